@@ -41,72 +41,784 @@
 #endif
 
 #ifdef __cplusplus
+#include <vector>
 #include <log4cplus/configurator.h>
+#include "fty_logger_format.h"
+#include "fty_logger_kv.h"
 #endif
+
+#ifdef __cplusplus
+class Ftylog;
+#else
+typedef struct Ftylog Ftylog;
+#endif
+
+//Effective log level of a Ftylog object, cached for the logging macros so
+//they check it without a function call.
+//Ftylog derives from this structure, see ftylog_levelState().
+typedef struct FtylogLevelState
+{
+    int effectiveLevel;
+    //Value of ftylog_levelGeneration when effectiveLevel was read
+    unsigned int levelGeneration;
+    //Identifies the logger in the results cached by the call sites: never
+    //0, and below 1 << FTYLOG_LOGGER_ID_BITS
+    unsigned int loggerId;
+} FtylogLevelState;
+
+#define FTYLOG_LOGGER_ID_BITS 23
+
+//Level state of a logger. Ftylog derives from FtylogLevelState only and has
+//no virtual function, so the state is at the address of the object; the
+//library checks it at compile time (see fty_logger.cc).
+static inline const FtylogLevelState * ftylog_levelState(const Ftylog * log)
+{
+    return (const FtylogLevelState *) (const void *) log;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+//Bumped by every change which may change the level of any logger: level
+//setters, verbose mode, loading or reloading a configuration file (which
+//resets all the loggers). A different value invalidates the cached levels.
+extern unsigned int ftylog_levelGeneration;
+
+//Read the level of the logger again, after a change of generation
+void ftylog_refreshLevel(Ftylog * log);
+
+//Default logger of the log_trace() ... log_fatal() macros, published once
+//it is built and NULL before (and after it is destroyed at exit)
+extern Ftylog * ftylog_defaultInstance;
+//Build the default logger if needed and return it
+Ftylog * ftylog_getInstance();
+#ifdef __cplusplus
+}
+#endif
+
+//Default logger, with one load once built instead of a function call
+static inline Ftylog * ftylog_defaultLogger(void)
+{
+    Ftylog * log = __atomic_load_n(&ftylog_defaultInstance, __ATOMIC_ACQUIRE);
+    return __builtin_expect(log != NULL, 1) ? log : ftylog_getInstance();
+}
+
+//Return true if a message of the given level passes the level of the logger.
+//This costs two relaxed atomic loads of lines shared by all the call sites
+//and two compares; the level is read again after a level change.
+static inline bool ftylog_isLevelEnabled(Ftylog * log, int level)
+{
+    const FtylogLevelState * state = ftylog_levelState(log);
+    if (__builtin_expect(__atomic_load_n(&state->levelGeneration, __ATOMIC_ACQUIRE) !=
+                         __atomic_load_n(&ftylog_levelGeneration, __ATOMIC_RELAXED), 0))
+    {
+        ftylog_refreshLevel(log);
+    }
+    return __atomic_load_n(&state->effectiveLevel, __ATOMIC_RELAXED) <= level;
+}
+
+//State of one call site of the rate limited macros (log_error_every_n,
+//log_warning_ratelimited, log_info_once...), in static storage created by
+//the macro and updated with atomic operations only
+typedef struct FtylogRateLimit
+{
+    //Calls seen (every N, once) or calls in the current window (rate limit)
+    unsigned long long count;
+    //Calls suppressed since the last message
+    unsigned long long suppressed;
+    //Current window of the rate limit, in seconds of CLOCK_MONOTONIC
+    long long window;
+} FtylogRateLimit;
+
+//Let one call out of n through. Return true if the message must be
+//logged, with the number of calls suppressed since the previous one.
+static inline bool ftylog_rateLimitEveryN(FtylogRateLimit * limit, unsigned long long n,
+                                          unsigned long long * suppressed)
+{
+    unsigned long long count = __atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED);
+    if ((n > 1) && ((count % n) != 0))
+    {
+        __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+    return true;
+}
+
+//Let the first call only through
+static inline bool ftylog_rateLimitOnce(FtylogRateLimit * limit, unsigned long long * suppressed)
+{
+    *suppressed = 0;
+    return __atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) == 0;
+}
+
+//Mutable state of a call site, in static storage created by the macro
+typedef struct FtylogSiteLevel
+{
+    //Level override of the call site (see BIOS_LOG_LEVEL), kept by the
+    //logging functions until the override rules change. Zero means not
+    //known yet.
+    unsigned long long cached;
+    //Decision of the inline level check, for the last logger used at the
+    //call site: ftylog_levelGeneration when it was taken (high 32 bits),
+    //the loggerId of the logger shifted left by one, or 1 if the level is
+    //enabled. A call with another logger takes its own decision and
+    //replaces it.
+    unsigned long long decision;
+} FtylogSiteLevel;
+
+//Description of one call site of the logging macros, created by the macro
+//in static storage and known at compile time: the logging functions get
+//one pointer instead of the level, file, line and function. Its address
+//identifies the call site.
+typedef struct FtylogCallSite
+{
+    int level;
+    //__FILE__, and the file name without its directories
+    const char * file;
+    const char * basename;
+    int line;
+    const char * func;
+    //"file:line"
+    const char * location;
+    //Mutable state of the call site, in static storage too
+    FtylogSiteLevel * levelCache;
+} FtylogCallSite;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+//Take the decision of the inline level check for a call site again, after
+//a change of generation or with another logger than the one it caches
+bool ftylog_refreshSite(Ftylog * log, const FtylogCallSite * site);
+#ifdef __cplusplus
+}
+#endif
+
+//Return true if the message of the call site must be given to the logger.
+//The decision includes the level override and the flight recorder; it is
+//taken once per level change: a disabled call site costs two relaxed
+//atomic loads of its own state, one of the generation and the compares.
+static inline bool ftylog_isSiteEnabled(Ftylog * log, const FtylogCallSite * site)
+{
+    const FtylogLevelState * logState = ftylog_levelState(log);
+    unsigned long long decision = __atomic_load_n(&site->levelCache->decision, __ATOMIC_RELAXED);
+    if (__builtin_expect((decision | 1) ==
+                         (((unsigned long long) __atomic_load_n(&ftylog_levelGeneration,
+                                                                __ATOMIC_RELAXED) << 32) |
+                          ((unsigned long long) logState->loggerId << 1) | 1), 1))
+    {
+        return (decision & 1) != 0;
+    }
+    return ftylog_refreshSite(log, site);
+}
+
+//Levels counted by FtylogStats: index level / 10000, TRACE to FATAL
+#define FTYLOG_STATS_LEVELS 6
+//Buckets of the latency histogram of FtylogStats: bucket i counts the calls
+//shorter than 256 << i nanoseconds, the last one all the longer calls
+#define FTYLOG_STATS_LATENCY_BUCKETS 16
+
+//Counters of a Ftylog object since its creation (see ftylog_getStats).
+//The messages rejected by the inline level check of the macros never
+//reach the logging functions and are not counted.
+typedef struct FtylogStats
+{
+    //Messages given to the appenders (or queued in asynchronous mode)
+    unsigned long long emitted[FTYLOG_STATS_LEVELS];
+    //Messages which reached the logging functions and were rejected by the
+    //level of the logger or of their call site
+    unsigned long long filtered[FTYLOG_STATS_LEVELS];
+    //Length of the messages formatted by the calling threads
+    unsigned long long bytesFormatted;
+    //Messages which could not be formatted
+    unsigned long long formatFailures;
+    //Messages lost after passing the level check (format failures included)
+    unsigned long long dropped;
+    //Calls of the rate limited macros suppressed, counted with the next
+    //message of their call site
+    unsigned long long suppressed;
+    //Messages which waited for room in the queue of the asynchronous mode
+    //(it never drops a message)
+    unsigned long long queueFullWaits;
+    //Calls of the logging functions, with the time spent in them
+    unsigned long long calls;
+    unsigned long long latency[FTYLOG_STATS_LATENCY_BUCKETS];
+    unsigned long long latencyTotalNs;
+} FtylogStats;
+
+#define ftylog_stringify_(x) #x
+#define ftylog_stringify(x) ftylog_stringify_(x)
+
+#ifdef __cplusplus
+//Part of path after its last '/' (name if there is none), computed by the
+//compiler in the call site descriptors
+constexpr const char * ftylog_basename(const char * path, const char * name)
+{
+    return (*path == '\0') ? name : ftylog_basename(path + 1, (*path == '/') ? path + 1 : name);
+}
+
+#define ftylog_call_site(level) \
+    static FtylogSiteLevel ftylog_macro_site_level_; \
+    static constexpr FtylogCallSite ftylog_macro_call_site_ = \
+        { (level), __FILE__, ftylog_basename(__FILE__, __FILE__), __LINE__, __func__, \
+          __FILE__ ":" ftylog_stringify(__LINE__), &ftylog_macro_site_level_ }
+#else
+//C has no constant expression for the base name: the compiler gives it
+//(GCC 12, clang 9) or the descriptor keeps the whole path
+#ifdef __FILE_NAME__
+#define FTYLOG_FILE_NAME __FILE_NAME__
+#else
+#define FTYLOG_FILE_NAME __FILE__
+#endif
+
+#define ftylog_call_site(level) \
+    static FtylogSiteLevel ftylog_macro_site_level_; \
+    static const FtylogCallSite ftylog_macro_call_site_ = \
+        { (level), __FILE__, FTYLOG_FILE_NAME, __LINE__, __func__, \
+          __FILE__ ":" ftylog_stringify(__LINE__), &ftylog_macro_site_level_ }
+#endif
+
 //Macro for logging
+//The level is checked inline: the arguments of a disabled message are not
+//evaluated and no function is called for it.
 
 #ifdef __cplusplus
 
 #define log_macro(level,ftylogger, ...) \
     do { \
-        ftylogger->insertLog((level), __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            ftylog_macro_logger_->insertLog(&ftylog_macro_call_site_, __VA_ARGS__); \
+        } \
     } while(0)
 #else
 #define log_macro(level,ftylogger, ...) \
     do { \
-        ftylog_insertLog(ftylogger,(level), __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            ftylog_insertLogSite(ftylog_macro_logger_, &ftylog_macro_call_site_, __VA_ARGS__); \
+        } \
+    } while(0)
+#endif
+
+//Minimum level of the log statements compiled in. Statements of a lower
+//level expand to nothing (their format is still checked by the compiler).
+//Define it in the CPPFLAGS of a project (e.g.
+//-DFTY_LOG_COMPILED_MIN_LEVEL=FTY_LOG_LEVEL_INFO), or per translation unit
+//before including this header. It only applies to the code which defines it.
+#define FTY_LOG_LEVEL_TRACE   0
+#define FTY_LOG_LEVEL_DEBUG   10000
+#define FTY_LOG_LEVEL_INFO    20000
+#define FTY_LOG_LEVEL_WARNING 30000
+#define FTY_LOG_LEVEL_ERROR   40000
+#define FTY_LOG_LEVEL_FATAL   50000
+
+#ifndef FTY_LOG_COMPILED_MIN_LEVEL
+#define FTY_LOG_COMPILED_MIN_LEVEL FTY_LOG_LEVEL_TRACE
+#endif
+
+//Never called: lets the compiler check the format of stripped statements
+static inline void ftylog_checkFormat(const char * format, ...)
+    __attribute__ ((format (printf, 1, 2)));
+static inline void ftylog_checkFormat(const char * format, ...)
+{
+    (void) format;
+}
+
+//Replacement of log_macro for the levels stripped at compile time:
+//neither the logger nor the arguments are evaluated and no code is emitted
+#define log_macro_stripped(ftylogger, ...) \
+    do { \
+        if (0) { \
+            (void) (ftylogger); \
+            ftylog_checkFormat(__VA_ARGS__); \
+        } \
     } while(0)
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_TRACE
+#define ftylog_macro_trace(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_trace(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_TRACE, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_DEBUG
+#define ftylog_macro_debug(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_debug(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_DEBUG, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_INFO
+#define ftylog_macro_info(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_info(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_INFO, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_WARNING
+#define ftylog_macro_warning(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_warning(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_WARNING, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_ERROR
+#define ftylog_macro_error(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_error(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_ERROR, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_FATAL
+#define ftylog_macro_fatal(ftylogger, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_macro_fatal(ftylogger, ...) \
+        log_macro(FTY_LOG_LEVEL_FATAL, ftylogger, __VA_ARGS__)
 #endif
 
 //Logging with explicit logger
 /* Prints message with TRACE level. 0 <=> log4cplus::TRACE_LOG_LEVEL */
 #define log_trace_log(ftylogger,...) \
-        log_macro(0,ftylogger, __VA_ARGS__)
+        ftylog_macro_trace(ftylogger, __VA_ARGS__)
 
 /* Prints message with DEBUG level. 10000 <=> log4cplus::DEBUG_LOG_LEVEL */
 #define log_debug_log(ftylogger,...) \
-        log_macro(10000,ftylogger, __VA_ARGS__)
+        ftylog_macro_debug(ftylogger, __VA_ARGS__)
 
 /* Prints message with INFO level. 20000 <=> log4cplus::INFO_LOG_LEVEL */
 #define log_info_log(ftylogger,...) \
-        log_macro(20000,ftylogger, __VA_ARGS__)
+        ftylog_macro_info(ftylogger, __VA_ARGS__)
 
 /* Prints message with WARNING level 30000 <=> log4cplus::WARN_LOG_LEVEL*/
 #define log_warning_log(ftylogger,...) \
-        log_macro(30000,ftylogger, __VA_ARGS__)
+        ftylog_macro_warning(ftylogger, __VA_ARGS__)
 
 /* Prints message with ERROR level 40000 <=> log4cplus::ERROR_LOG_LEVEL*/
 #define log_error_log(ftylogger,...) \
-        log_macro(40000,ftylogger, __VA_ARGS__)
+        ftylog_macro_error(ftylogger, __VA_ARGS__)
 
 /* Prints message with FATAL level. 50000 <=> log4cplus::FATAL_LOG_LEVEL*/
 #define log_fatal_log(ftylogger,...) \
-        log_macro(50000,ftylogger, __VA_ARGS__)
+        ftylog_macro_fatal(ftylogger, __VA_ARGS__)
 
 //Logging with default logger
 /* Prints message with TRACE level. 0 <=> log4cplus::TRACE_LOG_LEVEL */
 #define log_trace(...) \
-        log_macro(0,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_trace(ftylog_defaultLogger(), __VA_ARGS__)
 
 /* Prints message with DEBUG level. 10000 <=> log4cplus::DEBUG_LOG_LEVEL */
 #define log_debug(...) \
-        log_macro(10000,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_debug(ftylog_defaultLogger(), __VA_ARGS__)
 
 /* Prints message with INFO level. 20000 <=> log4cplus::INFO_LOG_LEVEL */
 #define log_info(...) \
-        log_macro(20000,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_info(ftylog_defaultLogger(), __VA_ARGS__)
 
 /* Prints message with WARNING level 30000 <=> log4cplus::WARN_LOG_LEVEL*/
 #define log_warning(...) \
-        log_macro(30000,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_warning(ftylog_defaultLogger(), __VA_ARGS__)
 
 /* Prints message with ERROR level 40000 <=> log4cplus::ERROR_LOG_LEVEL*/
 #define log_error(...) \
-        log_macro(40000,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_error(ftylog_defaultLogger(), __VA_ARGS__)
 
 /* Prints message with FATAL level. 50000 <=> log4cplus::FATAL_LOG_LEVEL*/
 #define log_fatal(...) \
-        log_macro(50000,ftylog_getInstance(), __VA_ARGS__)
+        ftylog_macro_fatal(ftylog_defaultLogger(), __VA_ARGS__)
+
+#ifdef __cplusplus
+//Macros for the "{} of {}" format of the template API (see
+//fty_logger_format.h). The format must be a string literal: the number
+//of {} is checked against the number of arguments at compile time.
+#define ftylog_fmt_first(first, ...) first
+
+#define ftylog_fmt_check(...) \
+    static_assert(FtylogFormat::placeholders(ftylog_fmt_first(__VA_ARGS__, 0)) >= 0, \
+                  "Log format: unmatched { or }, write {{ and }} for braces"); \
+    static_assert(FtylogFormat::placeholders(ftylog_fmt_first(__VA_ARGS__, 0)) + 1 == \
+                  decltype(ftylog_countArgs(__VA_ARGS__))::value, \
+                  "Log format: the number of {} does not match the number of arguments")
+
+#define log_fmt_macro(level, ftylogger, ...) \
+    do { \
+        ftylog_fmt_check(__VA_ARGS__); \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            ftylog_macro_logger_->log(&ftylog_macro_call_site_, __VA_ARGS__); \
+        } \
+    } while(0)
+
+//The types of the arguments are still checked, no code is emitted
+#define log_fmt_macro_stripped(ftylogger, ...) \
+    do { \
+        ftylog_fmt_check(__VA_ARGS__); \
+        if (0) { \
+            (ftylogger)->log(FTY_LOG_LEVEL_FATAL, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+        } \
+    } while(0)
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_TRACE
+#define ftylog_fmt_macro_trace(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_trace(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_TRACE, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_DEBUG
+#define ftylog_fmt_macro_debug(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_debug(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_DEBUG, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_INFO
+#define ftylog_fmt_macro_info(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_info(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_INFO, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_WARNING
+#define ftylog_fmt_macro_warning(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_warning(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_WARNING, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_ERROR
+#define ftylog_fmt_macro_error(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_error(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_ERROR, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_FATAL
+#define ftylog_fmt_macro_fatal(ftylogger, ...) \
+        log_fmt_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_fmt_macro_fatal(ftylogger, ...) \
+        log_fmt_macro(FTY_LOG_LEVEL_FATAL, ftylogger, __VA_ARGS__)
+#endif
+
+//Logging with explicit logger, e.g. log_info_fmt_log(logger, "{} of {}", done, total)
+#define log_trace_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_trace(ftylogger, __VA_ARGS__)
+#define log_debug_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_debug(ftylogger, __VA_ARGS__)
+#define log_info_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_info(ftylogger, __VA_ARGS__)
+#define log_warning_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_warning(ftylogger, __VA_ARGS__)
+#define log_error_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_error(ftylogger, __VA_ARGS__)
+#define log_fatal_fmt_log(ftylogger,...) \
+        ftylog_fmt_macro_fatal(ftylogger, __VA_ARGS__)
+
+//Logging with default logger, e.g. log_info_fmt("{} of {}", done, total)
+#define log_trace_fmt(...) \
+        ftylog_fmt_macro_trace(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_debug_fmt(...) \
+        ftylog_fmt_macro_debug(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_info_fmt(...) \
+        ftylog_fmt_macro_info(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_warning_fmt(...) \
+        ftylog_fmt_macro_warning(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_error_fmt(...) \
+        ftylog_fmt_macro_error(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_fatal_fmt(...) \
+        ftylog_fmt_macro_fatal(ftylog_defaultLogger(), __VA_ARGS__)
+
+//Macros for structured messages (see fty_logger_kv.h): a message followed
+//by key/value pairs, the keys being string literals
+#define ftylog_kv_check(...) \
+    static_assert(decltype(ftylog_countArgs(__VA_ARGS__))::value % 2 == 1, \
+                  "Structured log: a key without a value")
+
+#define log_kv_macro(level, ftylogger, ...) \
+    do { \
+        ftylog_kv_check(__VA_ARGS__); \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            static FtylogKvSite ftylog_macro_site_; \
+            ftylog_macro_logger_->logKv(&ftylog_macro_call_site_, ftylog_macro_site_, __VA_ARGS__); \
+        } \
+    } while(0)
+
+//The types of the arguments are still checked, no code is emitted
+#define log_kv_macro_stripped(ftylogger, ...) \
+    do { \
+        ftylog_kv_check(__VA_ARGS__); \
+        if (0) { \
+            static FtylogKvSite ftylog_macro_site_; \
+            (ftylogger)->logKv(FTY_LOG_LEVEL_FATAL, __FILE__, __LINE__, __func__, \
+                               ftylog_macro_site_, __VA_ARGS__); \
+        } \
+    } while(0)
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_TRACE
+#define ftylog_kv_macro_trace(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_trace(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_TRACE, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_DEBUG
+#define ftylog_kv_macro_debug(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_debug(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_DEBUG, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_INFO
+#define ftylog_kv_macro_info(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_info(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_INFO, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_WARNING
+#define ftylog_kv_macro_warning(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_warning(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_WARNING, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_ERROR
+#define ftylog_kv_macro_error(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_error(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_ERROR, ftylogger, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_FATAL
+#define ftylog_kv_macro_fatal(ftylogger, ...) \
+        log_kv_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_kv_macro_fatal(ftylogger, ...) \
+        log_kv_macro(FTY_LOG_LEVEL_FATAL, ftylogger, __VA_ARGS__)
+#endif
+
+//Logging with explicit logger, e.g. log_info_kv_log(logger, "Power changed", "power", watts)
+#define log_trace_kv_log(ftylogger,...) \
+        ftylog_kv_macro_trace(ftylogger, __VA_ARGS__)
+#define log_debug_kv_log(ftylogger,...) \
+        ftylog_kv_macro_debug(ftylogger, __VA_ARGS__)
+#define log_info_kv_log(ftylogger,...) \
+        ftylog_kv_macro_info(ftylogger, __VA_ARGS__)
+#define log_warning_kv_log(ftylogger,...) \
+        ftylog_kv_macro_warning(ftylogger, __VA_ARGS__)
+#define log_error_kv_log(ftylogger,...) \
+        ftylog_kv_macro_error(ftylogger, __VA_ARGS__)
+#define log_fatal_kv_log(ftylogger,...) \
+        ftylog_kv_macro_fatal(ftylogger, __VA_ARGS__)
+
+//Logging with default logger, e.g. log_info_kv("Power changed", "asset", id, "power", watts)
+#define log_trace_kv(...) \
+        ftylog_kv_macro_trace(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_debug_kv(...) \
+        ftylog_kv_macro_debug(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_info_kv(...) \
+        ftylog_kv_macro_info(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_warning_kv(...) \
+        ftylog_kv_macro_warning(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_error_kv(...) \
+        ftylog_kv_macro_error(ftylog_defaultLogger(), __VA_ARGS__)
+#define log_fatal_kv(...) \
+        ftylog_kv_macro_fatal(ftylog_defaultLogger(), __VA_ARGS__)
+#endif // __cplusplus
+
+//Rate limited logging: the limit is checked (and counted) only when the
+//level is enabled, and the message of a suppressed call is not formatted.
+//A message logged after suppressed ones ends with the number of them.
+#ifdef __cplusplus
+#define log_macro_limited(level, ftylogger, allowed, ...) \
+    do { \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            static FtylogRateLimit ftylog_macro_limit_; \
+            unsigned long long ftylog_macro_suppressed_ = 0; \
+            if (allowed) { \
+                ftylog_macro_logger_->insertLogSuppressed(ftylog_macro_suppressed_, \
+                    &ftylog_macro_call_site_, __VA_ARGS__); \
+            } \
+        } \
+    } while(0)
+#else
+#define log_macro_limited(level, ftylogger, allowed, ...) \
+    do { \
+        ftylog_call_site(level); \
+        Ftylog * ftylog_macro_logger_ = (ftylogger); \
+        if (ftylog_isSiteEnabled(ftylog_macro_logger_, &ftylog_macro_call_site_)) { \
+            static FtylogRateLimit ftylog_macro_limit_; \
+            unsigned long long ftylog_macro_suppressed_ = 0; \
+            if (allowed) { \
+                ftylog_insertLogSuppressedSite(ftylog_macro_logger_, ftylog_macro_suppressed_, \
+                    &ftylog_macro_call_site_, __VA_ARGS__); \
+            } \
+        } \
+    } while(0)
+#endif
+
+//Conditions of log_macro_limited
+#define ftylog_limit_every_n(n) \
+    ftylog_rateLimitEveryN(&ftylog_macro_limit_, (n), &ftylog_macro_suppressed_)
+#define ftylog_limit_per_second(perSecond) \
+    ftylog_rateLimitPerSecond(&ftylog_macro_limit_, (perSecond), &ftylog_macro_suppressed_)
+#define ftylog_limit_once() \
+    ftylog_rateLimitOnce(&ftylog_macro_limit_, &ftylog_macro_suppressed_)
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_TRACE
+#define ftylog_limited_macro_trace(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_trace(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_TRACE, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_DEBUG
+#define ftylog_limited_macro_debug(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_debug(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_DEBUG, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_INFO
+#define ftylog_limited_macro_info(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_info(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_INFO, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_WARNING
+#define ftylog_limited_macro_warning(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_warning(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_WARNING, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_ERROR
+#define ftylog_limited_macro_error(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_error(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_ERROR, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+#if FTY_LOG_COMPILED_MIN_LEVEL > FTY_LOG_LEVEL_FATAL
+#define ftylog_limited_macro_fatal(ftylogger, allowed, ...) \
+        log_macro_stripped(ftylogger, __VA_ARGS__)
+#else
+#define ftylog_limited_macro_fatal(ftylogger, allowed, ...) \
+        log_macro_limited(FTY_LOG_LEVEL_FATAL, ftylogger, allowed, __VA_ARGS__)
+#endif
+
+//Log one call out of n, e.g. log_error_every_n(100, "Can't reach %s", host)
+#define log_trace_every_n(n, ...) \
+        ftylog_limited_macro_trace(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_debug_every_n(n, ...) \
+        ftylog_limited_macro_debug(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_info_every_n(n, ...) \
+        ftylog_limited_macro_info(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_warning_every_n(n, ...) \
+        ftylog_limited_macro_warning(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_error_every_n(n, ...) \
+        ftylog_limited_macro_error(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_fatal_every_n(n, ...) \
+        ftylog_limited_macro_fatal(ftylog_defaultLogger(), ftylog_limit_every_n(n), __VA_ARGS__)
+
+#define log_trace_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_trace(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_debug_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_debug(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_info_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_info(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_warning_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_warning(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_error_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_error(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+#define log_fatal_every_n_log(ftylogger, n, ...) \
+        ftylog_limited_macro_fatal(ftylogger, ftylog_limit_every_n(n), __VA_ARGS__)
+
+//Log at most perSecond calls per second (of CLOCK_MONOTONIC),
+//e.g. log_warning_ratelimited(10, "Queue %s is full", name)
+#define log_trace_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_trace(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_debug_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_debug(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_info_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_info(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_warning_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_warning(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_error_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_error(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_fatal_ratelimited(perSecond, ...) \
+        ftylog_limited_macro_fatal(ftylog_defaultLogger(), ftylog_limit_per_second(perSecond), __VA_ARGS__)
+
+#define log_trace_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_trace(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_debug_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_debug(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_info_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_info(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_warning_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_warning(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_error_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_error(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+#define log_fatal_ratelimited_log(ftylogger, perSecond, ...) \
+        ftylog_limited_macro_fatal(ftylogger, ftylog_limit_per_second(perSecond), __VA_ARGS__)
+
+//Log the first call only
+#define log_trace_once(...) \
+        ftylog_limited_macro_trace(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+#define log_debug_once(...) \
+        ftylog_limited_macro_debug(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+#define log_info_once(...) \
+        ftylog_limited_macro_info(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+#define log_warning_once(...) \
+        ftylog_limited_macro_warning(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+#define log_error_once(...) \
+        ftylog_limited_macro_error(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+#define log_fatal_once(...) \
+        ftylog_limited_macro_fatal(ftylog_defaultLogger(), ftylog_limit_once(), __VA_ARGS__)
+
+#define log_trace_once_log(ftylogger, ...) \
+        ftylog_limited_macro_trace(ftylogger, ftylog_limit_once(), __VA_ARGS__)
+#define log_debug_once_log(ftylogger, ...) \
+        ftylog_limited_macro_debug(ftylogger, ftylog_limit_once(), __VA_ARGS__)
+#define log_info_once_log(ftylogger, ...) \
+        ftylog_limited_macro_info(ftylogger, ftylog_limit_once(), __VA_ARGS__)
+#define log_warning_once_log(ftylogger, ...) \
+        ftylog_limited_macro_warning(ftylogger, ftylog_limit_once(), __VA_ARGS__)
+#define log_error_once_log(ftylogger, ...) \
+        ftylog_limited_macro_error(ftylogger, ftylog_limit_once(), __VA_ARGS__)
+#define log_fatal_once_log(ftylogger, ...) \
+        ftylog_limited_macro_fatal(ftylogger, ftylog_limit_once(), __VA_ARGS__)
 
 #define LOG_START \
     log_debug("start")
@@ -122,9 +834,20 @@
 
 //  @interface
 #ifdef __cplusplus
+//Asynchronous backend, see src/fty-log/fty_log_backend.h
+class FtylogBackend;
+//Configuration file watcher, see src/fty-log/fty_log_watcher.h
+class FtylogConfigWatcher;
+//Flight recorder, see src/fty-log/fty_log_recorder.h
+class FtylogFlightRecorder;
+//Counters of the logging functions, see src/fty-log/fty_log_stats.h
+class FtylogStatsCounters;
+//Structured part of a message, see src/fty-log/fty_log_json.h
+struct FtylogStructured;
+
 //Log class
 
-class Ftylog
+class Ftylog : public FtylogLevelState
 {
 private:
   //Name of the agent/component
@@ -136,7 +859,28 @@ private:
   //log4cplus object to print logs
   log4cplus::Logger _logger;
   //Thread for watching modification of the log configuration file if any
-  log4cplus::ConfigureAndWatchThread * _watchConfigFile;
+  FtylogConfigWatcher * _watchConfigFile;
+  //True if messages are handed over to a backend thread
+  bool _asyncMode;
+  //True if the backend thread formats the messages, see setDeferredFormatting
+  bool _deferredFormat;
+  //True if each thread has its own queue, see setPerThreadQueues
+  bool _perThreadQueues;
+  //Queue and thread writing the messages in asynchronous mode, NULL otherwise
+  FtylogBackend * _backend;
+  //Keeps the messages below the level of the logger, NULL if not enabled
+  FtylogFlightRecorder * _recorder;
+  //Lowest level recorded by _recorder
+  log4cplus::LogLevel _recordLevel;
+  //Level of the logger itself; effectiveLevel is lower when the flight
+  //recorder needs the messages the logger rejects
+  int _loggerLevel;
+  //Counters of the logging functions
+  FtylogStatsCounters * _stats;
+  //Interval of the statistics line in nanoseconds of CLOCK_MONOTONIC (zero
+  //for none), and time of the next one
+  unsigned long long _statsInterval;
+  unsigned long long _nextStatsLine;
 
   //Initialize the Ftylog object
   void init (std::string _component, std::string logConfigFile = "");
@@ -144,6 +888,28 @@ private:
   //Return true if level is included in the logger level
   bool isLogLevel(log4cplus::LogLevel level);
 
+  //Set the level of the logger and of the inline level check
+  void setLogLevel(log4cplus::LogLevel level);
+  //Copy the level of the logger to the inline level check
+  void refreshLogLevel();
+  //Invalidate the level cached by every Ftylog object, after something
+  //(e.g. a configuration file) may have changed the level of loggers
+  void levelChanged();
+  friend void ftylog_refreshLevel(Ftylog * log);
+  //Take the decision of the inline level check of a call site
+  bool refreshSite(const FtylogCallSite * site);
+  friend bool ftylog_refreshSite(Ftylog * log, const FtylogCallSite * site);
+
+  //Stop the thread watching the configuration file; done before
+  //_configFile or the appenders change, as the thread reads them
+  void stopConfigWatcher();
+  //Load the configuration file again, called by the watching thread with
+  //its own copy of the path when the file is modified
+  void reloadConfigFile(const std::string & file);
+  //Read the level overrides (ftylog.levels) of the configuration file,
+  //none if file is empty
+  void loadLevelOverrides(const std::string & file);
+
   //Set the console appender
   void setConsoleAppender();
 
@@ -163,14 +929,51 @@ private:
   // log level set to trace level otherwise
   void setLogLevelFromEnv(const std::string& level);
 
-  //Set needed variables from env
+  //Set needed variables from env; BIOS_LOG_LEVEL also gives the level
+  //overrides of source files and functions
   void setLogLevelFromEnv();
   void setPatternFromEnv();
+  static void setClockFromEnv();
+  void setStatsIntervalFromEnv();
+  //Return true if BIOS_LOG_BATCH enables the batching console appender
+  static bool isBatchFromEnv();
 
   //Load appenders from the config file
   // or set the default console appender if no can't load from the config file
   void loadAppenders();
 
+  //Start or stop the backend thread according to _asyncMode
+  void startBackend();
+  void stopBackend();
+
+  //Print a message already formatted, with its structured part if any;
+  //dumped tells that the caller already checked the flight recorder
+  void insertRecord(log4cplus::LogLevel level, const char* file, int line,
+                    const char* func, const char* message, size_t length,
+                    const FtylogStructured * structured, bool dumped = false);
+  //Dump the flight recorder if level is its trigger level or above, and
+  //return true if it did
+  bool triggerFlightRecorder(log4cplus::LogLevel level);
+
+  //Counts one call of the logging functions and the time spent in it,
+  //then writes the statistics line when it is due
+  class CallStats
+  {
+  private:
+    Ftylog * _log;
+    unsigned long long _begin;
+
+    CallStats(const CallStats&) = delete;
+    CallStats& operator=(const CallStats&) = delete;
+
+  public:
+    explicit CallStats(Ftylog * log);
+    ~CallStats();
+  };
+  friend class CallStats;
+  //Write the statistics line
+  void insertStatsLine();
+
 public:
   //Constructor/destructor
   Ftylog(std::string _component, std::string logConfigFile = "");
@@ -220,6 +1023,167 @@ public:
   void insertLog(log4cplus::LogLevel level, const char* file, int line,
                  const char* func, const char* format, va_list args);
 
+  //Same as insertLog, with the number of similar messages suppressed by
+  //the rate limited macros since the previous one (added to the message)
+  void insertLogSuppressed(unsigned long long suppressed, log4cplus::LogLevel level,
+                           const char* file, int line, const char* func,
+                           const char* format, ...);
+
+  //The variants taking a va_list have another name: with the same one, a
+  //null pointer constant argument (e.g. 0 for %d) would select them
+  void insertLogSuppressedV(unsigned long long suppressed, log4cplus::LogLevel level,
+                            const char* file, int line, const char* func,
+                            const char* format, va_list args);
+
+  //Level override of a call site (see BIOS_LOG_LEVEL): while it exists,
+  //the messages the calling thread logs to log are filtered with the level
+  //of the override instead of the level of the logger
+  class SiteScope
+  {
+  private:
+    bool _active;
+    bool _enabled;
+    const Ftylog * _previousLog;
+    int _previousLevel;
+
+    SiteScope(const SiteScope&) = delete;
+    SiteScope& operator=(const SiteScope&) = delete;
+
+  public:
+    SiteScope(const Ftylog * log, const FtylogCallSite * site);
+    ~SiteScope();
+
+    //False if the level of the site is below its override
+    bool enabled() const
+    {
+      return _enabled;
+    }
+  };
+
+  //Same as insertLog and insertLogSuppressed, for the descriptor of the
+  //call site created by the logging macros
+  void insertLog(const FtylogCallSite* site, const char* format, ...);
+
+  void insertLogV(const FtylogCallSite* site, const char* format, va_list args);
+
+  void insertLogSuppressed(unsigned long long suppressed, const FtylogCallSite* site,
+                           const char* format, ...);
+
+  void insertLogSuppressedV(unsigned long long suppressed, const FtylogCallSite* site,
+                            const char* format, va_list args);
+
+  //Print a message already formatted
+  void insertMessage(log4cplus::LogLevel level, const char* file, int line,
+                     const char* func, const char* message, size_t length);
+
+  //Print a structured message already encoded: text is "message key=value...",
+  //fields the JSON members of the key/value pairs (see fty_logger_kv.h)
+  void insertStructured(log4cplus::LogLevel level, const char* file, int line,
+                        const char* func, const char* text, size_t textLength,
+                        size_t messageLength, const char* fields, size_t fieldsLength);
+
+  //Buffer of the calling thread for the messages of the template API
+  static std::string & messageBuffer();
+  //Buffer of the calling thread for the JSON fields of structured messages
+  static std::string & fieldsBuffer();
+
+  //Template API: format is "{} of {}" (see fty_logger_format.h), the
+  //arguments are printed according to their type. trace() ... fatal() get
+  //the call site from FtylogLocatedFormat; the log_*_fmt macros also check
+  //the format at compile time.
+  template <typename... Args>
+  void log(log4cplus::LogLevel level, const char* file, int line,
+           const char* func, const char* format, const Args&... args)
+  {
+    if (ftylog_isLevelEnabled(this, level))
+    {
+      std::string & buffer = messageBuffer();
+      FtylogFormat::format(buffer, format, args...);
+      insertMessage(level, file, line, func, buffer.data(), buffer.size());
+    }
+  }
+
+  template <typename... Args>
+  void log(const FtylogCallSite* site, const char* format, const Args&... args)
+  {
+    if (ftylog_isSiteEnabled(this, site))
+    {
+      SiteScope scope(this, site);
+      if (scope.enabled())
+      {
+        log(site->level, site->file, site->line, site->func, format, args...);
+      }
+    }
+  }
+
+  //Structured message: args are key/value pairs, the keys being string
+  //literals. The log_*_kv macros give the call site, which keeps the keys
+  //escaped once for all.
+  template <typename... Args>
+  void logKv(log4cplus::LogLevel level, const char* file, int line,
+             const char* func, FtylogKvSite & site, const char* message,
+             const Args&... args)
+  {
+    if (ftylog_isLevelEnabled(this, level))
+    {
+      std::string & text = messageBuffer();
+      std::string & fields = fieldsBuffer();
+      size_t messageLength = FtylogKv::encode(site, text, fields, message, args...);
+      insertStructured(level, file, line, func, text.data(), text.size(),
+                       messageLength, fields.data(), fields.size());
+    }
+  }
+
+  template <typename... Args>
+  void logKv(const FtylogCallSite* site, FtylogKvSite & kvSite, const char* message,
+             const Args&... args)
+  {
+    if (ftylog_isSiteEnabled(this, site))
+    {
+      SiteScope scope(this, site);
+      if (scope.enabled())
+      {
+        logKv(site->level, site->file, site->line, site->func, kvSite, message, args...);
+      }
+    }
+  }
+
+  template <typename... Args>
+  void trace(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::TRACE_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
+  template <typename... Args>
+  void debug(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::DEBUG_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
+  template <typename... Args>
+  void info(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::INFO_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
+  template <typename... Args>
+  void warning(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::WARN_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
+  template <typename... Args>
+  void error(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::ERROR_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
+  template <typename... Args>
+  void fatal(FtylogLocatedFormat format, const Args&... args)
+  {
+    log(log4cplus::FATAL_LOG_LEVEL, format.file, format.line, format.func, format.format, args...);
+  }
+
   //Load a specific appender if verbose mode is set to true :
   // -Save the logger logging level and set it to TRACE logging level
   // -Remove an already existing ConsoleAppender
@@ -228,9 +1192,62 @@ public:
   // -Add a new console appender
   void setVeboseMode();
 
+  //Switch the asynchronous mode on or off. When on, insertLog() only
+  //formats the message and queues it; a backend thread writes it to the
+  //appenders. Call it at startup, before other threads use this logger.
+  void setAsyncMode(bool asyncMode);
+  bool isAsyncMode();
+
+  //In asynchronous mode, let the backend thread format the messages:
+  //insertLog() only copies the format and the arguments (strings included).
+  //Messages with formats that can not be deferred (%n, %m, wide strings,
+  //positional arguments) are still formatted by the caller.
+  void setDeferredFormatting(bool deferredFormat);
+  bool isDeferredFormatting();
+
+  //In asynchronous mode, give each thread its own queue instead of one
+  //shared by all of them: the threads logging at the same time do not
+  //compete for the queue anymore. The backend thread writes the messages
+  //of all the queues in timestamp order. A queue is created on the first
+  //message of a thread and released when the thread exits.
+  //Call it at startup, before other threads use this logger.
+  void setPerThreadQueues(bool perThreadQueues);
+  bool isPerThreadQueues();
+
+  //Wait until all the messages queued in asynchronous mode are written
+  void flush();
+
+  //Keep the last messages rejected by the level of the logger, from
+  //recordLevel up, and write them to the appenders before the next message
+  //of triggerLevel or above. E.g. at INFO level, an ERROR is preceded by the
+  //DEBUG and TRACE messages which led to it. Each thread keeps its last
+  //records messages, formatted only when written, and truncated to
+  //FtylogFlightRecorder::DEFAULT_MESSAGE_LENGTH characters; past
+  //FtylogFlightRecorder::MAX_RINGS threads, the threads share these rings,
+  //so at most MAX_RINGS * records messages are kept. Zero records disable
+  //the recorder. Call it at startup, before other threads use
+  //this logger.
+  void setFlightRecorder(size_t records,
+                         log4cplus::LogLevel triggerLevel = log4cplus::ERROR_LOG_LEVEL,
+                         log4cplus::LogLevel recordLevel = log4cplus::TRACE_LOG_LEVEL);
+  //Write the recorded messages to the appenders now
+  void dumpFlightRecorder();
+
+  //Counters of the logging functions since the creation of this object,
+  //summed over the threads. Counting costs a few non-locked increments of
+  //counters of the calling thread and two reads of the clock per call.
+  FtylogStats getStats();
+  //Write the statistics as an INFO message every seconds seconds (zero
+  //for never, the default). The line is written by the first logging call
+  //after the interval, none is written while nothing is logged.
+  void setStatsInterval(unsigned int seconds);
+  //Statistics as written in the statistics line
+  static std::string formatStats(const FtylogStats & stats);
+
   /**
    * Set a context for a mapped diagnostic context (MDC)
    * @param contextParam The context params mapped.
+   * See FtylogScopedContext for a context set per scope without allocations.
    */
   static void setContext(const std::map<std::string, std::string>& contextParam);
 
@@ -240,6 +1257,60 @@ public:
   static void clearContext();
 };
 
+//Key/value pairs added to the context of the messages the calling thread
+//logs until the end of the scope, e.g.
+//  FtylogScopedContext context("request", requestId, "user", userName);
+//Values are printed like the arguments of log_info_fmt. Scopes nest, an
+//inner key hides the same outer key. Layouts see the pairs as MDC entries
+//(%X{request} of the pattern layouts); the pairs are kept in a buffer of
+//the thread, so entering and leaving a scope do not allocate memory.
+//Scopes must end in the reverse order of their creation, in the thread
+//which created them.
+class FtylogScopedContext
+{
+private:
+  //Depth of the context stack of the thread before this scope
+  size_t _depth;
+
+  static size_t depth();
+  static void push(const char* key, const std::string & value);
+  static void pop(size_t depth);
+  //Buffer of the calling thread for the text of the values
+  static std::string & valueBuffer();
+
+  void pushNext()
+  {
+  }
+
+  template <typename T, typename... Args>
+  void pushNext(const char* key, const T & value, const Args&... args)
+  {
+    std::string & text = valueBuffer();
+    text.clear();
+    ftylog_formatValue(text, value);
+    push(key, text);
+    pushNext(args...);
+  }
+
+  FtylogScopedContext(const FtylogScopedContext&) = delete;
+  FtylogScopedContext& operator=(const FtylogScopedContext&) = delete;
+
+public:
+  //args are key/value pairs, the keys being C strings
+  template <typename... Args>
+  explicit FtylogScopedContext(const Args&... args)
+    : _depth(depth())
+  {
+    static_assert(sizeof...(Args) % 2 == 0, "Scoped context: a key without a value");
+    pushNext(args...);
+  }
+
+  ~FtylogScopedContext()
+  {
+    pop(_depth);
+  }
+};
+
 //singleton for logger managment
 class ManageFtyLog
 {
@@ -249,17 +1320,39 @@ private:
   ~ManageFtyLog(){};
   ManageFtyLog(const ManageFtyLog&) = delete;
   ManageFtyLog& operator=(const ManageFtyLog&) = delete;
-  static Ftylog  _ftylogdefault;
+  //The instance, built on first use with the arguments of that call;
+  //created is set to true by the call building it
+  static Ftylog & instance(const char * componentName, const char * logConfigFile,
+                           bool * created);
 public:
 
   // Return the Ftylog obect from the instance
+  //The first call builds it with the component "ftylog" and the default
+  //configuration file, unless setInstanceFtylog was called before
   static Ftylog* getInstanceFtylog();
   //Create or replace the Ftylog object in the instance using a new Ftylog object
   static void setInstanceFtylog(std::string componentName, std::string logConfigFile = "");
+  //Same, then switch the asynchronous mode on or off: write the logs from
+  //a backend thread, see Ftylog::setAsyncMode
+  static void setInstanceFtylog(std::string componentName, std::string logConfigFile,
+                                bool asyncMode);
 };
 
-#else
-typedef struct Ftylog Ftylog;
+//One message read back from a file of the fty::RingFileAppender
+struct FtylogRingRecord
+{
+  //Number of the message in the file, in the order they were written
+  unsigned long long sequence;
+  std::string message;
+};
+
+//Read the messages which are still in a file of the fty::RingFileAppender,
+//in chronological order, e.g. after the process crashed. The file may be
+//read while a process is writing to it.
+//Return false and set error if the file can not be read or is not a ring file.
+bool ftylog_readRingFile(const std::string & file, std::vector<FtylogRingRecord> & records,
+                         std::string & error);
+
 #endif
 
 #ifdef __cplusplus
@@ -302,6 +1395,23 @@ bool ftylog_isLogFatal(Ftylog * log);
 void ftylog_insertLog(Ftylog * log, int level, const char* file, int line,
                       const char* func, const char* format, ...);
 
+//Procedure to print the log of the rate limited macros
+void ftylog_insertLogSuppressed(Ftylog * log, unsigned long long suppressed, int level,
+                                const char* file, int line, const char* func,
+                                const char* format, ...);
+
+//Same as ftylog_insertLog and ftylog_insertLogSuppressed, for the
+//descriptor of the call site created by the logging macros
+void ftylog_insertLogSite(Ftylog * log, const FtylogCallSite * site, const char* format, ...);
+void ftylog_insertLogSuppressedSite(Ftylog * log, unsigned long long suppressed,
+                                    const FtylogCallSite * site, const char* format, ...);
+
+//Let at most perSecond calls per second through (used by the
+//log_*_ratelimited macros). Return true if the message must be logged,
+//with the number of calls suppressed since the previous one.
+bool ftylog_rateLimitPerSecond(FtylogRateLimit * limit, unsigned int perSecond,
+                               unsigned long long * suppressed);
+
 //Load a specific appender if verbose mode is set to true :
 // -Save the logger logging level and set it to TRACE logging level
 // -Remove an already existing ConsoleAppender
@@ -310,6 +1420,23 @@ void ftylog_insertLog(Ftylog * log, int level, const char* file, int line,
 // -Add a new console appender
 void ftylog_setVeboseMode(Ftylog * log);
 
+//Switch the asynchronous mode on or off (see Ftylog::setAsyncMode)
+void ftylog_setAsyncMode(Ftylog * log, bool asyncMode);
+//Switch the deferred formatting on or off (see Ftylog::setDeferredFormatting)
+void ftylog_setDeferredFormatting(Ftylog * log, bool deferredFormat);
+//Give each thread its own queue in asynchronous mode (see Ftylog::setPerThreadQueues)
+void ftylog_setPerThreadQueues(Ftylog * log, bool perThreadQueues);
+//Wait until all the messages queued in asynchronous mode are written
+void ftylog_flush(Ftylog * log);
+//Keep the last messages rejected by the level of the logger, from
+//recordLevel up, and write them before the next message of triggerLevel or
+//above (see Ftylog::setFlightRecorder)
+void ftylog_setFlightRecorder(Ftylog * log, size_t records, int triggerLevel, int recordLevel);
+//Fill stats with the counters of the logging functions (see Ftylog::getStats)
+void ftylog_getStats(Ftylog * log, FtylogStats * stats);
+//Write the statistics every seconds seconds (see Ftylog::setStatsInterval)
+void ftylog_setStatsInterval(Ftylog * log, unsigned int seconds);
+
 // Return the Ftylog obect from the instance (C code)
 Ftylog * ftylog_getInstance();
 //Initialize the Ftylog object in the instance
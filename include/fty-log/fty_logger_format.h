@@ -0,0 +1,173 @@
+/*  =========================================================================
+    fty_logger_format - Type-safe formatting of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOGGER_FORMAT_H_INCLUDED
+#define FTY_LOGGER_FORMAT_H_INCLUDED
+
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <string>
+#include <type_traits>
+
+//  @interface
+//Formatting of "{} of {}" messages for the template API of Ftylog
+//(Ftylog::info(), log_info_fmt(), ...). Each {} is replaced with the text
+//of the next argument, "{{" and "}}" stand for "{" and "}".
+//The text of an argument is chosen by overload resolution on its static
+//type: a type without a ftylog_formatValue() overload does not compile.
+//Overload ftylog_formatValue(std::string &, const T &) to print your own
+//types; it is found by argument-dependent lookup.
+
+//Append the text of a value to out
+void ftylog_formatValue(std::string & out, bool value);
+void ftylog_formatValue(std::string & out, char value);
+void ftylog_formatValue(std::string & out, signed char value);
+void ftylog_formatValue(std::string & out, unsigned char value);
+void ftylog_formatValue(std::string & out, short value);
+void ftylog_formatValue(std::string & out, unsigned short value);
+void ftylog_formatValue(std::string & out, int value);
+void ftylog_formatValue(std::string & out, unsigned int value);
+void ftylog_formatValue(std::string & out, long value);
+void ftylog_formatValue(std::string & out, unsigned long value);
+void ftylog_formatValue(std::string & out, long long value);
+void ftylog_formatValue(std::string & out, unsigned long long value);
+//Floating point values are printed with the shortest text read back as
+//the same value
+void ftylog_formatValue(std::string & out, float value);
+void ftylog_formatValue(std::string & out, double value);
+void ftylog_formatValue(std::string & out, long double value);
+//A NULL string is printed as "(null)"
+void ftylog_formatValue(std::string & out, const char * value);
+void ftylog_formatValue(std::string & out, const std::string & value);
+void ftylog_formatValue(std::string & out, const void * value);
+void ftylog_formatValue(std::string & out, std::nullptr_t value);
+
+class FtylogFormat
+{
+public:
+  //Number of {} in format, or -1 if format holds a "{" or a "}" which is
+  //neither a placeholder nor escaped. Evaluated at compile time for literals:
+  //the recursion goes one level deeper per brace, not per character, to stay
+  //below the constexpr depth limit of the compilers on long formats.
+  static constexpr int placeholders(const char * format, int count = 0)
+  {
+    return placeholdersAt(nextBrace(format, TEXT_SPAN), format + TEXT_SPAN, count);
+  }
+
+  //Replace out with the message built from format and args.
+  //Missing arguments leave their {} in the message, extra ones are ignored.
+  template <typename... Args>
+  static void format(std::string & out, const char * format, const Args&... args)
+  {
+    out.clear();
+    formatNext(out, format, args...);
+  }
+
+private:
+  //Number of characters searched by one call of nextBrace()
+  static constexpr size_t TEXT_SPAN = 4096;
+
+  //First "{", "}" or end of string among the length characters from text,
+  //text + length if none. Halves the span at each level so that the
+  //recursion stays shallow; the right half is read only when the left one
+  //holds no brace nor end of string.
+  static constexpr const char * nextBrace(const char * text, size_t length)
+  {
+    return (length == 1)
+      ? (((text[0] == '{') || (text[0] == '}') || (text[0] == '\0')) ? text : text + 1)
+      : nextBraceAfter(nextBrace(text, length / 2), text + length / 2, length - length / 2);
+  }
+
+  static constexpr const char * nextBraceAfter(const char * found, const char * middle,
+                                               size_t length)
+  {
+    return (found != middle) ? found : nextBrace(middle, length);
+  }
+
+  //Continue placeholders() from brace, found by nextBrace() before end
+  static constexpr int placeholdersAt(const char * brace, const char * end, int count)
+  {
+    return (brace == end) ? placeholders(brace, count)
+      : (brace[0] == '\0') ? count
+      : ((brace[0] == '{') && (brace[1] == '}')) ? placeholders(brace + 2, count + 1)
+      : ((brace[0] == '{') && (brace[1] == '{')) ? placeholders(brace + 2, count)
+      : ((brace[0] == '}') && (brace[1] == '}')) ? placeholders(brace + 2, count)
+      : -1;
+  }
+
+  //Append the text of format up to the next {}; return the position after
+  //it, or NULL if the whole format has been appended
+  static const char * appendText(std::string & out, const char * format);
+
+  static void formatNext(std::string & out, const char * format)
+  {
+    while ((format = appendText(out, format)) != NULL)
+    {
+      out.append("{}");
+    }
+  }
+
+  template <typename T, typename... Args>
+  static void formatNext(std::string & out, const char * format, const T & value,
+                         const Args&... args)
+  {
+    format = appendText(out, format);
+    if (format != NULL)
+    {
+      ftylog_formatValue(out, value);
+      formatNext(out, format, args...);
+    }
+  }
+};
+
+//Format of the Ftylog::trace() ... Ftylog::fatal() members. Built implicitly
+//from the format argument, its default arguments are evaluated at the call
+//site and so give the location of the call (like C++20 source_location).
+struct FtylogLocatedFormat
+{
+#if defined(__GNUC__) || defined(__clang__)
+  FtylogLocatedFormat(const char * format_, const char * file_ = __builtin_FILE(),
+                      int line_ = __builtin_LINE(),
+                      const char * func_ = __builtin_FUNCTION())
+#else
+  FtylogLocatedFormat(const char * format_, const char * file_ = "",
+                      int line_ = 0, const char * func_ = "")
+#endif
+    : format(format_), file(file_), line(line_), func(func_)
+  {
+  }
+
+  const char * format;
+  const char * file;
+  int line;
+  const char * func;
+};
+
+//Never defined: the type of ftylog_countArgs(args...) gives the number of args
+template <typename... Args>
+std::integral_constant<size_t, sizeof...(Args)> ftylog_countArgs(const Args&...);
+
+//  @end
+
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,164 @@
+/*  =========================================================================
+    fty_logger_kv - Structured key/value log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOGGER_KV_H_INCLUDED
+#define FTY_LOGGER_KV_H_INCLUDED
+
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "fty_logger_format.h"
+
+//  @interface
+//Structured log messages: a message followed by key/value fields, e.g.
+//log_info_kv("Power changed", "asset", id, "power", watts).
+//Text layouts print "Power changed asset=ups-12 power=1250.5"; the JSON
+//layout (fty::JsonLayout) prints the fields as typed JSON members.
+//Keys must be string literals. Values are printed in text with
+//ftylog_formatValue() and in JSON with ftylog_jsonValue(); overload both
+//to log your own types.
+
+//Append text as a quoted JSON string. Characters are not checked for
+//valid UTF-8, only the quote, the backslash and the control characters
+//are escaped.
+void ftylog_jsonString(std::string & out, const char * text, size_t length);
+
+//Append the JSON value of a value
+void ftylog_jsonValue(std::string & out, bool value);
+void ftylog_jsonValue(std::string & out, char value);
+void ftylog_jsonValue(std::string & out, signed char value);
+void ftylog_jsonValue(std::string & out, unsigned char value);
+void ftylog_jsonValue(std::string & out, short value);
+void ftylog_jsonValue(std::string & out, unsigned short value);
+void ftylog_jsonValue(std::string & out, int value);
+void ftylog_jsonValue(std::string & out, unsigned int value);
+void ftylog_jsonValue(std::string & out, long value);
+void ftylog_jsonValue(std::string & out, unsigned long value);
+void ftylog_jsonValue(std::string & out, long long value);
+void ftylog_jsonValue(std::string & out, unsigned long long value);
+//JSON has no nan nor infinities, they are printed as strings
+void ftylog_jsonValue(std::string & out, float value);
+void ftylog_jsonValue(std::string & out, double value);
+void ftylog_jsonValue(std::string & out, long double value);
+//A NULL string is printed as null
+void ftylog_jsonValue(std::string & out, const char * value);
+void ftylog_jsonValue(std::string & out, const std::string & value);
+void ftylog_jsonValue(std::string & out, const void * value);
+void ftylog_jsonValue(std::string & out, std::nullptr_t value);
+
+//Keys of one call site of the log_*_kv macros, escaped on its first call
+//only: the macros keep it in static storage
+class FtylogKvSite
+{
+private:
+  std::once_flag _once;
+  //" key=" for the text of the message, "key": for the JSON fields
+  std::vector<std::string> _textKeys;
+  std::vector<std::string> _jsonKeys;
+
+  void addKey(const char * key, size_t length);
+
+  void addKeys()
+  {
+  }
+
+  template <size_t N, typename T, typename... Args>
+  void addKeys(const char (&key)[N], const T & value, const Args&... args)
+  {
+    (void) value;
+    addKey(key, N - 1);
+    addKeys(args...);
+  }
+
+  FtylogKvSite(const FtylogKvSite&) = delete;
+  FtylogKvSite& operator=(const FtylogKvSite&) = delete;
+
+public:
+  FtylogKvSite()
+  {
+  }
+
+  //Escape the keys of args (key, value, key, value...) on the first call
+  template <typename... Args>
+  void init(const Args&... args)
+  {
+    std::call_once(_once, [this, &args...]() { addKeys(args...); });
+  }
+
+  const std::string & textKey(size_t index) const { return _textKeys[index]; }
+  const std::string & jsonKey(size_t index) const { return _jsonKeys[index]; }
+};
+
+class FtylogKv
+{
+public:
+  //Replace text with "message key=value..." and fields with the JSON
+  //members "key":value,... of args (key, value, key, value...).
+  //Return the length of message in text.
+  template <typename... Args>
+  static size_t encode(FtylogKvSite & site, std::string & text, std::string & fields,
+                       const char * message, const Args&... args)
+  {
+    static_assert(sizeof...(Args) % 2 == 0, "Structured log: a key without a value");
+    site.init(args...);
+    text.assign(message);
+    size_t length = text.size();
+    fields.clear();
+    encodeNext(site, 0, text, fields, args...);
+    return length;
+  }
+
+private:
+  static void encodeNext(const FtylogKvSite & site, size_t index, std::string & text,
+                         std::string & fields)
+  {
+    (void) site;
+    (void) index;
+    (void) text;
+    (void) fields;
+  }
+
+  template <size_t N, typename T, typename... Args>
+  static void encodeNext(const FtylogKvSite & site, size_t index, std::string & text,
+                         std::string & fields, const char (&key)[N], const T & value,
+                         const Args&... args)
+  {
+    (void) key;
+    text.append(site.textKey(index));
+    ftylog_formatValue(text, value);
+    if (index != 0)
+    {
+      fields.push_back(',');
+    }
+    fields.append(site.jsonKey(index));
+    ftylog_jsonValue(fields, value);
+    encodeNext(site, index + 1, text, fields, args...);
+  }
+};
+
+//  @end
+
+#endif // __cplusplus
+
+#endif
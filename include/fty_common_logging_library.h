@@ -99,10 +99,16 @@
 //  These classes are stable or legacy and built in all releases
 typedef struct _fty_log_fty_logger_t fty_log_fty_logger_t;
 #define FTY_LOG_FTY_LOGGER_T_DEFINED
+typedef struct _fty_log_fty_logger_format_t fty_log_fty_logger_format_t;
+#define FTY_LOG_FTY_LOGGER_FORMAT_T_DEFINED
+typedef struct _fty_log_fty_logger_kv_t fty_log_fty_logger_kv_t;
+#define FTY_LOG_FTY_LOGGER_KV_T_DEFINED
 
 
 //  Public classes, each with its own header file
 #include "fty-log/fty_logger.h"
+#include "fty-log/fty_logger_format.h"
+#include "fty-log/fty_logger_kv.h"
 
 #ifdef FTY_COMMON_LOGGING_BUILD_DRAFT_API
 
@@ -48,30 +48,32 @@ BuildRequires:  pkgconfig
 BuildRequires:  xmlto
 BuildRequires:  gcc-c++
 BuildRequires:  log4cplus-devel
+BuildRequires:  zlib-devel
 BuildRoot:      %{_tmppath}/%{name}-%{version}-build
 
 %description
 fty-common-logging provides common logs.
 
-%package -n libfty_common_logging1
+%package -n libfty_common_logging2
 Group:          System/Libraries
 Summary:        provides common logs shared library
 
-%description -n libfty_common_logging1
+%description -n libfty_common_logging2
 This package contains shared library for fty-common-logging: provides common logs
 
-%post -n libfty_common_logging1 -p /sbin/ldconfig
-%postun -n libfty_common_logging1 -p /sbin/ldconfig
+%post -n libfty_common_logging2 -p /sbin/ldconfig
+%postun -n libfty_common_logging2 -p /sbin/ldconfig
 
-%files -n libfty_common_logging1
+%files -n libfty_common_logging2
 %defattr(-,root,root)
 %{_libdir}/libfty_common_logging.so.*
 
 %package devel
 Summary:        provides common logs
 Group:          System/Libraries
-Requires:       libfty_common_logging1 = %{version}
+Requires:       libfty_common_logging2 = %{version}
 Requires:       log4cplus-devel
+Requires:       zlib-devel
 
 %description devel
 provides common logs development tools
@@ -79,9 +81,11 @@ This package contains development files for fty-common-logging: provides common
 
 %files devel
 %defattr(-,root,root)
+%{_bindir}/fty-log-ring-reader
 %{_includedir}/*
 %{_libdir}/libfty_common_logging.so
 %{_libdir}/pkgconfig/libfty_common_logging.pc
+%{_mandir}/man1/*
 %{_mandir}/man3/*
 %{_mandir}/man7/*
 
@@ -0,0 +1,109 @@
+/*  =========================================================================
+    fty-log-ring-reader - Print the records of a ring log file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+
+/*
+@header
+    fty-log-ring-reader - Print the records of a ring log file
+@discuss
+    Prints, in chronological order, the messages still present in a file
+    written by the fty::RingFileAppender, e.g. after the process crashed.
+    The file may be read while a process is writing to it.
+
+    Usage: fty-log-ring-reader [--sequence] FILE...
+@end
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+//Only the public API: the tool is installed
+#include "fty_common_logging_library.h"
+
+static void usage(const char * program)
+{
+  printf("Usage: %s [--sequence] FILE...\n", program);
+  printf("  --sequence  prefix each message with its sequence number\n");
+}
+
+int main(int argc, char * argv[])
+{
+  bool sequence = false;
+  std::vector<std::string> files;
+
+  for (int argn = 1; argn < argc; argn++)
+  {
+    std::string arg = argv[argn];
+    if ((arg == "--help") || (arg == "-h"))
+    {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    else if ((arg == "--sequence") || (arg == "-s"))
+    {
+      sequence = true;
+    }
+    else if ((arg.size() > 1) && (arg[0] == '-'))
+    {
+      fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty())
+  {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int result = EXIT_SUCCESS;
+  for (const std::string & file : files)
+  {
+    std::vector<FtylogRingRecord> records;
+    std::string error;
+    if (!ftylog_readRingFile(file, records, error))
+    {
+      fprintf(stderr, "%s\n", error.c_str());
+      result = EXIT_FAILURE;
+      continue;
+    }
+    for (const FtylogRingRecord & record : records)
+    {
+      if (sequence)
+      {
+        printf("%llu ", (unsigned long long) record.sequence);
+      }
+      fwrite(record.message.data(), 1, record.message.size(), stdout);
+      //The layout usually ends the messages with %n
+      if (record.message.empty() || (record.message.back() != '\n'))
+      {
+        putchar('\n');
+      }
+    }
+  }
+  return result;
+}
@@ -0,0 +1,640 @@
+/*  =========================================================================
+    fty_log_backend - Asynchronous log backend
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_backend - Asynchronous log backend
+@discuss
+    Producer threads move their formatted messages into a bounded ring
+    buffer; a single backend thread drains it into the log4cplus appenders,
+    so the callers do not wait for the appenders' locks and output syscalls.
+@end
+ */
+
+#include <stdint.h>
+#include <log4cplus/thread/threads.h>
+#include <log4cplus/spi/loggingevent.h>
+
+#include "fty_common_logging_classes.h"
+
+////////////////////////
+//FtylogRingBuffer
+////////////////////////
+
+FtylogRingBuffer::FtylogRingBuffer(size_t capacity)
+{
+  size_t size = 2;
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  _mask = size - 1;
+  _cells.reset(new Cell[size]);
+  for (size_t i = 0; i < size; i++)
+  {
+    _cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  _enqueuePos.store(0, std::memory_order_relaxed);
+  _dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+bool FtylogRingBuffer::tryPush(FtylogRecord & record, size_t & position)
+{
+  Cell * cell;
+  size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+  for (;;)
+  {
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if (diff == 0)
+    {
+      //The cell is free for this position, try to claim it
+      if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      //The consumer did not free this cell yet: the queue is full
+      return false;
+    }
+    else
+    {
+      pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  std::swap(cell->record, record);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  position = pos;
+  return true;
+}
+
+bool FtylogRingBuffer::tryPop(FtylogRecord & record)
+{
+  Cell * cell;
+  size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+  for (;;)
+  {
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+    if (diff == 0)
+    {
+      if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      //No producer published this cell yet: the queue is empty
+      return false;
+    }
+    else
+    {
+      pos = _dequeuePos.load(std::memory_order_relaxed);
+    }
+  }
+  std::swap(record, cell->record);
+  cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+  return true;
+}
+
+////////////////////////
+//FtylogSpscQueue
+////////////////////////
+
+FtylogSpscQueue::FtylogSpscQueue(size_t capacity)
+{
+  size_t size = 2;
+  while (size < capacity)
+  {
+    size <<= 1;
+  }
+  _mask = size - 1;
+  _records.reset(new FtylogRecord[size]);
+  _tail.store(0, std::memory_order_relaxed);
+  _cachedHead = 0;
+  _head.store(0, std::memory_order_relaxed);
+}
+
+bool FtylogSpscQueue::tryPush(FtylogRecord & record)
+{
+  size_t tail = _tail.load(std::memory_order_relaxed);
+  if (tail - _cachedHead > _mask)
+  {
+    _cachedHead = _head.load(std::memory_order_acquire);
+    if (tail - _cachedHead > _mask)
+    {
+      return false;
+    }
+  }
+  std::swap(_records[tail & _mask], record);
+  _tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+size_t FtylogSpscQueue::available() const
+{
+  return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_relaxed);
+}
+
+FtylogRecord & FtylogSpscQueue::front()
+{
+  return _records[_head.load(std::memory_order_relaxed) & _mask];
+}
+
+void FtylogSpscQueue::pop()
+{
+  _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+////////////////////////
+//FtylogBackend
+////////////////////////
+
+namespace
+{
+
+std::atomic<unsigned long long> backendIds(0);
+
+//Queues of the calling thread, one per backend it logged to
+struct ThreadProducers
+{
+  std::vector<std::pair<unsigned long long, std::shared_ptr<FtylogBackend::Producer>>> queues;
+
+  ~ThreadProducers()
+  {
+    for (auto & queue : queues)
+    {
+      queue.second->released.store(true, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ThreadProducers threadProducers;
+
+//Put the scoped contexts into the MDC of an event, hiding its values
+void mergeContext(log4cplus::MappedDiagnosticContextMap & mdc,
+                  const FtylogContextSnapshot & context)
+{
+  context.forEach([&mdc](const char * key, size_t keyLength, const char * value,
+                         size_t valueLength)
+  {
+    mdc[log4cplus::tstring(key, keyLength)].assign(value, valueLength);
+  });
+}
+
+}
+
+FtylogBackend::FtylogBackend(log4cplus::Logger logger, size_t queueSize, bool perThread,
+                             FtylogStatsCounters * stats)
+  : _logger(logger), _queue(perThread ? 2 : queueSize), _perThread(perThread),
+    _queueSize(queueSize), _id(++backendIds), _stats(stats), _contextSerial(0)
+{
+  _producersVersion.store(0);
+  _pushed.store(0);
+  _written.store(0);
+  _sleeping.store(false);
+  _stop.store(false);
+  _thread = std::thread(&FtylogBackend::run, this);
+}
+
+FtylogBackend::~FtylogBackend()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop.store(true);
+    _wakeUp.notify_one();
+  }
+  _thread.join();
+  //The threads still holding a queue drop it on their next message
+  std::lock_guard<std::mutex> lock(_producersMutex);
+  for (std::shared_ptr<Producer> & producer : _producers)
+  {
+    producer->orphaned.store(true, std::memory_order_relaxed);
+  }
+}
+
+FtylogBackend::Producer & FtylogBackend::producer()
+{
+  auto & queues = threadProducers.queues;
+  for (size_t i = 0; i < queues.size(); )
+  {
+    if (queues[i].first == _id)
+    {
+      return *queues[i].second;
+    }
+    if (queues[i].second->orphaned.load(std::memory_order_relaxed))
+    {
+      queues.erase(queues.begin() + i);
+      continue;
+    }
+    i++;
+  }
+  std::shared_ptr<Producer> producer = std::make_shared<Producer>(_queueSize);
+  {
+    std::lock_guard<std::mutex> lock(_producersMutex);
+    _producers.push_back(producer);
+    _producersVersion.fetch_add(1, std::memory_order_release);
+  }
+  queues.push_back(std::make_pair(_id, producer));
+  return *producer;
+}
+
+void FtylogBackend::removeProducer(Producer * producer)
+{
+  std::lock_guard<std::mutex> lock(_producersMutex);
+  for (size_t i = 0; i < _producers.size(); i++)
+  {
+    if (_producers[i].get() == producer)
+    {
+      _producers.erase(_producers.begin() + i);
+      _producersVersion.fetch_add(1, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+bool FtylogBackend::isBackendThread() const
+{
+  return std::this_thread::get_id() == _thread.get_id();
+}
+
+void FtylogBackend::capture(FtylogRecord & record, log4cplus::LogLevel level,
+                            const char* file, int line, const char* func)
+{
+  record.level = level;
+  record.file = file;
+  record.line = line;
+  record.func = func;
+  record.thread = log4cplus::thread::getCurrentThreadName();
+  record.thread2 = log4cplus::thread::getCurrentThreadName2();
+  record.timestamp = FtylogClock::now();
+  //The context is per thread, it must be captured on the producer side.
+  //The scoped contexts are shared, the MDC is copied only when it holds
+  //other values (brought up to date first: a synchronous message may have
+  //left there the entries of a scope which ended since).
+  FtylogContextStack & stack = FtylogContextStack::forThisThread();
+  record.context = stack.shareSnapshot();
+  if (stack.hasOtherMdc())
+  {
+    stack.mirror();
+    record.mdc = log4cplus::getMDC().getContext();
+  }
+  else
+  {
+    record.mdc.clear();
+  }
+}
+
+void FtylogBackend::push(log4cplus::LogLevel level, const char* file, int line,
+                         const char* func, const char* message, size_t length,
+                         const FtylogStructured * structured)
+{
+  //Every field is overwritten: the record comes back from the queue with
+  //the content of an older message
+  static thread_local FtylogRecord record;
+  capture(record, level, file, line, func);
+  record.message.assign(message, length);
+  record.deferred = false;
+  record.structured = (structured != NULL);
+  if (record.structured)
+  {
+    record.messageLength = structured->messageLength;
+    record.fields.assign(structured->fields, structured->fieldsLength);
+  }
+
+  //Messages issued by the appenders themselves are written directly,
+  //the backend thread can not wait for room in its own queue
+  if (isBackendThread())
+  {
+    write(record);
+    return;
+  }
+  enqueue(record);
+}
+
+bool FtylogBackend::pushDeferred(log4cplus::LogLevel level, const char* file, int line,
+                                 const char* func, const char* format, va_list args)
+{
+  if (isBackendThread())
+  {
+    return false;
+  }
+  static thread_local FtylogRecord record;
+  record.args.clear();
+  if (!FtylogDeferredFormat::capture(format, args, record.args))
+  {
+    return false;
+  }
+  //The format is copied too: it is not always a string literal
+  record.format.assign(format);
+  record.deferred = true;
+  record.structured = false;
+  capture(record, level, file, line, func);
+  enqueue(record);
+  return true;
+}
+
+void FtylogBackend::countFullWait()
+{
+  if (NULL != _stats)
+  {
+    _stats->addQueueFullWait();
+  }
+}
+
+void FtylogBackend::enqueue(FtylogRecord & record)
+{
+  //The record is swapped with an older one by tryPush()
+  log4cplus::LogLevel level = record.level;
+  size_t position = 0;
+  if (_perThread)
+  {
+    //Nothing shared with the other producers
+    FtylogSpscQueue & queue = producer().queue;
+    if (!queue.tryPush(record))
+    {
+      countFullWait();
+      while (!queue.tryPush(record))
+      {
+        std::this_thread::yield();
+      }
+    }
+    //Pairs with the idle check of the backend thread
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+  else
+  {
+    if (!_queue.tryPush(record, position))
+    {
+      countFullWait();
+      while (!_queue.tryPush(record, position))
+      {
+        //The queue is full: let the backend thread make room
+        std::this_thread::yield();
+      }
+    }
+    //Sequentially consistent, pairs with the idle check of the backend thread
+    _pushed.fetch_add(1);
+  }
+
+  if (_sleeping.load())
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wakeUp.notify_one();
+  }
+
+  //The process may abort right after a fatal message, make sure it is out.
+  //_pushed may not count yet the records of other producers in the
+  //positions before ours: wait for our position to be written instead.
+  if (level >= log4cplus::FATAL_LOG_LEVEL)
+  {
+    if (_perThread)
+    {
+      flush();
+    }
+    else
+    {
+      waitWritten(position + 1);
+    }
+  }
+}
+
+void FtylogBackend::flush()
+{
+  if (isBackendThread())
+  {
+    return;
+  }
+  if (_perThread)
+  {
+    //Records pushed to each queue so far
+    std::vector<std::pair<std::shared_ptr<Producer>, size_t>> targets;
+    {
+      std::lock_guard<std::mutex> lock(_producersMutex);
+      for (std::shared_ptr<Producer> & producer : _producers)
+      {
+        targets.push_back(std::make_pair(producer, producer->queue.pushed()));
+      }
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto & target : targets)
+    {
+      while (target.first->queue.popped() < target.second)
+      {
+        _wakeUp.notify_one();
+        _drained.wait_for(lock, std::chrono::milliseconds(10));
+      }
+    }
+    return;
+  }
+  //Every position claimed so far, the records pushed before this call
+  //included, whether or not their producers counted them in _pushed yet
+  waitWritten(_queue.claimed());
+}
+
+void FtylogBackend::waitWritten(unsigned long long target)
+{
+  if (isBackendThread())
+  {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (_written.load(std::memory_order_acquire) < target)
+  {
+    _wakeUp.notify_one();
+    _drained.wait_for(lock, std::chrono::milliseconds(10));
+  }
+}
+
+void FtylogBackend::write(FtylogRecord & record)
+{
+  if (record.deferred)
+  {
+    FtylogDeferredFormat::format(record.format.c_str(), record.args, record.message);
+  }
+  //The log4cplus layouts read the scoped contexts in the MDC of the event
+  const log4cplus::MappedDiagnosticContextMap * mdc = &record.mdc;
+  if (record.context)
+  {
+    if (record.mdc.empty())
+    {
+      if (_contextSerial != record.context->serial())
+      {
+        _contextSerial = record.context->serial();
+        _contextMdc.clear();
+        mergeContext(_contextMdc, *record.context);
+      }
+      mdc = &_contextMdc;
+    }
+    else
+    {
+      mergeContext(record.mdc, *record.context);
+    }
+  }
+  log4cplus::spi::InternalLoggingEvent event(_logger.getName(), record.level,
+    log4cplus::tstring(), *mdc, record.message, record.thread,
+    record.thread2, record.timestamp, record.file, record.line, record.func);
+  FtylogEventContext::Scope contextScope(record.context.get(), record.mdc);
+  if (record.structured)
+  {
+    FtylogStructured structured;
+    structured.fields = record.fields.data();
+    structured.fieldsLength = record.fields.size();
+    structured.messageLength = record.messageLength;
+    structured.textLength = record.message.size();
+    FtylogJsonLayout::Scope scope(&structured);
+    _logger.forcedLog(event);
+  }
+  else
+  {
+    _logger.forcedLog(event);
+  }
+  //Let the producer thread rebuild the snapshot in place
+  record.context.reset();
+}
+
+size_t FtylogBackend::drainProducers(std::vector<std::shared_ptr<Producer>> & producers,
+                                     unsigned long long & version)
+{
+  if (version != _producersVersion.load(std::memory_order_acquire))
+  {
+    std::lock_guard<std::mutex> lock(_producersMutex);
+    producers = _producers;
+    version = _producersVersion.load(std::memory_order_relaxed);
+  }
+
+  //Queues with records, and how many of them this pass writes: records
+  //queued during the pass wait for the next one, so the queues of the
+  //idle threads are not read again for each record
+  static thread_local std::vector<std::pair<Producer *, size_t>> active;
+  active.clear();
+  for (std::shared_ptr<Producer> & producer : producers)
+  {
+    //Read before the queue: the thread pushes nothing after its release
+    bool released = producer->released.load(std::memory_order_acquire);
+    size_t available = producer->queue.available();
+    if (available != 0)
+    {
+      active.push_back(std::make_pair(producer.get(), available));
+    }
+    else if (released)
+    {
+      removeProducer(producer.get());
+    }
+  }
+
+  //Merge the queues: each of them is in timestamp order, write the oldest
+  //head first. A linear search is enough for a few tens of threads.
+  size_t written = 0;
+  while (!active.empty())
+  {
+    size_t oldest = 0;
+    for (size_t i = 1; i < active.size(); i++)
+    {
+      if (active[i].first->queue.front().timestamp <
+          active[oldest].first->queue.front().timestamp)
+      {
+        oldest = i;
+      }
+    }
+    FtylogSpscQueue & queue = active[oldest].first->queue;
+    //Written from its cell, which is freed afterwards so that flush() does
+    //not return before the record is out
+    write(queue.front());
+    queue.pop();
+    written++;
+    if (--active[oldest].second == 0)
+    {
+      active[oldest] = active.back();
+      active.pop_back();
+    }
+  }
+  return written;
+}
+
+bool FtylogBackend::isIdle()
+{
+  if (!_perThread)
+  {
+    return _written.load() >= _pushed.load();
+  }
+  std::lock_guard<std::mutex> lock(_producersMutex);
+  for (std::shared_ptr<Producer> & producer : _producers)
+  {
+    if (producer->queue.available() != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FtylogBackend::run()
+{
+  FtylogRecord record;
+  //Copy of the list of producer queues, updated when it changes
+  std::vector<std::shared_ptr<Producer>> producers;
+  unsigned long long version = ~0ULL;
+  for (;;)
+  {
+    if (_perThread)
+    {
+      while (drainProducers(producers, version) != 0)
+      {
+      }
+    }
+    else
+    {
+      while (_queue.tryPop(record))
+      {
+        write(record);
+        _written.fetch_add(1, std::memory_order_release);
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _drained.notify_all();
+    if (_stop.load())
+    {
+      //Producers are gone, only records already published may remain
+      if (isIdle())
+      {
+        break;
+      }
+      continue;
+    }
+    _sleeping.store(true);
+    //Pairs with the fence of the producers in per-thread mode
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //Re-check under the lock so a wake-up between the drain and the wait
+    //is not lost; the timeout is only a safety net
+    if (isIdle())
+    {
+      _wakeUp.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    _sleeping.store(false, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,287 @@
+/*  =========================================================================
+    fty_log_backend - Asynchronous log backend
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_BACKEND_H_INCLUDED
+#define FTY_LOG_BACKEND_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdarg.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <log4cplus/logger.h>
+#include <log4cplus/mdc.h>
+#include <log4cplus/helpers/timehelper.h>
+
+//  @interface
+
+class FtylogStatsCounters;
+class FtylogContextSnapshot;
+
+//One log message waiting in the backend queue.
+//file and func point to static strings (__FILE__, __func__) and are not copied
+struct FtylogRecord
+{
+  log4cplus::LogLevel level;
+  const char * file;
+  int line;
+  const char * func;
+  std::string message;
+  //When deferred, message is built by the backend thread from a copy of
+  //the format and the arguments captured by FtylogDeferredFormat
+  bool deferred;
+  std::string format;
+  std::string args;
+  //Structured message of the log_*_kv macros: message is "text key=value..."
+  //of which the first messageLength characters are the text, fields holds
+  //the JSON members of the key/value pairs
+  bool structured;
+  size_t messageLength;
+  std::string fields;
+  //Context of the producer thread, captured when the message is queued
+  std::string thread;
+  std::string thread2;
+  log4cplus::helpers::Time timestamp;
+  //Scoped contexts (NULL if none), shared with the producer thread, and
+  //the MDC when it holds other values
+  std::shared_ptr<const FtylogContextSnapshot> context;
+  log4cplus::MappedDiagnosticContextMap mdc;
+
+  FtylogRecord()
+    : level(log4cplus::NOT_SET_LOG_LEVEL), file(NULL), line(0), func(NULL), deferred(false),
+      structured(false), messageLength(0)
+  {
+  }
+};
+
+//Bounded multi-producer queue of log records (Vyukov's array-based queue).
+//The capacity is rounded up to a power of two.
+class FtylogRingBuffer
+{
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    FtylogRecord record;
+  };
+
+  size_t _mask;
+  std::unique_ptr<Cell[]> _cells;
+  //Producer and consumer positions live on their own cache lines
+  //(padded by hand: C++11 has no over-aligned operator new)
+  char _pad0[64];
+  std::atomic<size_t> _enqueuePos;
+  char _pad1[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> _dequeuePos;
+  char _pad2[64 - sizeof(std::atomic<size_t>)];
+
+  FtylogRingBuffer(const FtylogRingBuffer&) = delete;
+  FtylogRingBuffer& operator=(const FtylogRingBuffer&) = delete;
+
+public:
+  explicit FtylogRingBuffer(size_t capacity);
+
+  size_t capacity() const { return _mask + 1; }
+
+  //Swap the record with a free cell of the queue; return false if the
+  //queue is full. Records are swapped rather than moved so that the string
+  //buffers go back and forth between the producers and the consumer and
+  //are reused instead of reallocated for each message.
+  bool tryPush(FtylogRecord & record, size_t & position);
+  //Swap the oldest record of the queue with the given one; return false if
+  //the queue is empty
+  bool tryPop(FtylogRecord & record);
+
+  //Number of positions claimed by the producers so far, the records of
+  //some of them may not be published yet
+  size_t claimed() const { return _enqueuePos.load(std::memory_order_acquire); }
+};
+
+//Bounded single-producer single-consumer queue of log records. The
+//producer keeps a copy of the consumer position and reads the shared one
+//only when the copy says the queue is full.
+class FtylogSpscQueue
+{
+private:
+  size_t _mask;
+  std::unique_ptr<FtylogRecord[]> _records;
+  char _pad0[64];
+  //Written by the producer
+  std::atomic<size_t> _tail;
+  size_t _cachedHead;
+  char _pad1[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  //Written by the consumer
+  std::atomic<size_t> _head;
+  char _pad2[64 - sizeof(std::atomic<size_t>)];
+
+  FtylogSpscQueue(const FtylogSpscQueue&) = delete;
+  FtylogSpscQueue& operator=(const FtylogSpscQueue&) = delete;
+
+public:
+  explicit FtylogSpscQueue(size_t capacity);
+
+  //Producer side: swap the record with a free cell, return false if full.
+  //As with FtylogRingBuffer, the buffers of the strings are reused.
+  bool tryPush(FtylogRecord & record);
+
+  //Consumer side: number of records ready to be read
+  size_t available() const;
+  //Consumer side: oldest record, when available() is not zero. It stays
+  //in the queue, and may be written to the appenders from there.
+  FtylogRecord & front();
+  //Consumer side: free the cell of the oldest record
+  void pop();
+
+  //Number of records pushed and popped since the creation of the queue
+  size_t pushed() const { return _tail.load(std::memory_order_acquire); }
+  size_t popped() const { return _head.load(std::memory_order_acquire); }
+};
+
+//Background thread draining a FtylogRingBuffer, or the queues of the
+//producer threads, into the appenders of a log4cplus logger
+class FtylogBackend
+{
+public:
+  //Queue of one producer thread in per-thread mode, shared between the
+  //thread (which keeps it until it exits) and the backend
+  struct Producer
+  {
+    FtylogSpscQueue queue;
+    //Set when the thread has exited: no record will be pushed anymore
+    std::atomic<bool> released;
+    //Set when the backend is destroyed: the thread forgets the queue
+    std::atomic<bool> orphaned;
+
+    explicit Producer(size_t capacity)
+      : queue(capacity), released(false), orphaned(false)
+    {
+    }
+  };
+
+private:
+  //Logger whose appenders receive the queued records
+  log4cplus::Logger _logger;
+  FtylogRingBuffer _queue;
+
+  //Per-thread mode: one queue per producer thread, merged in timestamp
+  //order by the backend thread
+  bool _perThread;
+  size_t _queueSize;
+  //Identifies the backend in the queues the threads keep; an address could
+  //be reused by another backend
+  unsigned long long _id;
+  //Queues of the producer threads; _producersVersion changes with the list
+  std::mutex _producersMutex;
+  std::vector<std::shared_ptr<Producer>> _producers;
+  std::atomic<unsigned long long> _producersVersion;
+
+  //Counters of the logger, NULL if none
+  FtylogStatsCounters * _stats;
+
+  //Number of records queued and written so far. The backend thread
+  //writes the records in the order of their positions in _queue, so the
+  //record of position p is out once _written is above p.
+  std::atomic<unsigned long long> _pushed;
+  std::atomic<unsigned long long> _written;
+
+  //Wake-up of the idle backend thread
+  std::mutex _mutex;
+  std::condition_variable _wakeUp;
+  std::condition_variable _drained;
+  std::atomic<bool> _sleeping;
+  std::atomic<bool> _stop;
+
+  std::thread _thread;
+
+  //MDC of the events of the records without other values than the scoped
+  //contexts, built by the backend thread from the snapshot of this serial
+  log4cplus::MappedDiagnosticContextMap _contextMdc;
+  unsigned long long _contextSerial;
+
+  //Body of the backend thread
+  void run();
+  //Write one record to the appenders of the logger
+  void write(FtylogRecord & record);
+  //Wait until the records of the positions of _queue below target have
+  //been written
+  void waitWritten(unsigned long long target);
+  //Fill the context of the producer thread in the record
+  void capture(FtylogRecord & record, log4cplus::LogLevel level, const char* file,
+               int line, const char* func);
+  //Hand the record over to the backend thread
+  void enqueue(FtylogRecord & record);
+  //Count a record waiting for room in a full queue
+  void countFullWait();
+  //Queue of the calling thread in per-thread mode, registered on first use
+  Producer & producer();
+  //Write the records of the producer queues, oldest first; return the
+  //number of records written. producers and version are the copy of the
+  //list of queues kept by the backend thread.
+  size_t drainProducers(std::vector<std::shared_ptr<Producer>> & producers,
+                        unsigned long long & version);
+  //Forget the queue of a thread which exited
+  void removeProducer(Producer * producer);
+  //Return true if no record is waiting
+  bool isIdle();
+
+  FtylogBackend(const FtylogBackend&) = delete;
+  FtylogBackend& operator=(const FtylogBackend&) = delete;
+
+public:
+  //Default number of records the queue can hold
+  static const size_t DEFAULT_QUEUE_SIZE = 8192;
+  //Default number of records of each queue in per-thread mode
+  static const size_t DEFAULT_THREAD_QUEUE_SIZE = 1024;
+
+  //perThread: give each producer thread its own queue of queueSize records
+  //instead of sharing one between all of them. stats counts the waits for
+  //room in the queues.
+  FtylogBackend(log4cplus::Logger logger, size_t queueSize = DEFAULT_QUEUE_SIZE,
+                bool perThread = false, FtylogStatsCounters * stats = NULL);
+  //Write all pending records and stop the backend thread
+  ~FtylogBackend();
+
+  //Queue a copy of a formatted message. If the queue is full, wait for the
+  //backend thread to make room. FATAL messages are written before push()
+  //returns. The structured part of the message, if any, is copied too.
+  void push(log4cplus::LogLevel level, const char* file, int line,
+            const char* func, const char* message, size_t length,
+            const FtylogStructured * structured = NULL);
+
+  //Queue the format and a copy of the arguments; the backend thread
+  //formats the message. Return false without queuing anything if the
+  //format can not be deferred (see FtylogDeferredFormat::capture) or when
+  //called from the backend thread: the caller must format the message.
+  bool pushDeferred(log4cplus::LogLevel level, const char* file, int line,
+                    const char* func, const char* format, va_list args);
+
+  //Wait until every record queued before this call has been written
+  void flush();
+
+  //Return true when called from the backend thread itself
+  bool isBackendThread() const;
+};
+
+//  @end
+#endif
@@ -0,0 +1,242 @@
+/*  =========================================================================
+    fty_log_batch - Appender batching the writes of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+/*
+@header
+    fty_log_batch - Appender batching the writes of log messages
+@discuss
+    The appenders of log4cplus make one write() per message. During a burst
+    of messages, this appender turns thousands of system calls into a few
+    writev() of up to IOV_MAX messages. Messages still pending when the
+    process is killed are lost: the flush level and the maximum age bound
+    what can be missing.
+@end
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/factory.h>
+#include <log4cplus/spi/loggingevent.h>
+
+#include "fty_common_logging_classes.h"
+
+const char * const FtylogBatchAppender::TYPE_NAME = "fty::BatchAppender";
+
+FtylogBatchAppender::FtylogBatchAppender(bool logToStdErr, size_t bufferSize,
+                                         unsigned int maxAgeMillis,
+                                         log4cplus::LogLevel flushLevel)
+  : _fd(logToStdErr ? STDERR_FILENO : STDOUT_FILENO), _ownFd(false),
+    _bufferSize(bufferSize), _maxAgeMillis(maxAgeMillis), _flushLevel(flushLevel),
+    _count(0), _bytes(0), _stop(false)
+{
+  start();
+}
+
+FtylogBatchAppender::FtylogBatchAppender(const log4cplus::helpers::Properties & properties)
+  : log4cplus::Appender(properties), _fd(STDOUT_FILENO), _ownFd(false),
+    _bufferSize(DEFAULT_BUFFER_SIZE), _maxAgeMillis(DEFAULT_MAX_AGE_MILLIS),
+    _flushLevel(log4cplus::ERROR_LOG_LEVEL), _count(0), _bytes(0), _stop(false)
+{
+  bool logToStdErr = false;
+  properties.getBool(logToStdErr, "logToStdErr");
+  if (logToStdErr)
+  {
+    _fd = STDERR_FILENO;
+  }
+  unsigned int value;
+  if (properties.getUInt(value, "BufferSize"))
+  {
+    _bufferSize = value;
+  }
+  if (properties.getUInt(value, "MaxAge"))
+  {
+    _maxAgeMillis = value;
+  }
+  if (properties.exists("FlushLevel"))
+  {
+    _flushLevel = log4cplus::getLogLevelManager().fromString(properties.getProperty("FlushLevel"));
+  }
+
+  const log4cplus::tstring & file = properties.getProperty("File");
+  if (!file.empty())
+  {
+    _fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0)
+    {
+      log4cplus::helpers::getLogLog().error("Can not open the log file " + file +
+                                            ": " + strerror(errno));
+    }
+    _ownFd = true;
+  }
+  start();
+}
+
+FtylogBatchAppender::~FtylogBatchAppender()
+{
+  destructorImpl();
+}
+
+void FtylogBatchAppender::start()
+{
+  //Enough slots for a full batch of short messages
+  _iov.reserve(IOV_MAX);
+  _flusher = std::thread(&FtylogBatchAppender::run, this);
+}
+
+void FtylogBatchAppender::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    writeRecords();
+    _stop = true;
+    _wakeUp.notify_one();
+  }
+  if (_flusher.joinable())
+  {
+    _flusher.join();
+  }
+  if (_ownFd && (_fd >= 0))
+  {
+    ::close(_fd);
+    _fd = -1;
+  }
+  closed = true;
+}
+
+void FtylogBatchAppender::flushBatch()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  writeRecords();
+}
+
+void FtylogBatchAppender::append(const log4cplus::spi::InternalLoggingEvent & event)
+{
+  const log4cplus::tstring & message = formatEvent(event);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_count == _records.size())
+  {
+    _records.emplace_back();
+  }
+  _records[_count].assign(message);
+  _count++;
+  _bytes += message.size();
+  if (_count == 1)
+  {
+    //Start the age of the batch
+    _oldest = std::chrono::steady_clock::now();
+    _wakeUp.notify_one();
+  }
+  if ((_bytes >= _bufferSize) || (_count >= (size_t) IOV_MAX) ||
+      (event.getLogLevel() >= _flushLevel))
+  {
+    writeRecords();
+  }
+}
+
+void FtylogBatchAppender::writeRecords()
+{
+  if (0 == _count)
+  {
+    return;
+  }
+  _iov.resize(_count);
+  for (size_t i = 0; i < _count; i++)
+  {
+    _iov[i].iov_base = const_cast<char *>(_records[i].data());
+    _iov[i].iov_len = _records[i].size();
+  }
+  _count = 0;
+  _bytes = 0;
+  if (_fd < 0)
+  {
+    return;
+  }
+
+  struct iovec * iov = _iov.data();
+  int iovcnt = (int) _iov.size();
+  while (iovcnt > 0)
+  {
+    ssize_t written = writev(_fd, iov, iovcnt);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      //Like the appenders of log4cplus, give up on the messages
+      break;
+    }
+    //Skip what was written, the last buffer may be partially written
+    while ((iovcnt > 0) && ((size_t) written >= iov->iov_len))
+    {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (char *) iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
+void FtylogBatchAppender::run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_stop)
+  {
+    if (0 == _count)
+    {
+      _wakeUp.wait(lock);
+      continue;
+    }
+    std::chrono::steady_clock::time_point deadline =
+      _oldest + std::chrono::milliseconds(_maxAgeMillis);
+    if (std::chrono::steady_clock::now() >= deadline)
+    {
+      writeRecords();
+    }
+    else
+    {
+      _wakeUp.wait_until(lock, deadline);
+    }
+  }
+}
+
+void FtylogBatchAppender::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getAppenderFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::AppenderFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogBatchAppender,
+                                         log4cplus::spi::AppenderFactory>(TYPE_NAME)));
+  });
+}
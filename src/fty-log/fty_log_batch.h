@@ -0,0 +1,116 @@
+/*  =========================================================================
+    fty_log_batch - Appender batching the writes of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+#ifndef FTY_LOG_BATCH_H_INCLUDED
+#define FTY_LOG_BATCH_H_INCLUDED
+
+#include <sys/uio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <log4cplus/appender.h>
+#include <log4cplus/helpers/property.h>
+
+//  @interface
+
+//Appender writing the console (or a file) like log4cplus::ConsoleAppender
+//and FileAppender, but gathering the formatted messages and writing them
+//with a single writev() when:
+// - the pending messages reach a size,
+// - the oldest pending message reaches an age (a small thread checks it),
+// - or a message of the flush level (ERROR by default) is logged.
+//Used by Ftylog::setConsoleAppender() when BIOS_LOG_BATCH is set, and in
+//the log configuration files with:
+//  log4cplus.appender.batch=fty::BatchAppender
+//  log4cplus.appender.batch.File=/var/log/agent.log   (default: the console)
+//  log4cplus.appender.batch.logToStdErr=true          (console only)
+//  log4cplus.appender.batch.BufferSize=65536
+//  log4cplus.appender.batch.MaxAge=100                (milliseconds)
+//  log4cplus.appender.batch.FlushLevel=ERROR
+class FtylogBatchAppender : public log4cplus::Appender
+{
+public:
+  //Name of the appender type in the log configuration files
+  static const char * const TYPE_NAME;
+  static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+  static const unsigned int DEFAULT_MAX_AGE_MILLIS = 100;
+
+  //Write to the console, stdout or stderr
+  explicit FtylogBatchAppender(bool logToStdErr,
+                               size_t bufferSize = DEFAULT_BUFFER_SIZE,
+                               unsigned int maxAgeMillis = DEFAULT_MAX_AGE_MILLIS,
+                               log4cplus::LogLevel flushLevel = log4cplus::ERROR_LOG_LEVEL);
+  explicit FtylogBatchAppender(const log4cplus::helpers::Properties & properties);
+  virtual ~FtylogBatchAppender();
+
+  //Write the pending messages and stop the flushing thread
+  virtual void close();
+
+  //Write the pending messages now
+  void flushBatch();
+
+  //Return true if the appender writes to the console
+  bool isConsole() const { return !_ownFd; }
+
+  //Make the appender available to the log configuration files
+  static void registerFactory();
+
+protected:
+  virtual void append(const log4cplus::spi::InternalLoggingEvent & event);
+
+private:
+  int _fd;
+  //True if _fd is a file opened by the appender
+  bool _ownFd;
+  size_t _bufferSize;
+  unsigned int _maxAgeMillis;
+  log4cplus::LogLevel _flushLevel;
+
+  //Pending messages; the strings are reused from one batch to the next
+  std::vector<std::string> _records;
+  std::vector<struct iovec> _iov;
+  size_t _count;
+  size_t _bytes;
+  //Time of the oldest pending message
+  std::chrono::steady_clock::time_point _oldest;
+
+  std::mutex _mutex;
+  std::condition_variable _wakeUp;
+  bool _stop;
+  std::thread _flusher;
+
+  //Start the flushing thread
+  void start();
+  //Write the pending messages, with _mutex held
+  void writeRecords();
+  //Body of the flushing thread, writing the messages which are too old
+  void run();
+
+  FtylogBatchAppender(const FtylogBatchAppender&) = delete;
+  FtylogBatchAppender& operator=(const FtylogBatchAppender&) = delete;
+};
+
+//  @end
+#endif
@@ -0,0 +1,119 @@
+/*  =========================================================================
+    fty_log_buffer - Per-thread buffer for formatting log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_buffer - Per-thread buffer for formatting log messages
+@discuss
+    Replaces the vasprintf()/free() pair done for every message: the buffer
+    only grows when a message does not fit, so in steady state formatting
+    a message does not touch the allocator.
+@end
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fty_common_logging_classes.h"
+
+FtylogFormatBuffer::FtylogFormatBuffer()
+  : _data(NULL), _capacity(0), _allocations(0)
+{
+}
+
+FtylogFormatBuffer::~FtylogFormatBuffer()
+{
+  free(_data);
+  //Messages logged by later thread exit handlers start a new buffer
+  _data = NULL;
+  _capacity = 0;
+}
+
+FtylogFormatBuffer & FtylogFormatBuffer::forThisThread()
+{
+  static thread_local FtylogFormatBuffer buffer;
+  return buffer;
+}
+
+bool FtylogFormatBuffer::reserve(size_t size)
+{
+  if (size <= _capacity)
+  {
+    return true;
+  }
+  size_t capacity = (_capacity == 0) ? INITIAL_CAPACITY : _capacity;
+  while (capacity < size)
+  {
+    capacity *= 2;
+  }
+  char * data = (char *) realloc(_data, capacity);
+  if (data == NULL)
+  {
+    return false;
+  }
+  _data = data;
+  _capacity = capacity;
+  _allocations++;
+  return true;
+}
+
+int FtylogFormatBuffer::format(const char * format, va_list args)
+{
+  return formatAt(0, format, args);
+}
+
+int FtylogFormatBuffer::append(size_t length, const char * format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int r = formatAt(length, format, args);
+  va_end(args);
+  return r;
+}
+
+int FtylogFormatBuffer::formatAt(size_t offset, const char * format, va_list args)
+{
+  if (!reserve(offset + INITIAL_CAPACITY))
+  {
+    return -1;
+  }
+
+  //First try with the current buffer, args is still needed for a retry
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  int r = vsnprintf(_data + offset, _capacity - offset, format, argsCopy);
+  va_end(argsCopy);
+  if (r < 0)
+  {
+    return -1;
+  }
+
+  if ((size_t) r >= _capacity - offset)
+  {
+    //Too small: grow to the exact need and format again
+    if (!reserve(offset + (size_t) r + 1))
+    {
+      return -1;
+    }
+    r = vsnprintf(_data + offset, _capacity - offset, format, args);
+  }
+  return (r < 0) ? -1 : (int) offset + r;
+}
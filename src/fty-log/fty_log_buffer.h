@@ -0,0 +1,75 @@
+/*  =========================================================================
+    fty_log_buffer - Per-thread buffer for formatting log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_BUFFER_H_INCLUDED
+#define FTY_LOG_BUFFER_H_INCLUDED
+
+#include <stdarg.h>
+#include <stddef.h>
+
+//  @interface
+
+//Character buffer grown on demand and reused by all the messages formatted
+//by one thread, so that formatting a message does not allocate once the
+//buffer is large enough
+class FtylogFormatBuffer
+{
+private:
+  char * _data;
+  size_t _capacity;
+  //Number of (re)allocations done so far
+  unsigned long _allocations;
+
+  FtylogFormatBuffer(const FtylogFormatBuffer&) = delete;
+  FtylogFormatBuffer& operator=(const FtylogFormatBuffer&) = delete;
+
+  //Make room for at least size bytes, return false if out of memory
+  bool reserve(size_t size);
+  //Format a printf-like text at the given offset of the buffer.
+  //Return the length of the content, or -1 on error
+  int formatAt(size_t offset, const char * format, va_list args);
+
+public:
+  //Size of the first allocation
+  static const size_t INITIAL_CAPACITY = 256;
+
+  FtylogFormatBuffer();
+  ~FtylogFormatBuffer();
+
+  //Return the buffer of the calling thread
+  static FtylogFormatBuffer & forThisThread();
+
+  //Format a printf-like message into the buffer.
+  //Return the length of the message, or -1 on error
+  int format(const char * format, va_list args);
+  //Append a printf-like text after the first length characters.
+  //Return the new length of the message, or -1 on error
+  int append(size_t length, const char * format, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+  //Formatted message, NUL terminated
+  const char * data() const { return _data; }
+  size_t capacity() const { return _capacity; }
+  unsigned long allocations() const { return _allocations; }
+};
+
+//  @end
+#endif
@@ -0,0 +1,471 @@
+/*  =========================================================================
+    fty_log_compress - Rolling file appender compressing the rotated files
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_compress - Rolling file appender compressing the rotated files
+@discuss
+    Only the compression thread touches the .gz files: it compresses a
+    rotated file into File.gz.tmp, shifts the backups, renames the result
+    to File.1.gz and removes the rotated file, so a backup is never seen
+    half written. zlib streams the file through buffers of CHUNK bytes,
+    which bounds the memory to them and the deflate state.
+@end
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <vector>
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/factory.h>
+
+#include "fty_common_logging_classes.h"
+
+const char * const FtylogCompressedRollingFileAppender::TYPE_NAME =
+  "fty::CompressedRollingFileAppender";
+
+namespace
+{
+
+//Size of the buffers of the compression
+const size_t CHUNK = 64 * 1024;
+
+const char PENDING[] = ".pending.";
+const char TEMPORARY[] = ".gz.tmp";
+
+std::string backupName(const std::string & file, int index)
+{
+  return file + "." + std::to_string(index) + ".gz";
+}
+
+//Parse the number of "<prefix><number><suffix>"
+bool parseNumber(const std::string & name, const std::string & prefix, const char * suffix,
+                 unsigned long long & number)
+{
+  size_t suffixLength = strlen(suffix);
+  if ((name.size() <= prefix.size() + suffixLength) || (name.compare(0, prefix.size(), prefix) != 0) ||
+      (name.compare(name.size() - suffixLength, suffixLength, suffix) != 0))
+  {
+    return false;
+  }
+  std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffixLength);
+  if (digits.find_first_not_of("0123456789") != std::string::npos)
+  {
+    return false;
+  }
+  number = strtoull(digits.c_str(), NULL, 10);
+  return true;
+}
+
+//Backups File.<n>.gz and rotated files File.pending.<n> of file, sorted by number
+void listRotated(const std::string & file,
+                 std::vector<std::pair<unsigned long long, std::string>> & backups,
+                 std::vector<std::pair<unsigned long long, std::string>> & pending)
+{
+  size_t slash = file.rfind('/');
+  std::string dir = (slash == std::string::npos) ? "." : file.substr(0, std::max(slash, (size_t) 1));
+  std::string base = (slash == std::string::npos) ? file : file.substr(slash + 1);
+  std::string prefix = (slash == std::string::npos) ? "" : file.substr(0, slash + 1);
+  DIR * handle = opendir(dir.c_str());
+  if (NULL == handle)
+  {
+    return;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(handle)) != NULL)
+  {
+    std::string name = entry->d_name;
+    unsigned long long number;
+    if (parseNumber(name, base + ".", ".gz", number))
+    {
+      backups.push_back(std::make_pair(number, prefix + name));
+    }
+    else if (parseNumber(name, base + PENDING, "", number))
+    {
+      pending.push_back(std::make_pair(number, prefix + name));
+    }
+  }
+  closedir(handle);
+  std::sort(backups.begin(), backups.end());
+  std::sort(pending.begin(), pending.end());
+}
+
+bool readFile(const std::string & path, std::string & content, std::string & error)
+{
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+  char buffer[4096];
+  ssize_t size;
+  while ((size = read(fd, buffer, sizeof(buffer))) != 0)
+  {
+    if (size < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      error = path + ": " + strerror(errno);
+      ::close(fd);
+      return false;
+    }
+    content.append(buffer, size);
+  }
+  ::close(fd);
+  return true;
+}
+
+//The compression only uses the time and the disk bandwidth left by the
+//other threads of the machine
+void lowerPriority()
+{
+  setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+  //IOPRIO_WHO_PROCESS of the calling thread, IOPRIO_CLASS_IDLE
+  syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+}
+
+}
+
+FtylogCompressedRollingFileAppender::FtylogCompressedRollingFileAppender(
+  const log4cplus::helpers::Properties & properties)
+  : log4cplus::Appender(properties), _file(properties.getProperty("File")),
+    _maxFileSize(DEFAULT_MAX_FILE_SIZE), _maxBackupIndex(DEFAULT_MAX_BACKUP_INDEX),
+    _queueSize(DEFAULT_QUEUE_SIZE), _compressionLevel(DEFAULT_COMPRESSION_LEVEL),
+    _fd(-1), _size(0), _sequence(1), _compressing(false), _stop(false)
+{
+  if (properties.exists("MaxFileSize"))
+  {
+    _maxFileSize = FtylogRingFileAppender::parseSize(properties.getProperty("MaxFileSize"));
+  }
+  if (properties.exists("MaxBackupIndex"))
+  {
+    _maxBackupIndex = atoi(properties.getProperty("MaxBackupIndex").c_str());
+  }
+  if (properties.exists("QueueSize"))
+  {
+    _queueSize = (size_t) atoi(properties.getProperty("QueueSize").c_str());
+  }
+  if (properties.exists("CompressionLevel"))
+  {
+    _compressionLevel = atoi(properties.getProperty("CompressionLevel").c_str());
+  }
+  open();
+}
+
+FtylogCompressedRollingFileAppender::FtylogCompressedRollingFileAppender(
+  const std::string & file, size_t maxFileSize, int maxBackupIndex, size_t queueSize,
+  int compressionLevel)
+  : _file(file), _maxFileSize(maxFileSize), _maxBackupIndex(maxBackupIndex),
+    _queueSize(queueSize), _compressionLevel(compressionLevel),
+    _fd(-1), _size(0), _sequence(1), _compressing(false), _stop(false)
+{
+  open();
+}
+
+FtylogCompressedRollingFileAppender::~FtylogCompressedRollingFileAppender()
+{
+  destructorImpl();
+}
+
+void FtylogCompressedRollingFileAppender::open()
+{
+  if (_maxFileSize == 0)
+  {
+    _maxFileSize = DEFAULT_MAX_FILE_SIZE;
+  }
+  _queueSize = std::max(_queueSize, (size_t) 1);
+  _compressionLevel = std::min(std::max(_compressionLevel, 1), 9);
+
+  //Rotated files left by a previous run, and the output of a compression
+  //it did not finish
+  std::vector<std::pair<unsigned long long, std::string>> backups, pending;
+  listRotated(_file, backups, pending);
+  unlink((_file + TEMPORARY).c_str());
+  for (const auto & rotated : pending)
+  {
+    _pending.push_back(rotated.second);
+    _sequence = rotated.first + 1;
+  }
+  while (_pending.size() > _queueSize)
+  {
+    unlink(_pending.front().c_str());
+    _pending.pop_front();
+  }
+
+  _fd = ::open(_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  struct stat fileStat;
+  if (_fd < 0)
+  {
+    log4cplus::helpers::getLogLog().error("Can not open the log file " + _file +
+                                          ": " + strerror(errno));
+  }
+  else if (fstat(_fd, &fileStat) == 0)
+  {
+    _size = (size_t) fileStat.st_size;
+  }
+  _thread = std::thread(&FtylogCompressedRollingFileAppender::run, this);
+}
+
+void FtylogCompressedRollingFileAppender::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    _wakeUp.notify_one();
+    _idle.notify_all();
+  }
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+  if (_fd >= 0)
+  {
+    ::close(_fd);
+    _fd = -1;
+  }
+  closed = true;
+}
+
+void FtylogCompressedRollingFileAppender::append(const log4cplus::spi::InternalLoggingEvent & event)
+{
+  if (_fd < 0)
+  {
+    return;
+  }
+  const log4cplus::tstring & message = formatEvent(event);
+  size_t written = 0;
+  while (written < message.size())
+  {
+    ssize_t size = write(_fd, message.data() + written, message.size() - written);
+    if (size < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      log4cplus::helpers::getLogLog().error("Can not write to the log file " + _file +
+                                            ": " + strerror(errno));
+      break;
+    }
+    written += size;
+  }
+  _size += written;
+  if (_size >= _maxFileSize)
+  {
+    rollover();
+  }
+}
+
+void FtylogCompressedRollingFileAppender::rollover()
+{
+  std::string pending = _file + PENDING + std::to_string(_sequence++);
+  ::close(_fd);
+  if (rename(_file.c_str(), pending.c_str()) == 0)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    //Bounded queue: drop the oldest rather than wait
+    if (_pending.size() >= _queueSize)
+    {
+      log4cplus::helpers::getLogLog().warn("The compression of " + _file +
+                                           " can not keep up, removing " + _pending.front());
+      unlink(_pending.front().c_str());
+      _pending.pop_front();
+    }
+    _pending.push_back(pending);
+    _wakeUp.notify_one();
+  }
+  else
+  {
+    log4cplus::helpers::getLogLog().error("Can not rotate the log file " + _file +
+                                          ": " + strerror(errno));
+  }
+  _fd = ::open(_file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0)
+  {
+    log4cplus::helpers::getLogLog().error("Can not open the log file " + _file +
+                                          ": " + strerror(errno));
+  }
+  _size = 0;
+}
+
+void FtylogCompressedRollingFileAppender::run()
+{
+  lowerPriority();
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true)
+  {
+    _wakeUp.wait(lock, [this]() { return _stop || !_pending.empty(); });
+    if (_stop)
+    {
+      break;
+    }
+    std::string pending = _pending.front();
+    _pending.pop_front();
+    _compressing = true;
+    lock.unlock();
+    compress(pending);
+    lock.lock();
+    _compressing = false;
+    if (_pending.empty())
+    {
+      _idle.notify_all();
+    }
+  }
+}
+
+void FtylogCompressedRollingFileAppender::waitForCompression()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _idle.wait(lock, [this]() { return _stop || (_pending.empty() && !_compressing); });
+}
+
+void FtylogCompressedRollingFileAppender::compress(const std::string & pending)
+{
+  if (_maxBackupIndex <= 0)
+  {
+    unlink(pending.c_str());
+    return;
+  }
+  int in = ::open(pending.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+  {
+    //Removed because the queue was full
+    return;
+  }
+  std::string temporary = _file + TEMPORARY;
+  char mode[] = "wb6";
+  mode[2] = (char) ('0' + _compressionLevel);
+  gzFile out = gzopen(temporary.c_str(), mode);
+  bool compressed = (NULL != out) && (gzbuffer(out, CHUNK) == 0);
+  std::vector<char> buffer(CHUNK);
+  while (compressed)
+  {
+    ssize_t size = read(in, buffer.data(), buffer.size());
+    if (size == 0)
+    {
+      break;
+    }
+    if (size < 0)
+    {
+      compressed = (errno == EINTR);
+      continue;
+    }
+    compressed = (gzwrite(out, buffer.data(), (unsigned int) size) == size);
+  }
+  if ((NULL != out) && (gzclose(out) != Z_OK))
+  {
+    compressed = false;
+  }
+  ::close(in);
+  if (!compressed)
+  {
+    //The rotated file stays, the next appender of the file tries again
+    log4cplus::helpers::getLogLog().error("Can not compress " + pending + " to " + temporary);
+    unlink(temporary.c_str());
+    return;
+  }
+
+  unlink(backupName(_file, _maxBackupIndex).c_str());
+  for (int index = _maxBackupIndex - 1; index >= 1; index--)
+  {
+    rename(backupName(_file, index).c_str(), backupName(_file, index + 1).c_str());
+  }
+  if (rename(temporary.c_str(), backupName(_file, 1).c_str()) != 0)
+  {
+    log4cplus::helpers::getLogLog().error("Can not rename " + temporary + ": " + strerror(errno));
+    return;
+  }
+  unlink(pending.c_str());
+}
+
+void FtylogCompressedRollingFileAppender::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getAppenderFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::AppenderFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogCompressedRollingFileAppender,
+                                         log4cplus::spi::AppenderFactory>(TYPE_NAME)));
+  });
+}
+
+bool FtylogCompressedRollingFileAppender::readCompressed(const std::string & path,
+                                                         std::string & content,
+                                                         std::string & error)
+{
+  gzFile in = gzopen(path.c_str(), "rb");
+  if (NULL == in)
+  {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+  std::vector<char> buffer(CHUNK);
+  int size;
+  while ((size = gzread(in, buffer.data(), (unsigned int) buffer.size())) > 0)
+  {
+    content.append(buffer.data(), size);
+  }
+  if (size < 0)
+  {
+    int code;
+    error = path + ": " + gzerror(in, &code);
+  }
+  gzclose(in);
+  return size == 0;
+}
+
+bool FtylogCompressedRollingFileAppender::readAll(const std::string & file, std::string & content,
+                                                  std::string & error)
+{
+  std::vector<std::pair<unsigned long long, std::string>> backups, pending;
+  listRotated(file, backups, pending);
+  //File.1.gz is the newest backup
+  for (auto backup = backups.rbegin(); backup != backups.rend(); ++backup)
+  {
+    if (!readCompressed(backup->second, content, error))
+    {
+      return false;
+    }
+  }
+  for (const auto & rotated : pending)
+  {
+    if (!readFile(rotated.second, content, error))
+    {
+      return false;
+    }
+  }
+  return readFile(file, content, error);
+}
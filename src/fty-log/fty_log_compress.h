@@ -0,0 +1,124 @@
+/*  =========================================================================
+    fty_log_compress - Rolling file appender compressing the rotated files
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_COMPRESS_H_INCLUDED
+#define FTY_LOG_COMPRESS_H_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <log4cplus/appender.h>
+#include <log4cplus/helpers/property.h>
+
+//  @interface
+
+//Appender writing to a file rotated when it reaches a size, like
+//log4cplus::RollingFileAppender, whose rotated files are compressed with
+//gzip by a background thread of low priority. Selected in a log
+//configuration file with:
+//  log4cplus.appender.file=fty::CompressedRollingFileAppender
+//  log4cplus.appender.file.File=/var/log/agent.log
+//  log4cplus.appender.file.MaxFileSize=16MB
+//  log4cplus.appender.file.MaxBackupIndex=5
+//  log4cplus.appender.file.layout=log4cplus::PatternLayout
+//The backups are File.1.gz (newest) to File.<MaxBackupIndex>.gz. A
+//rotation renames the file to File.pending.<n> and queues it; the logging
+//thread never waits for the compression. When QueueSize files (4 by
+//default) already wait, the oldest one is removed. The files still waiting
+//when the appender is closed are compressed by the next appender of File.
+class FtylogCompressedRollingFileAppender : public log4cplus::Appender
+{
+public:
+  //Name of the appender type in the log configuration files
+  static const char * const TYPE_NAME;
+  static const size_t DEFAULT_MAX_FILE_SIZE = 10 * 1024 * 1024;
+  static const int DEFAULT_MAX_BACKUP_INDEX = 1;
+  static const size_t DEFAULT_QUEUE_SIZE = 4;
+  //gzip level, from 1 (fastest) to 9 (smallest)
+  static const int DEFAULT_COMPRESSION_LEVEL = 6;
+
+  explicit FtylogCompressedRollingFileAppender(const log4cplus::helpers::Properties & properties);
+  FtylogCompressedRollingFileAppender(const std::string & file,
+                                      size_t maxFileSize = DEFAULT_MAX_FILE_SIZE,
+                                      int maxBackupIndex = DEFAULT_MAX_BACKUP_INDEX,
+                                      size_t queueSize = DEFAULT_QUEUE_SIZE,
+                                      int compressionLevel = DEFAULT_COMPRESSION_LEVEL);
+  virtual ~FtylogCompressedRollingFileAppender();
+
+  //Stop the compression thread after the file it is compressing
+  virtual void close();
+
+  //Wait until no rotated file waits for the compression
+  void waitForCompression();
+
+  //Make the appender available to the log configuration files
+  static void registerFactory();
+
+  //Append the uncompressed content of a gzip file to content. Return false
+  //and set error if it can not be read.
+  static bool readCompressed(const std::string & path, std::string & content,
+                             std::string & error);
+  //Content written to file by the appender, oldest first: the compressed
+  //backups, the files waiting for compression, then file itself
+  static bool readAll(const std::string & file, std::string & content, std::string & error);
+
+protected:
+  virtual void append(const log4cplus::spi::InternalLoggingEvent & event);
+
+private:
+  std::string _file;
+  size_t _maxFileSize;
+  int _maxBackupIndex;
+  size_t _queueSize;
+  int _compressionLevel;
+  //File being written, -1 if it could not be opened, and its size
+  int _fd;
+  size_t _size;
+  //Number of the next rotated file, File.pending.<n>
+  unsigned long long _sequence;
+
+  //Rotated files waiting for the compression thread, oldest first
+  std::mutex _mutex;
+  std::condition_variable _wakeUp;
+  std::condition_variable _idle;
+  std::deque<std::string> _pending;
+  bool _compressing;
+  bool _stop;
+  std::thread _thread;
+
+  //Queue the rotated files left by a previous run, open the file and
+  //start the compression thread
+  void open();
+  //Rename the file and queue it, then start a new one
+  void rollover();
+  //Body of the compression thread
+  void run();
+  //Compress a rotated file into File.1.gz, shifting the older backups
+  void compress(const std::string & pending);
+
+  FtylogCompressedRollingFileAppender(const FtylogCompressedRollingFileAppender&) = delete;
+  FtylogCompressedRollingFileAppender& operator=(const FtylogCompressedRollingFileAppender&) = delete;
+};
+
+//  @end
+#endif
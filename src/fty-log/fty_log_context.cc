@@ -0,0 +1,317 @@
+/*  =========================================================================
+    fty_log_context - Per-thread stack of scoped context entries
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_context - Per-thread stack of scoped context entries
+@discuss
+    The layouts of the library read the entries in a snapshot, built when
+    a message is logged after they changed and shared by reference count
+    with the messages queued for the backend thread. The snapshot object
+    is rebuilt in place, reusing its buffers, once no message holds it.
+    The log4cplus layouts read the context in the MDC, a map of strings.
+    The entries are copied to it when a message is logged synchronously
+    after they changed, and the copy reuses the map nodes and the string
+    buffers of the previous one when the keys are the same, as they are
+    from one request to the next. A key already in the MDC (e.g. set by
+    Ftylog::setContext) gets its value back when the entry hiding it is
+    popped.
+@end
+ */
+
+#include <string.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+std::atomic<unsigned long long> snapshotSerials(0);
+
+thread_local const FtylogEventContext::Scope * currentScope = NULL;
+
+}
+
+////////////////////////
+//FtylogContextSnapshot
+////////////////////////
+
+FtylogContextSnapshot::FtylogContextSnapshot()
+  : _serial(0)
+{
+  _text.reserve(FtylogContextStack::INITIAL_TEXT);
+  _entries.reserve(FtylogContextStack::INITIAL_ENTRIES);
+}
+
+const char * FtylogContextSnapshot::find(const char * key, size_t keyLength,
+                                         size_t & valueLength) const
+{
+  for (const Entry & entry : _entries)
+  {
+    if ((entry.keyLength == keyLength) &&
+        (memcmp(_text.data() + entry.keyOffset, key, keyLength) == 0))
+    {
+      valueLength = entry.valueLength;
+      return _text.data() + entry.valueOffset;
+    }
+  }
+  return NULL;
+}
+
+////////////////////////
+//FtylogContextStack
+////////////////////////
+
+FtylogContextStack::FtylogContextStack()
+  : _version(0), _snapshotVersion(0), _mirroredVersion(0), _mirroredCount(0)
+{
+  _text.reserve(INITIAL_TEXT);
+  _entries.reserve(INITIAL_ENTRIES);
+}
+
+FtylogContextStack & FtylogContextStack::forThisThread()
+{
+  static thread_local FtylogContextStack stack;
+  return stack;
+}
+
+void FtylogContextStack::push(const char * key, size_t keyLength,
+                              const char * value, size_t valueLength)
+{
+  Entry entry;
+  entry.keyOffset = _text.size();
+  entry.keyLength = keyLength;
+  _text.append(key, keyLength);
+  entry.valueOffset = _text.size();
+  entry.valueLength = valueLength;
+  _text.append(value, valueLength);
+  _entries.push_back(entry);
+  _version++;
+}
+
+void FtylogContextStack::pop(size_t count)
+{
+  if (count >= _entries.size())
+  {
+    return;
+  }
+  _text.resize(_entries[count].keyOffset);
+  _entries.resize(count);
+  _version++;
+}
+
+bool FtylogContextStack::hasKey(const std::string & key) const
+{
+  for (const Entry & entry : _entries)
+  {
+    if ((entry.keyLength == key.size()) &&
+        (memcmp(_text.data() + entry.keyOffset, key.data(), entry.keyLength) == 0))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FtylogContextStack::buildSnapshot()
+{
+  _snapshotVersion = _version;
+  if (_entries.empty())
+  {
+    return;
+  }
+  if (!_snapshot || (_snapshot.use_count() > 1))
+  {
+    //Queued messages keep the previous snapshot
+    _snapshot = std::make_shared<FtylogContextSnapshot>();
+  }
+  else
+  {
+    //The backend thread released it after reading it
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  FtylogContextSnapshot & snapshot = *_snapshot;
+  snapshot._text.clear();
+  snapshot._entries.clear();
+  snapshot._serial = ++snapshotSerials;
+  //The inner value replaces the outer one, at the place of the outer key
+  for (const Entry & entry : _entries)
+  {
+    const char * key = _text.data() + entry.keyOffset;
+    const char * value = _text.data() + entry.valueOffset;
+    size_t valueLength;
+    if (snapshot.find(key, entry.keyLength, valueLength) != NULL)
+    {
+      for (FtylogContextSnapshot::Entry & existing : snapshot._entries)
+      {
+        if ((existing.keyLength == entry.keyLength) &&
+            (memcmp(snapshot._text.data() + existing.keyOffset, key, entry.keyLength) == 0))
+        {
+          existing.valueOffset = snapshot._text.size();
+          existing.valueLength = entry.valueLength;
+          snapshot._text.append(value, entry.valueLength);
+        }
+      }
+      continue;
+    }
+    FtylogContextSnapshot::Entry copy;
+    copy.keyOffset = snapshot._text.size();
+    copy.keyLength = entry.keyLength;
+    snapshot._text.append(key, entry.keyLength);
+    copy.valueOffset = snapshot._text.size();
+    copy.valueLength = entry.valueLength;
+    snapshot._text.append(value, entry.valueLength);
+    snapshot._entries.push_back(copy);
+  }
+}
+
+bool FtylogContextStack::hasOtherMdc() const
+{
+  if (log4cplus::getMDC().getContext().size() > _mirroredCount)
+  {
+    return true;
+  }
+  for (size_t i = 0; i < _mirroredCount; i++)
+  {
+    if (_shadowed[i])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FtylogContextStack::isMirrored(const std::string & key) const
+{
+  for (size_t i = 0; i < _mirroredCount; i++)
+  {
+    if (_mirroredKeys[i] == key)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FtylogContextStack::mirrorEntries()
+{
+  log4cplus::MDC & mdc = log4cplus::getMDC();
+  //The keys of the popped entries get back the value they hid, or are
+  //removed; the others are kept at the beginning of the vectors
+  size_t kept = 0;
+  for (size_t i = 0; i < _mirroredCount; i++)
+  {
+    if (!hasKey(_mirroredKeys[i]))
+    {
+      if (_shadowed[i])
+      {
+        mdc.put(_mirroredKeys[i], _shadowValues[i]);
+      }
+      else
+      {
+        mdc.remove(_mirroredKeys[i]);
+      }
+      continue;
+    }
+    if (kept != i)
+    {
+      _mirroredKeys[kept].swap(_mirroredKeys[i]);
+      _shadowValues[kept].swap(_shadowValues[i]);
+      _shadowed[kept] = _shadowed[i];
+    }
+    kept++;
+  }
+  _mirroredCount = kept;
+
+  //Inner entries come last and override the outer ones with the same key
+  for (size_t i = 0; i < _entries.size(); i++)
+  {
+    const Entry & entry = _entries[i];
+    _key.assign(_text, entry.keyOffset, entry.keyLength);
+    _value.assign(_text, entry.valueOffset, entry.valueLength);
+    if (!isMirrored(_key))
+    {
+      if (_mirroredKeys.size() == _mirroredCount)
+      {
+        _mirroredKeys.resize(_mirroredCount + 1);
+        _shadowValues.resize(_mirroredCount + 1);
+        _shadowed.resize(_mirroredCount + 1);
+      }
+      _mirroredKeys[_mirroredCount].assign(_key);
+      _shadowed[_mirroredCount] = mdc.get(&_shadowValues[_mirroredCount], _key) ? 1 : 0;
+      _mirroredCount++;
+    }
+    mdc.put(_key, _value);
+  }
+  _mirroredVersion = _version;
+}
+
+void FtylogContextStack::invalidateMirror()
+{
+  _mirroredCount = 0;
+  _version++;
+}
+
+////////////////////////
+//FtylogEventContext
+////////////////////////
+
+FtylogEventContext::Scope::Scope(const FtylogContextSnapshot * snapshot_,
+                                 const log4cplus::MappedDiagnosticContextMap & mdc_)
+  : _previous(currentScope), snapshot(snapshot_), mdc(mdc_)
+{
+  currentScope = this;
+}
+
+FtylogEventContext::Scope::~Scope()
+{
+  currentScope = _previous;
+}
+
+const FtylogEventContext::Scope * FtylogEventContext::current()
+{
+  return currentScope;
+}
+
+void FtylogEventContext::append(std::string & out,
+                                const log4cplus::spi::InternalLoggingEvent & event,
+                                const std::string & key)
+{
+  const Scope * scope = currentScope;
+  if (NULL == scope)
+  {
+    out.append(event.getMDC(key));
+    return;
+  }
+  size_t length;
+  const char * value = (NULL != scope->snapshot) ?
+    scope->snapshot->find(key.data(), key.size(), length) : NULL;
+  if (NULL != value)
+  {
+    out.append(value, length);
+    return;
+  }
+  auto entry = scope->mdc.find(key);
+  if (entry != scope->mdc.end())
+  {
+    out.append(entry->second);
+  }
+}
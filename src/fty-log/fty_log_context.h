@@ -0,0 +1,251 @@
+/*  =========================================================================
+    fty_log_context - Per-thread stack of scoped context entries
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_CONTEXT_H_INCLUDED
+#define FTY_LOG_CONTEXT_H_INCLUDED
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <log4cplus/mdc.h>
+#include <log4cplus/spi/loggingevent.h>
+
+//  @interface
+
+//Entries of the scoped contexts of a thread at one time, one per key with
+//its innermost value. Shared by the messages logged while the entries do
+//not change (those waiting in the queue of the asynchronous mode
+//included), and never modified while shared.
+class FtylogContextSnapshot
+{
+private:
+  struct Entry
+  {
+    size_t keyOffset;
+    size_t keyLength;
+    size_t valueOffset;
+    size_t valueLength;
+  };
+
+  std::string _text;
+  std::vector<Entry> _entries;
+  //Different for every content a snapshot object gets
+  unsigned long long _serial;
+
+  friend class FtylogContextStack;
+
+public:
+  FtylogContextSnapshot();
+
+  unsigned long long serial() const { return _serial; }
+
+  //Value of key, or NULL if no entry has it
+  const char * find(const char * key, size_t keyLength, size_t & valueLength) const;
+
+  //Call function(key, keyLength, value, valueLength) for each entry
+  template <typename Function>
+  void forEach(Function function) const
+  {
+    for (const Entry & entry : _entries)
+    {
+      function(_text.data() + entry.keyOffset, entry.keyLength,
+               _text.data() + entry.valueOffset, entry.valueLength);
+    }
+  }
+};
+
+//Key/value pairs of the FtylogScopedContext objects of one thread, the
+//innermost last. Keys and values are stored back to back in one buffer
+//whose capacity is kept when entries are popped, so pushing and popping
+//do not allocate memory once the thread has reached its deepest context.
+class FtylogContextStack
+{
+private:
+  struct Entry
+  {
+    size_t keyOffset;
+    size_t keyLength;
+    size_t valueOffset;
+    size_t valueLength;
+  };
+
+  std::string _text;
+  std::vector<Entry> _entries;
+  //Changed by every push and pop
+  unsigned long long _version;
+  //Snapshot of the entries, and the version it was built from
+  std::shared_ptr<FtylogContextSnapshot> _snapshot;
+  unsigned long long _snapshotVersion;
+  //Version of the entries copied to the MDC of the thread
+  unsigned long long _mirroredVersion;
+  //Keys the last copy put into the MDC: the first _mirroredCount ones,
+  //with the values they hid in the MDC (_shadowed[i] is 0 if none), put
+  //back when their entries are popped. The vectors do not shrink, to keep
+  //the buffers of the strings.
+  std::vector<std::string> _mirroredKeys;
+  std::vector<std::string> _shadowValues;
+  std::vector<char> _shadowed;
+  size_t _mirroredCount;
+  //Reused buffers for the arguments of MDC::put()
+  std::string _key;
+  std::string _value;
+
+  //Build the snapshot of the entries
+  void buildSnapshot();
+  //Copy the entries to the MDC
+  void mirrorEntries();
+  //Return true if an entry has this key
+  bool hasKey(const std::string & key) const;
+  //Return true if the last copy put this key into the MDC
+  bool isMirrored(const std::string & key) const;
+
+  FtylogContextStack(const FtylogContextStack&) = delete;
+  FtylogContextStack& operator=(const FtylogContextStack&) = delete;
+
+public:
+  //Storage reserved for each thread, enough for usual contexts
+  static const size_t INITIAL_TEXT = 1024;
+  static const size_t INITIAL_ENTRIES = 16;
+
+  FtylogContextStack();
+
+  //Stack of the calling thread
+  static FtylogContextStack & forThisThread();
+
+  size_t size() const { return _entries.size(); }
+
+  void push(const char * key, size_t keyLength, const char * value, size_t valueLength);
+  //Remove the entries above the first count ones
+  void pop(size_t count);
+
+  //Snapshot of the entries, NULL if there is none. It is built again after
+  //the entries changed, in place unless a queued message still holds it.
+  const FtylogContextSnapshot * snapshot()
+  {
+    if (_version != _snapshotVersion)
+    {
+      buildSnapshot();
+    }
+    return _entries.empty() ? NULL : _snapshot.get();
+  }
+  //Same, shared with a message queued for the backend thread
+  std::shared_ptr<const FtylogContextSnapshot> shareSnapshot()
+  {
+    if (snapshot() == NULL)
+    {
+      return std::shared_ptr<const FtylogContextSnapshot>();
+    }
+    return _snapshot;
+  }
+
+  //Make the entries visible to the log4cplus layouts (%X{key} of
+  //log4cplus::PatternLayout) through the MDC of the thread, if they
+  //changed since the last call. Called before logging a message
+  //synchronously: contexts without messages cost nothing.
+  void mirror()
+  {
+    if (_version != _mirroredVersion)
+    {
+      mirrorEntries();
+    }
+  }
+
+  //Return true if the MDC of the thread holds more than the copies of the
+  //entries, e.g. values of Ftylog::setContext()
+  bool hasOtherMdc() const;
+
+  //The MDC was replaced: copy the entries again on the next mirror()
+  void invalidateMirror();
+};
+
+//Context of the message the calling thread is writing to the appenders:
+//the snapshot of the scoped contexts and the MDC of the thread which logged
+//it. Set by Ftylog and the backend thread, it lets the layouts of the
+//library read the context without copying the MDC. A message logged
+//without it (through log4cplus directly) has the MDC of its event.
+class FtylogEventContext
+{
+public:
+  class Scope
+  {
+  private:
+    const Scope * _previous;
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  public:
+    //Entries of the scoped contexts (or NULL), which hide the same keys of mdc
+    const FtylogContextSnapshot * snapshot;
+    const log4cplus::MappedDiagnosticContextMap & mdc;
+
+    Scope(const FtylogContextSnapshot * snapshot_,
+          const log4cplus::MappedDiagnosticContextMap & mdc_);
+    ~Scope();
+  };
+
+  //Context of the message the calling thread is writing, or NULL
+  static const Scope * current();
+
+  //Append the value of key to out; append nothing if the context does
+  //not have the key
+  static void append(std::string & out, const log4cplus::spi::InternalLoggingEvent & event,
+                     const std::string & key);
+
+  //Call function(key, keyLength, value, valueLength) for each key of the
+  //context: those of the MDC first (in order), then the scoped ones
+  template <typename Function>
+  static void forEach(const log4cplus::spi::InternalLoggingEvent & event, Function function)
+  {
+    const Scope * scope = current();
+    if (NULL == scope)
+    {
+      forEachMdc(event.getMDCCopy(), NULL, function);
+      return;
+    }
+    forEachMdc(scope->mdc, scope->snapshot, function);
+    if (NULL != scope->snapshot)
+    {
+      scope->snapshot->forEach(function);
+    }
+  }
+
+private:
+  template <typename Function>
+  static void forEachMdc(const log4cplus::MappedDiagnosticContextMap & mdc,
+                         const FtylogContextSnapshot * snapshot, Function & function)
+  {
+    size_t length;
+    for (const auto & entry : mdc)
+    {
+      if ((NULL == snapshot) ||
+          (NULL == snapshot->find(entry.first.data(), entry.first.size(), length)))
+      {
+        function(entry.first.data(), entry.first.size(), entry.second.data(), entry.second.size());
+      }
+    }
+  }
+};
+
+//  @end
+#endif
@@ -0,0 +1,422 @@
+/*  =========================================================================
+    fty_log_deferred - Deferred formatting of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_deferred - Deferred formatting of log messages
+@discuss
+    Both steps walk the conversions of the format: capture() reads each
+    argument with va_arg according to its conversion and appends its bytes
+    to a buffer, format() reads them back and prints each conversion with
+    snprintf, so the output matches vsnprintf byte for byte.
+@end
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+//Type of the argument consumed by a conversion
+enum ArgType
+{
+  ARG_NONE,
+  ARG_INT,
+  ARG_UINT,
+  ARG_LONG,
+  ARG_ULONG,
+  ARG_LLONG,
+  ARG_ULLONG,
+  ARG_INTMAX,
+  ARG_UINTMAX,
+  ARG_SSIZE,
+  ARG_SIZE,
+  ARG_PTRDIFF,
+  ARG_DOUBLE,
+  ARG_LDOUBLE,
+  ARG_POINTER,
+  ARG_STRING
+};
+
+//Length of a NULL string in the captured arguments
+const size_t NULL_STRING = (size_t) -1;
+
+//One conversion of a format, from the '%' to the conversion character
+struct Conversion
+{
+  const char * begin;
+  const char * end;
+  //Number of '*' for the width and the precision, read as int arguments
+  int stars;
+  bool precisionStar;
+  //Precision written in the format, -1 if none
+  int precision;
+  ArgType type;
+};
+
+//Parse the conversion starting at p, which points to a '%'.
+//Return false if the conversion is not supported.
+bool parseConversion(const char * p, Conversion & conversion)
+{
+  conversion.begin = p++;
+  conversion.stars = 0;
+  conversion.precisionStar = false;
+  conversion.precision = -1;
+
+  if (*p == '%')
+  {
+    conversion.end = p + 1;
+    conversion.type = ARG_NONE;
+    return true;
+  }
+
+  //Flags
+  while ((*p != '\0') && (strchr("-+ #0'I", *p) != NULL))
+  {
+    p++;
+  }
+  //Width
+  if (*p == '*')
+  {
+    conversion.stars++;
+    p++;
+  }
+  while ((*p >= '0') && (*p <= '9'))
+  {
+    p++;
+  }
+  //Positional arguments (%1$d, %*2$d) are not supported
+  if (*p == '$')
+  {
+    return false;
+  }
+  //Precision
+  if (*p == '.')
+  {
+    p++;
+    if (*p == '*')
+    {
+      conversion.stars++;
+      conversion.precisionStar = true;
+      p++;
+    }
+    else
+    {
+      conversion.precision = 0;
+      while ((*p >= '0') && (*p <= '9'))
+      {
+        if (conversion.precision < INT32_MAX / 10)
+        {
+          conversion.precision = conversion.precision * 10 + (*p - '0');
+        }
+        p++;
+      }
+    }
+    if (*p == '$' || ((*p >= '0') && (*p <= '9')))
+    {
+      return false;
+    }
+  }
+
+  //Length modifier: 'q' stands for ll, q and L
+  char length = 0;
+  switch (*p)
+  {
+    case 'h':
+      p++;
+      if (*p == 'h')
+      {
+        p++;
+      }
+      break;
+    case 'l':
+      p++;
+      length = 'l';
+      if (*p == 'l')
+      {
+        p++;
+        length = 'q';
+      }
+      break;
+    case 'q':
+    case 'L':
+      length = 'q';
+      p++;
+      break;
+    case 'j':
+    case 't':
+      length = *p++;
+      break;
+    case 'z':
+    case 'Z':
+      length = 'z';
+      p++;
+      break;
+    default:
+      break;
+  }
+
+  switch (*p)
+  {
+    case 'd':
+    case 'i':
+      switch (length)
+      {
+        case 'l': conversion.type = ARG_LONG; break;
+        case 'q': conversion.type = ARG_LLONG; break;
+        case 'j': conversion.type = ARG_INTMAX; break;
+        case 'z': conversion.type = ARG_SSIZE; break;
+        case 't': conversion.type = ARG_PTRDIFF; break;
+        default: conversion.type = ARG_INT; break;
+      }
+      break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      switch (length)
+      {
+        case 'l': conversion.type = ARG_ULONG; break;
+        case 'q': conversion.type = ARG_ULLONG; break;
+        case 'j': conversion.type = ARG_UINTMAX; break;
+        case 'z': conversion.type = ARG_SIZE; break;
+        case 't': conversion.type = ARG_PTRDIFF; break;
+        default: conversion.type = ARG_UINT; break;
+      }
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      conversion.type = (length == 'q') ? ARG_LDOUBLE : ARG_DOUBLE;
+      break;
+    case 'c':
+      //%lc takes a wint_t
+      if (length == 'l')
+      {
+        return false;
+      }
+      conversion.type = ARG_INT;
+      break;
+    case 's':
+      //%ls takes a wide string
+      if (length == 'l')
+      {
+        return false;
+      }
+      conversion.type = ARG_STRING;
+      break;
+    case 'p':
+      conversion.type = ARG_POINTER;
+      break;
+    default:
+      //%n writes to the caller's memory, %m reads the caller's errno,
+      //the others are wide or unknown conversions
+      return false;
+  }
+  conversion.end = p + 1;
+  return true;
+}
+
+template <typename T>
+void appendValue(std::string & out, T value)
+{
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+T readValue(const std::string & args, size_t & pos)
+{
+  T value;
+  memcpy(&value, args.data() + pos, sizeof(value));
+  pos += sizeof(value);
+  return value;
+}
+
+//Append one conversion printed by snprintf to out
+template <typename T>
+void appendFormatted(std::string & out, const char * spec, const int * stars,
+                     int starCount, T value)
+{
+  size_t pos = out.size();
+  size_t room = 64;
+  for (;;)
+  {
+    out.resize(pos + room);
+    int r;
+    switch (starCount)
+    {
+      case 0:
+        r = snprintf(&out[pos], room, spec, value);
+        break;
+      case 1:
+        r = snprintf(&out[pos], room, spec, stars[0], value);
+        break;
+      default:
+        r = snprintf(&out[pos], room, spec, stars[0], stars[1], value);
+        break;
+    }
+    if (r < 0)
+    {
+      out.resize(pos);
+      return;
+    }
+    if ((size_t) r < room)
+    {
+      out.resize(pos + r);
+      return;
+    }
+    room = (size_t) r + 1;
+  }
+}
+
+bool captureArgs(const char * format, va_list * args, std::string & out)
+{
+  Conversion conversion;
+  for (const char * p = strchr(format, '%'); p != NULL; p = strchr(conversion.end, '%'))
+  {
+    if (!parseConversion(p, conversion))
+    {
+      return false;
+    }
+    int stars[2] = { 0, 0 };
+    for (int i = 0; i < conversion.stars; i++)
+    {
+      stars[i] = va_arg(*args, int);
+      appendValue(out, stars[i]);
+    }
+    switch (conversion.type)
+    {
+      case ARG_NONE: break;
+      case ARG_INT: appendValue(out, va_arg(*args, int)); break;
+      case ARG_UINT: appendValue(out, va_arg(*args, unsigned int)); break;
+      case ARG_LONG: appendValue(out, va_arg(*args, long)); break;
+      case ARG_ULONG: appendValue(out, va_arg(*args, unsigned long)); break;
+      case ARG_LLONG: appendValue(out, va_arg(*args, long long)); break;
+      case ARG_ULLONG: appendValue(out, va_arg(*args, unsigned long long)); break;
+      case ARG_INTMAX: appendValue(out, va_arg(*args, intmax_t)); break;
+      case ARG_UINTMAX: appendValue(out, va_arg(*args, uintmax_t)); break;
+      case ARG_SSIZE: appendValue(out, va_arg(*args, ssize_t)); break;
+      case ARG_SIZE: appendValue(out, va_arg(*args, size_t)); break;
+      case ARG_PTRDIFF: appendValue(out, va_arg(*args, ptrdiff_t)); break;
+      case ARG_DOUBLE: appendValue(out, va_arg(*args, double)); break;
+      case ARG_LDOUBLE: appendValue(out, va_arg(*args, long double)); break;
+      case ARG_POINTER: appendValue(out, va_arg(*args, void *)); break;
+      case ARG_STRING:
+      {
+        //The string may be gone when the message is formatted: copy it,
+        //up to the precision which allows strings without terminating NUL
+        const char * s = va_arg(*args, const char *);
+        if (s == NULL)
+        {
+          appendValue(out, NULL_STRING);
+          break;
+        }
+        int precision = conversion.precisionStar ? stars[conversion.stars - 1] : conversion.precision;
+        size_t length = (precision >= 0) ? strnlen(s, precision) : strlen(s);
+        appendValue(out, length);
+        out.append(s, length);
+        out.push_back('\0');
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+}
+
+bool FtylogDeferredFormat::capture(const char * format, va_list args, std::string & out)
+{
+  va_list copy;
+  va_copy(copy, args);
+  bool result = captureArgs(format, &copy, out);
+  va_end(copy);
+  return result;
+}
+
+void FtylogDeferredFormat::format(const char * format, const std::string & args, std::string & out)
+{
+  out.clear();
+  std::string spec;
+  size_t pos = 0;
+  const char * text = format;
+  Conversion conversion;
+  for (const char * p = strchr(format, '%'); p != NULL; p = strchr(conversion.end, '%'))
+  {
+    out.append(text, p - text);
+    //The format was accepted by capture()
+    parseConversion(p, conversion);
+    text = conversion.end;
+    if (conversion.type == ARG_NONE)
+    {
+      out.push_back('%');
+      continue;
+    }
+    spec.assign(conversion.begin, conversion.end - conversion.begin);
+    const char * s = spec.c_str();
+    int stars[2] = { 0, 0 };
+    for (int i = 0; i < conversion.stars; i++)
+    {
+      stars[i] = readValue<int>(args, pos);
+    }
+    int n = conversion.stars;
+    switch (conversion.type)
+    {
+      case ARG_NONE: break;
+      case ARG_INT: appendFormatted(out, s, stars, n, readValue<int>(args, pos)); break;
+      case ARG_UINT: appendFormatted(out, s, stars, n, readValue<unsigned int>(args, pos)); break;
+      case ARG_LONG: appendFormatted(out, s, stars, n, readValue<long>(args, pos)); break;
+      case ARG_ULONG: appendFormatted(out, s, stars, n, readValue<unsigned long>(args, pos)); break;
+      case ARG_LLONG: appendFormatted(out, s, stars, n, readValue<long long>(args, pos)); break;
+      case ARG_ULLONG: appendFormatted(out, s, stars, n, readValue<unsigned long long>(args, pos)); break;
+      case ARG_INTMAX: appendFormatted(out, s, stars, n, readValue<intmax_t>(args, pos)); break;
+      case ARG_UINTMAX: appendFormatted(out, s, stars, n, readValue<uintmax_t>(args, pos)); break;
+      case ARG_SSIZE: appendFormatted(out, s, stars, n, readValue<ssize_t>(args, pos)); break;
+      case ARG_SIZE: appendFormatted(out, s, stars, n, readValue<size_t>(args, pos)); break;
+      case ARG_PTRDIFF: appendFormatted(out, s, stars, n, readValue<ptrdiff_t>(args, pos)); break;
+      case ARG_DOUBLE: appendFormatted(out, s, stars, n, readValue<double>(args, pos)); break;
+      case ARG_LDOUBLE: appendFormatted(out, s, stars, n, readValue<long double>(args, pos)); break;
+      case ARG_POINTER: appendFormatted(out, s, stars, n, readValue<void *>(args, pos)); break;
+      case ARG_STRING:
+      {
+        const char * value = NULL;
+        size_t length = readValue<size_t>(args, pos);
+        if (length != NULL_STRING)
+        {
+          value = args.data() + pos;
+          pos += length + 1;
+        }
+        appendFormatted(out, s, stars, n, value);
+        break;
+      }
+    }
+  }
+  out.append(text);
+}
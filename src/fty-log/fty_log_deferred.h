@@ -0,0 +1,49 @@
+/*  =========================================================================
+    fty_log_deferred - Deferred formatting of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_DEFERRED_H_INCLUDED
+#define FTY_LOG_DEFERRED_H_INCLUDED
+
+#include <stdarg.h>
+#include <string>
+
+//  @interface
+
+//Formatting of printf-like messages split in two steps: capture() copies
+//the arguments in a compact binary form, format() builds the message from
+//the format and the captured arguments, later and possibly on another thread.
+//The result is the same as vsnprintf on the original arguments.
+class FtylogDeferredFormat
+{
+public:
+  //Append the arguments used by format to out. Strings (%s) are copied.
+  //Return false if the format can not be deferred: positional arguments,
+  //wide characters and strings, %n and %m. The arguments are read from a
+  //copy of args, which the caller can still use in that case.
+  static bool capture(const char * format, va_list args, std::string & out);
+
+  //Replace out with the message built from format and the arguments
+  //captured by capture() for the same format
+  static void format(const char * format, const std::string & args, std::string & out);
+};
+
+//  @end
+#endif
@@ -0,0 +1,436 @@
+/*  =========================================================================
+    fty_log_journal - Appender sending batches of records to systemd-journald
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_journal - Appender sending batches of records to systemd-journald
+@discuss
+    A record is a datagram of "FIELD=value\n" lines; a value holding a new
+    line is sent as "FIELD\n", its size on 64 bits little endian, the value
+    and "\n". The socket is not connected, so that a restart of journald
+    does not break it. A record larger than the socket accepts goes in a
+    sealed memfd passed with SCM_RIGHTS, the way libsystemd does; it is
+    dropped where the C library has no memfd_create().
+@end
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/factory.h>
+
+#include "fty_common_logging_classes.h"
+
+const char * const FtylogJournalAppender::TYPE_NAME = "fty::JournalAppender";
+const char * const FtylogJournalAppender::DEFAULT_SOCKET_PATH = "/run/systemd/journal/socket";
+
+namespace
+{
+
+//Limit of sendmmsg()
+const size_t MAX_BATCH_SIZE = 1024;
+//Limit of journald for the field names
+const size_t MAX_FIELD_NAME = 64;
+
+void appendField(std::string & out, const char * name, size_t nameLength,
+                 const char * value, size_t length)
+{
+  out.append(name, nameLength);
+  if (memchr(value, '\n', length) == NULL)
+  {
+    out.push_back('=');
+  }
+  else
+  {
+    out.push_back('\n');
+    uint64_t size = htole64((uint64_t) length);
+    out.append((const char *) &size, sizeof(size));
+  }
+  out.append(value, length);
+  out.push_back('\n');
+}
+
+void appendField(std::string & out, const char * name, const std::string & value)
+{
+  appendField(out, name, strlen(name), value.data(), value.size());
+}
+
+//Field name of an MDC key: upper case letters, digits and '_', starting
+//with a letter (journald keeps the names starting with '_' to itself)
+bool fieldName(std::string & name, const char * key, size_t keyLength)
+{
+  name.clear();
+  for (size_t i = 0; i < keyLength; i++)
+  {
+    char c = key[i];
+    if ((c >= 'a') && (c <= 'z'))
+    {
+      name.push_back((char) (c - 'a' + 'A'));
+    }
+    else if (((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '_'))
+    {
+      name.push_back(c);
+    }
+    else
+    {
+      name.push_back('_');
+    }
+  }
+  size_t first = name.find_first_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+  if (first == std::string::npos)
+  {
+    return false;
+  }
+  name.erase(0, first);
+  if (name.size() > MAX_FIELD_NAME)
+  {
+    name.resize(MAX_FIELD_NAME);
+  }
+  return true;
+}
+
+int priority(log4cplus::LogLevel level)
+{
+  if (level >= log4cplus::FATAL_LOG_LEVEL)
+  {
+    return 2;
+  }
+  if (level >= log4cplus::ERROR_LOG_LEVEL)
+  {
+    return 3;
+  }
+  if (level >= log4cplus::WARN_LOG_LEVEL)
+  {
+    return 4;
+  }
+  if (level >= log4cplus::INFO_LOG_LEVEL)
+  {
+    return 6;
+  }
+  return 7;
+}
+
+}
+
+FtylogJournalAppender::FtylogJournalAppender(const log4cplus::helpers::Properties & properties)
+  : log4cplus::Appender(properties), _socketPath(DEFAULT_SOCKET_PATH),
+    _batchSize(DEFAULT_BATCH_SIZE), _maxAgeMillis(DEFAULT_MAX_AGE_MILLIS),
+    _flushLevel(log4cplus::ERROR_LOG_LEVEL), _fd(-1), _addressLength(0), _failed(false),
+    _count(0), _stop(false)
+{
+  if (properties.exists("SocketPath"))
+  {
+    _socketPath = properties.getProperty("SocketPath");
+  }
+  _syslogIdentifier = properties.getProperty("SyslogIdentifier");
+  unsigned int value;
+  if (properties.getUInt(value, "BatchSize"))
+  {
+    _batchSize = value;
+  }
+  if (properties.getUInt(value, "MaxAge"))
+  {
+    _maxAgeMillis = value;
+  }
+  if (properties.exists("FlushLevel"))
+  {
+    _flushLevel = log4cplus::getLogLevelManager().fromString(properties.getProperty("FlushLevel"));
+  }
+  start();
+}
+
+FtylogJournalAppender::FtylogJournalAppender(const std::string & socketPath,
+                                             const std::string & syslogIdentifier,
+                                             size_t batchSize, unsigned int maxAgeMillis,
+                                             log4cplus::LogLevel flushLevel)
+  : _socketPath(socketPath), _syslogIdentifier(syslogIdentifier), _batchSize(batchSize),
+    _maxAgeMillis(maxAgeMillis), _flushLevel(flushLevel), _fd(-1), _addressLength(0),
+    _failed(false), _count(0), _stop(false)
+{
+  start();
+}
+
+FtylogJournalAppender::~FtylogJournalAppender()
+{
+  destructorImpl();
+}
+
+void FtylogJournalAppender::start()
+{
+  if (_syslogIdentifier.empty())
+  {
+    _syslogIdentifier = program_invocation_short_name;
+  }
+  _batchSize = std::min(std::max(_batchSize, (size_t) 1), MAX_BATCH_SIZE);
+
+  memset(&_address, 0, sizeof(_address));
+  _address.sun_family = AF_UNIX;
+  if (_socketPath.size() >= sizeof(_address.sun_path))
+  {
+    log4cplus::helpers::getLogLog().error("The journal socket path is too long: " + _socketPath);
+  }
+  else
+  {
+    memcpy(_address.sun_path, _socketPath.c_str(), _socketPath.size() + 1);
+    _addressLength = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + _socketPath.size() + 1);
+    _fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+    {
+      log4cplus::helpers::getLogLog().error(std::string("Can not create the journal socket: ") +
+                                            strerror(errno));
+    }
+  }
+  _iov.reserve(_batchSize);
+  _messages.reserve(_batchSize);
+  _flusher = std::thread(&FtylogJournalAppender::run, this);
+}
+
+void FtylogJournalAppender::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    sendRecords();
+    _stop = true;
+    _wakeUp.notify_one();
+  }
+  if (_flusher.joinable())
+  {
+    _flusher.join();
+  }
+  if (_fd >= 0)
+  {
+    ::close(_fd);
+    _fd = -1;
+  }
+  closed = true;
+}
+
+void FtylogJournalAppender::flushBatch()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  sendRecords();
+}
+
+void FtylogJournalAppender::formatRecord(std::string & out,
+                                         const log4cplus::spi::InternalLoggingEvent & event,
+                                         const std::string & syslogIdentifier)
+{
+  appendField(out, "MESSAGE", event.getMessage());
+  out.append("PRIORITY=");
+  out.push_back((char) ('0' + priority(event.getLogLevel())));
+  out.push_back('\n');
+  appendField(out, "SYSLOG_IDENTIFIER", syslogIdentifier);
+  if (!event.getFile().empty())
+  {
+    appendField(out, "CODE_FILE", event.getFile());
+    out.append("CODE_LINE=");
+    ftylog_formatValue(out, event.getLine());
+    out.push_back('\n');
+  }
+  if (!event.getFunction().empty())
+  {
+    appendField(out, "CODE_FUNC", event.getFunction());
+  }
+
+  static thread_local std::string name;
+  FtylogEventContext::forEach(event, [&out](const char * key, size_t keyLength,
+                                            const char * value, size_t valueLength)
+  {
+    if (fieldName(name, key, keyLength))
+    {
+      appendField(out, name.data(), name.size(), value, valueLength);
+    }
+  });
+}
+
+void FtylogJournalAppender::append(const log4cplus::spi::InternalLoggingEvent & event)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_count == _records.size())
+  {
+    _records.emplace_back();
+  }
+  _records[_count].clear();
+  formatRecord(_records[_count], event, _syslogIdentifier);
+  _count++;
+  if (_count == 1)
+  {
+    //Start the age of the batch
+    _oldest = std::chrono::steady_clock::now();
+    _wakeUp.notify_one();
+  }
+  if ((_count >= _batchSize) || (event.getLogLevel() >= _flushLevel))
+  {
+    sendRecords();
+  }
+}
+
+void FtylogJournalAppender::sendRecords()
+{
+  if (0 == _count)
+  {
+    return;
+  }
+  size_t count = _count;
+  _count = 0;
+  if (_fd < 0)
+  {
+    return;
+  }
+
+  _iov.resize(count);
+  _messages.resize(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    _iov[i].iov_base = const_cast<char *>(_records[i].data());
+    _iov[i].iov_len = _records[i].size();
+    memset(&_messages[i], 0, sizeof(_messages[i]));
+    _messages[i].msg_hdr.msg_name = &_address;
+    _messages[i].msg_hdr.msg_namelen = _addressLength;
+    _messages[i].msg_hdr.msg_iov = &_iov[i];
+    _messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t sent = 0;
+  while (sent < count)
+  {
+    int result = sendmmsg(_fd, &_messages[sent], (unsigned int) (count - sent), MSG_NOSIGNAL);
+    if (result > 0)
+    {
+      sent += result;
+      continue;
+    }
+    if (errno == EINTR)
+    {
+      continue;
+    }
+    if (errno == EMSGSIZE)
+    {
+      //The other records of the batch are still sent
+      if (!sendLarge(_records[sent]))
+      {
+        log4cplus::helpers::getLogLog().warn("Can not send a log record of " +
+                                             std::to_string(_records[sent].size()) +
+                                             " bytes to " + _socketPath + ", dropped");
+      }
+      sent++;
+      continue;
+    }
+    //Like the appenders of log4cplus, give up on the records
+    if (!_failed)
+    {
+      log4cplus::helpers::getLogLog().error("Can not send the log records to " + _socketPath +
+                                            ": " + strerror(errno));
+      _failed = true;
+    }
+    return;
+  }
+  _failed = false;
+}
+
+#if defined (HAVE_MEMFD_CREATE) && defined (F_ADD_SEALS)
+bool FtylogJournalAppender::sendLarge(const std::string & record)
+{
+  int memfd = memfd_create("fty-log-journal", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (memfd < 0)
+  {
+    return false;
+  }
+  bool sent = false;
+  if ((write(memfd, record.data(), record.size()) == (ssize_t) record.size()) &&
+      (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0))
+  {
+    union
+    {
+      struct cmsghdr header;
+      char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &_address;
+    message.msg_namelen = _addressLength;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr * header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &memfd, sizeof(int));
+    ssize_t result;
+    while (((result = sendmsg(_fd, &message, MSG_NOSIGNAL)) < 0) && (errno == EINTR))
+    {
+    }
+    sent = (result >= 0);
+  }
+  ::close(memfd);
+  return sent;
+}
+#else
+bool FtylogJournalAppender::sendLarge(const std::string &)
+{
+  //No memfd before glibc 2.27
+  return false;
+}
+#endif
+
+void FtylogJournalAppender::run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_stop)
+  {
+    if (0 == _count)
+    {
+      _wakeUp.wait(lock);
+      continue;
+    }
+    std::chrono::steady_clock::time_point deadline =
+      _oldest + std::chrono::milliseconds(_maxAgeMillis);
+    if (std::chrono::steady_clock::now() >= deadline)
+    {
+      sendRecords();
+    }
+    else
+    {
+      _wakeUp.wait_until(lock, deadline);
+    }
+  }
+}
+
+void FtylogJournalAppender::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getAppenderFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::AppenderFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogJournalAppender,
+                                         log4cplus::spi::AppenderFactory>(TYPE_NAME)));
+  });
+}
@@ -0,0 +1,132 @@
+/*  =========================================================================
+    fty_log_journal - Appender sending batches of records to systemd-journald
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_JOURNAL_H_INCLUDED
+#define FTY_LOG_JOURNAL_H_INCLUDED
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <log4cplus/appender.h>
+#include <log4cplus/helpers/property.h>
+#include <log4cplus/spi/loggingevent.h>
+
+//  @interface
+
+//Appender sending the log events to systemd-journald with its native
+//protocol, without going through stderr and a text parse. Each event is
+//a record with the fields:
+//  MESSAGE             the message, without layout
+//  PRIORITY            syslog level: FATAL 2, ERROR 3, WARN 4, INFO 6, DEBUG/TRACE 7
+//  SYSLOG_IDENTIFIER   the name of the program, or the SyslogIdentifier property
+//  CODE_FILE, CODE_LINE, CODE_FUNC   the call site given to insertLog()
+//  one field per context entry (Ftylog::setContext(), FtylogScopedContext),
+//  its key in upper case
+//  with the characters other than letters, digits and '_' replaced by '_'
+//The records are gathered and sent with a single sendmmsg() when BatchSize
+//of them are pending, when the oldest one reaches MaxAge, or right away
+//for a message of the flush level. Selected in a log configuration file
+//with:
+//  log4cplus.appender.journal=fty::JournalAppender
+//  log4cplus.appender.journal.SocketPath=/run/systemd/journal/socket
+//  log4cplus.appender.journal.SyslogIdentifier=fty-alert-list
+//  log4cplus.appender.journal.BatchSize=64
+//  log4cplus.appender.journal.MaxAge=100              (milliseconds)
+//  log4cplus.appender.journal.FlushLevel=ERROR
+class FtylogJournalAppender : public log4cplus::Appender
+{
+public:
+  //Name of the appender type in the log configuration files
+  static const char * const TYPE_NAME;
+  static const char * const DEFAULT_SOCKET_PATH;
+  static const size_t DEFAULT_BATCH_SIZE = 64;
+  static const unsigned int DEFAULT_MAX_AGE_MILLIS = 100;
+
+  explicit FtylogJournalAppender(const log4cplus::helpers::Properties & properties);
+  explicit FtylogJournalAppender(const std::string & socketPath = DEFAULT_SOCKET_PATH,
+                                 const std::string & syslogIdentifier = std::string(),
+                                 size_t batchSize = DEFAULT_BATCH_SIZE,
+                                 unsigned int maxAgeMillis = DEFAULT_MAX_AGE_MILLIS,
+                                 log4cplus::LogLevel flushLevel = log4cplus::ERROR_LOG_LEVEL);
+  virtual ~FtylogJournalAppender();
+
+  //Send the pending records and stop the flushing thread
+  virtual void close();
+
+  //Send the pending records now
+  void flushBatch();
+
+  //Make the appender available to the log configuration files
+  static void registerFactory();
+
+  //Append the record of an event to out
+  static void formatRecord(std::string & out, const log4cplus::spi::InternalLoggingEvent & event,
+                           const std::string & syslogIdentifier);
+
+protected:
+  virtual void append(const log4cplus::spi::InternalLoggingEvent & event);
+
+private:
+  std::string _socketPath;
+  std::string _syslogIdentifier;
+  size_t _batchSize;
+  unsigned int _maxAgeMillis;
+  log4cplus::LogLevel _flushLevel;
+  int _fd;
+  struct sockaddr_un _address;
+  socklen_t _addressLength;
+  //The journal could not be reached, reported once until it can again
+  bool _failed;
+
+  //Pending records; the strings are reused from one batch to the next
+  std::vector<std::string> _records;
+  std::vector<struct iovec> _iov;
+  std::vector<struct mmsghdr> _messages;
+  size_t _count;
+  //Time of the oldest pending record
+  std::chrono::steady_clock::time_point _oldest;
+
+  std::mutex _mutex;
+  std::condition_variable _wakeUp;
+  bool _stop;
+  std::thread _flusher;
+
+  //Open the socket and start the flushing thread
+  void start();
+  //Send the pending records, with _mutex held
+  void sendRecords();
+  //Send a record too large for a datagram in a sealed memfd, as journald
+  //expects it; false if it could not be sent
+  bool sendLarge(const std::string & record);
+  //Body of the flushing thread, sending the records which are too old
+  void run();
+
+  FtylogJournalAppender(const FtylogJournalAppender&) = delete;
+  FtylogJournalAppender& operator=(const FtylogJournalAppender&) = delete;
+};
+
+//  @end
+#endif
@@ -0,0 +1,157 @@
+/*  =========================================================================
+    fty_log_json - Layout writing log messages as JSON lines
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_json - Layout writing log messages as JSON lines
+@discuss
+    Each line is built in a buffer of the calling thread and written with a
+    single call, without the stream formatting of the pattern layouts.
+    The fields of the log_*_kv macros come already encoded in JSON.
+@end
+ */
+
+#include <mutex>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/spi/factory.h>
+#include <log4cplus/spi/loggingevent.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+thread_local const FtylogStructured * currentStructured = NULL;
+
+void appendMember(std::string & out, const char * key, const std::string & value)
+{
+  out.append(key);
+  ftylog_jsonString(out, value.data(), value.size());
+}
+
+}
+
+const char * const FtylogJsonLayout::TYPE_NAME = "fty::JsonLayout";
+
+FtylogJsonLayout::FtylogJsonLayout()
+{
+}
+
+FtylogJsonLayout::FtylogJsonLayout(const log4cplus::helpers::Properties & properties)
+  : log4cplus::Layout(properties)
+{
+}
+
+void FtylogJsonLayout::formatAndAppend(log4cplus::tostream & output,
+                                       const log4cplus::spi::InternalLoggingEvent & event)
+{
+  static thread_local std::string line;
+  format(line, event);
+  output.write(line.data(), line.size());
+}
+
+void FtylogJsonLayout::format(std::string & out, const log4cplus::spi::InternalLoggingEvent & event)
+{
+  const log4cplus::tstring & message = event.getMessage();
+  //Only the event of the structured message has its fields: the layout may
+  //also see other events while the message is logged (e.g. a flight
+  //recorder dump, messages of the appenders)
+  const FtylogStructured * structured = currentStructured;
+  if ((structured != NULL) && ((structured->textLength != message.size()) ||
+                               (structured->messageLength > message.size())))
+  {
+    structured = NULL;
+  }
+
+  out.clear();
+  static const FtylogTimestampFormat timestampFormat("%Y-%m-%dT%H:%M:%S.%fZ", true);
+  out.append("{\"timestamp\":\"");
+  timestampFormat.append(out, event.getTimestamp());
+  out.push_back('"');
+
+  appendMember(out, ",\"level\":", log4cplus::getLogLevelManager().toString(event.getLogLevel()));
+  appendMember(out, ",\"logger\":", event.getLoggerName());
+  appendMember(out, ",\"thread\":", event.getThread());
+  if (!event.getFile().empty())
+  {
+    appendMember(out, ",\"file\":", event.getFile());
+    out.append(",\"line\":");
+    ftylog_formatValue(out, event.getLine());
+  }
+  if (!event.getFunction().empty())
+  {
+    appendMember(out, ",\"func\":", event.getFunction());
+  }
+
+  out.append(",\"message\":");
+  ftylog_jsonString(out, message.data(),
+                    (structured != NULL) ? structured->messageLength : message.size());
+
+  bool first = true;
+  FtylogEventContext::forEach(event, [&out, &first](const char * key, size_t keyLength,
+                                                    const char * value, size_t valueLength)
+  {
+    out.append(first ? ",\"context\":{" : ",");
+    first = false;
+    ftylog_jsonString(out, key, keyLength);
+    out.push_back(':');
+    ftylog_jsonString(out, value, valueLength);
+  });
+  if (!first)
+  {
+    out.push_back('}');
+  }
+
+  if ((structured != NULL) && (structured->fieldsLength != 0))
+  {
+    out.push_back(',');
+    out.append(structured->fields, structured->fieldsLength);
+  }
+  out.append("}\n");
+}
+
+void FtylogJsonLayout::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getLayoutFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::LayoutFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogJsonLayout,
+                                         log4cplus::spi::LayoutFactory>(TYPE_NAME)));
+  });
+}
+
+const FtylogStructured * FtylogJsonLayout::current()
+{
+  return currentStructured;
+}
+
+FtylogJsonLayout::Scope::Scope(const FtylogStructured * structured)
+  : _previous(currentStructured)
+{
+  currentStructured = structured;
+}
+
+FtylogJsonLayout::Scope::~Scope()
+{
+  currentStructured = _previous;
+}
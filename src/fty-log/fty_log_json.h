@@ -0,0 +1,86 @@
+/*  =========================================================================
+    fty_log_json - Layout writing log messages as JSON lines
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_JSON_H_INCLUDED
+#define FTY_LOG_JSON_H_INCLUDED
+
+#include <string>
+#include <log4cplus/layout.h>
+#include <log4cplus/helpers/property.h>
+
+//  @interface
+
+//Structured part of a message of the log_*_kv macros. The text of the
+//message is "message key=value..."; the JSON layout prints the first
+//messageLength characters as the message, followed by the fields.
+struct FtylogStructured
+{
+  //JSON members "key":value,... (not NUL terminated)
+  const char * fields;
+  size_t fieldsLength;
+  size_t messageLength;
+  //Length of the whole text, to recognize the event of this message
+  size_t textLength;
+};
+
+//One JSON object per line with the timestamp, level, logger, thread,
+//location, message, context ("context": MDC and FtylogScopedContext entries)
+//and structured fields of the event.
+//Configuration: log4cplus.appender.X.layout=fty::JsonLayout
+class FtylogJsonLayout : public log4cplus::Layout
+{
+public:
+  //Type name of the layout in configuration files
+  static const char * const TYPE_NAME;
+
+  FtylogJsonLayout();
+  explicit FtylogJsonLayout(const log4cplus::helpers::Properties & properties);
+
+  virtual void formatAndAppend(log4cplus::tostream & output,
+                               const log4cplus::spi::InternalLoggingEvent & event);
+
+  //Replace out with the JSON line of event
+  static void format(std::string & out, const log4cplus::spi::InternalLoggingEvent & event);
+
+  //Make the layout available to configuration files
+  static void registerFactory();
+
+  //Structured part of the message the calling thread is logging, or NULL
+  static const FtylogStructured * current();
+
+  //Give the structured part of a message to the layouts of the calling
+  //thread while it logs the message
+  class Scope
+  {
+  private:
+    const FtylogStructured * _previous;
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  public:
+    explicit Scope(const FtylogStructured * structured);
+    ~Scope();
+  };
+};
+
+//  @end
+#endif
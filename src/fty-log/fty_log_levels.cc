@@ -0,0 +1,278 @@
+/*  =========================================================================
+    fty_log_levels - Level overrides per source file or function
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_levels - Level overrides per source file or function
+@discuss
+    The result of a call site is cached in 64 bits: the generation of the
+    rules it was computed for (24 bits), the identifier of the logger it
+    was computed for (23 bits) and the level plus one (17 bits, zero for
+    no override). A zeroed cache never matches, the identifiers starting
+    at 1. A call site used by two loggers in turn matches the rules again
+    at each change of logger.
+@end
+ */
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+std::string trim(const std::string & text)
+{
+  size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+  {
+    return std::string();
+  }
+  size_t end = text.find_last_not_of(" \t");
+  return text.substr(begin, end - begin + 1);
+}
+
+//Same names as BIOS_LOG_LEVEL
+bool levelFromName(const std::string & name, int & level)
+{
+  static const struct
+  {
+    const char * name;
+    int level;
+  } levels[] =
+  {
+    { "LOG_TRACE", log4cplus::TRACE_LOG_LEVEL },
+    { "LOG_DEBUG", log4cplus::DEBUG_LOG_LEVEL },
+    { "LOG_INFO", log4cplus::INFO_LOG_LEVEL },
+    { "LOG_WARNING", log4cplus::WARN_LOG_LEVEL },
+    { "LOG_ERR", log4cplus::ERROR_LOG_LEVEL },
+    { "LOG_CRIT", log4cplus::FATAL_LOG_LEVEL },
+    { "LOG_OFF", log4cplus::OFF_LOG_LEVEL }
+  };
+  for (const auto & entry : levels)
+  {
+    if (name == entry.name)
+    {
+      level = entry.level;
+      return true;
+    }
+  }
+  return false;
+}
+
+const unsigned int GENERATION_BITS = 24;
+const unsigned int LEVEL_BITS = 17;
+
+unsigned long long cacheKey(unsigned int generation, unsigned int ownerId)
+{
+  return ((unsigned long long) (generation & ((1U << GENERATION_BITS) - 1)) <<
+          (FTYLOG_LOGGER_ID_BITS + LEVEL_BITS)) |
+         ((unsigned long long) ownerId << LEVEL_BITS);
+}
+
+void lowerTo(int & lowest, const std::vector<FtylogLevelOverrides::Rule> & rules)
+{
+  for (const FtylogLevelOverrides::Rule & rule : rules)
+  {
+    if ((lowest == FtylogLevelOverrides::NO_OVERRIDE) || (rule.level < lowest))
+    {
+      lowest = rule.level;
+    }
+  }
+}
+
+}
+
+std::atomic<bool> FtylogLevelOverrides::_any(false);
+std::atomic<unsigned int> FtylogLevelOverrides::_generation(1);
+
+bool FtylogLevelOverrides::parse(const std::string & spec, std::vector<Rule> & rules,
+                                 std::string & base)
+{
+  bool valid = true;
+  size_t begin = 0;
+  while (begin <= spec.size())
+  {
+    size_t end = spec.find(',', begin);
+    if (end == std::string::npos)
+    {
+      end = spec.size();
+    }
+    std::string entry = trim(spec.substr(begin, end - begin));
+    begin = end + 1;
+    if (entry.empty())
+    {
+      continue;
+    }
+
+    size_t equal = entry.rfind('=');
+    if (equal == std::string::npos)
+    {
+      base = entry;
+      continue;
+    }
+    Rule rule;
+    rule.function = false;
+    rule.pattern = trim(entry.substr(0, equal));
+    if (rule.pattern.compare(0, 5, "func:") == 0)
+    {
+      rule.function = true;
+      rule.pattern.erase(0, 5);
+    }
+    else if (rule.pattern.compare(0, 5, "file:") == 0)
+    {
+      rule.pattern.erase(0, 5);
+    }
+    if (rule.pattern.empty() || !levelFromName(trim(entry.substr(equal + 1)), rule.level))
+    {
+      valid = false;
+      continue;
+    }
+    rules.push_back(rule);
+  }
+  return valid;
+}
+
+FtylogLevelOverrides::Rules & FtylogLevelOverrides::rules()
+{
+  static Rules rules;
+  return rules;
+}
+
+void FtylogLevelOverrides::setEnvironmentRules(const std::vector<Rule> & newRules)
+{
+  Rules & current = rules();
+  std::lock_guard<std::mutex> lock(current.mutex);
+  current.environment = newRules;
+  changed(current);
+}
+
+void FtylogLevelOverrides::setOwnerRules(const void * owner, const std::vector<Rule> & newRules)
+{
+  Rules & current = rules();
+  std::lock_guard<std::mutex> lock(current.mutex);
+  if (newRules.empty())
+  {
+    if (current.owners.erase(owner) == 0)
+    {
+      return;
+    }
+  }
+  else
+  {
+    current.owners[owner] = newRules;
+  }
+  changed(current);
+}
+
+void FtylogLevelOverrides::changed(Rules & current)
+{
+  _generation.fetch_add(1, std::memory_order_release);
+  _any.store(!current.environment.empty() || !current.owners.empty(),
+             std::memory_order_relaxed);
+  //The effective levels of the loggers depend on the lowest level
+  __atomic_add_fetch(&ftylog_levelGeneration, 1, __ATOMIC_RELEASE);
+}
+
+int FtylogLevelOverrides::lowestLevel(const void * owner)
+{
+  if (!_any.load(std::memory_order_relaxed))
+  {
+    return NO_OVERRIDE;
+  }
+  Rules & current = rules();
+  std::lock_guard<std::mutex> lock(current.mutex);
+  int lowest = NO_OVERRIDE;
+  lowerTo(lowest, current.environment);
+  auto found = current.owners.find(owner);
+  if (found != current.owners.end())
+  {
+    lowerTo(lowest, found->second);
+  }
+  return lowest;
+}
+
+int FtylogLevelOverrides::cachedLevel(const void * owner, unsigned int ownerId,
+                                      const FtylogCallSite * site)
+{
+  const unsigned long long levelMask = (1ULL << LEVEL_BITS) - 1;
+  unsigned int generation = _generation.load(std::memory_order_acquire);
+  if (NULL != site->levelCache)
+  {
+    unsigned long long cached = __atomic_load_n(&site->levelCache->cached, __ATOMIC_RELAXED);
+    if ((cached & ~levelMask) == cacheKey(generation, ownerId))
+    {
+      return (int) (cached & levelMask) - 1;
+    }
+  }
+
+  Rules & current = rules();
+  std::lock_guard<std::mutex> lock(current.mutex);
+  generation = _generation.load(std::memory_order_relaxed);
+  int level = match(current, owner, site);
+  if (NULL != site->levelCache)
+  {
+    __atomic_store_n(&site->levelCache->cached,
+                     cacheKey(generation, ownerId) | (unsigned int) (level + 1),
+                     __ATOMIC_RELAXED);
+  }
+  return level;
+}
+
+int FtylogLevelOverrides::match(const Rules & current, const void * owner,
+                                const FtylogCallSite * site)
+{
+  for (const Rule & rule : current.environment)
+  {
+    if (matchRule(rule, site))
+    {
+      return rule.level;
+    }
+  }
+  auto found = current.owners.find(owner);
+  if (found != current.owners.end())
+  {
+    for (const Rule & rule : found->second)
+    {
+      if (matchRule(rule, site))
+      {
+        return rule.level;
+      }
+    }
+  }
+  return NO_OVERRIDE;
+}
+
+bool FtylogLevelOverrides::matchRule(const Rule & rule, const FtylogCallSite * site)
+{
+  if (rule.function)
+  {
+    return strncmp(site->func, rule.pattern.c_str(), rule.pattern.size()) == 0;
+  }
+  if (rule.pattern.find('/') != std::string::npos)
+  {
+    return fnmatch(rule.pattern.c_str(), site->file, 0) == 0;
+  }
+  //The base name of the call sites of C code may still have directories
+  const char * name = strrchr(site->basename, '/');
+  return fnmatch(rule.pattern.c_str(), (NULL != name) ? name + 1 : site->basename, 0) == 0;
+}
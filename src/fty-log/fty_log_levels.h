@@ -0,0 +1,108 @@
+/*  =========================================================================
+    fty_log_levels - Level overrides per source file or function
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_LEVELS_H_INCLUDED
+#define FTY_LOG_LEVELS_H_INCLUDED
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//  @interface
+
+//Rules giving the level of the call sites of some source files or
+//functions instead of the level of their logger. The rules of
+//BIOS_LOG_LEVEL apply to every Ftylog object, those of the configuration
+//file of a Ftylog object to its own messages only. Each call site matches
+//them once and keeps the result in its FtylogSiteLevel, for the last
+//logger used there, until they change.
+class FtylogLevelOverrides
+{
+public:
+  //Result for a call site matching no rule
+  static const int NO_OVERRIDE = -1;
+
+  struct Rule
+  {
+    //Prefix of the function name, or glob of the source file
+    bool function;
+    std::string pattern;
+    int level;
+  };
+
+  //Parse a comma separated list of rules "pattern=LEVEL", LEVEL being one
+  //of the BIOS_LOG_LEVEL values (LOG_TRACE...). The pattern is
+  //"func:prefix" for the functions starting with prefix, or a glob of
+  //the source file ("file:" may be put before it), matched against the
+  //path given by __FILE__ if it has a '/', the name of the file otherwise.
+  //An entry without '=' goes to base. Return false if an entry is not
+  //valid; the valid ones are kept.
+  static bool parse(const std::string & spec, std::vector<Rule> & rules, std::string & base);
+
+  //Replace the rules of BIOS_LOG_LEVEL, or those of the configuration
+  //file of owner. The rules of BIOS_LOG_LEVEL are tried first.
+  static void setEnvironmentRules(const std::vector<Rule> & rules);
+  static void setOwnerRules(const void * owner, const std::vector<Rule> & rules);
+
+  //Lowest level given by a rule of BIOS_LOG_LEVEL or of owner,
+  //NO_OVERRIDE without rules
+  static int lowestLevel(const void * owner);
+
+  //Level of the first rule of BIOS_LOG_LEVEL or of owner (whose
+  //FtylogLevelState::loggerId is ownerId) matching the call site,
+  //NO_OVERRIDE if none. Without rules, or with the result cached by the
+  //call site for this owner, no name is compared.
+  static int siteLevel(const void * owner, unsigned int ownerId, const FtylogCallSite * site)
+  {
+    if (!_any.load(std::memory_order_relaxed))
+    {
+      return NO_OVERRIDE;
+    }
+    return cachedLevel(owner, ownerId, site);
+  }
+
+private:
+  struct Rules
+  {
+    std::mutex mutex;
+    std::vector<Rule> environment;
+    std::map<const void *, std::vector<Rule>> owners;
+  };
+
+  //Set when there is any rule
+  static std::atomic<bool> _any;
+  //Changed with the rules, invalidates the results cached by the call sites
+  static std::atomic<unsigned int> _generation;
+
+  //Created on first use: the default logger sets the rules while the
+  //static objects are initialized
+  static Rules & rules();
+  static int cachedLevel(const void * owner, unsigned int ownerId, const FtylogCallSite * site);
+  static int match(const Rules & rules, const void * owner, const FtylogCallSite * site);
+  static bool matchRule(const Rule & rule, const FtylogCallSite * site);
+  //Called with the mutex locked after a change of the rules
+  static void changed(Rules & rules);
+};
+
+//  @end
+#endif
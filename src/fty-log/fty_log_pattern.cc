@@ -0,0 +1,355 @@
+/*  =========================================================================
+    fty_log_pattern - Pattern layout compiled when the appenders are loaded
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_pattern - Pattern layout compiled when the appenders are loaded
+@discuss
+    log4cplus::PatternLayout calls a converter object per conversion of the
+    pattern, each one filling a string then padding it through the stream.
+    Here the conversions are a flat list of steps appending to a buffer of
+    the calling thread, written to the stream at once.
+    A pattern with a conversion or an option not listed in the header is
+    given to log4cplus::PatternLayout, so the output never differs.
+@end
+ */
+
+#include <ctype.h>
+#include <log4cplus/loglevel.h>
+#include <log4cplus/spi/loggingevent.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+//Levels rendered in advance, from TRACE_LOG_LEVEL (0) to OFF_LOG_LEVEL
+const size_t RENDERED_LEVELS = 7;
+
+void appendInteger(std::string & out, int value)
+{
+  char text[16];
+  char * end = text + sizeof(text);
+  char * digit = end;
+  unsigned int remaining = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+  do
+  {
+    *--digit = (char) ('0' + (remaining % 10));
+    remaining /= 10;
+  }
+  while (remaining != 0);
+  if (value < 0)
+  {
+    *--digit = '-';
+  }
+  out.append(digit, end - digit);
+}
+
+}
+
+FtylogPatternLayout::FtylogPatternLayout()
+{
+}
+
+bool FtylogPatternLayout::compile(const std::string & pattern, const std::string & loggerName)
+{
+  _steps.clear();
+  _dates.clear();
+  Step literal;
+  literal.kind = LITERAL;
+  literal.leftAlign = false;
+  literal.minWidth = 0;
+  literal.maxWidth = std::string::npos;
+  literal.date = 0;
+
+  size_t i = 0;
+  while (i < pattern.size())
+  {
+    char c = pattern[i++];
+    if (c != '%')
+    {
+      literal.text.push_back(c);
+      continue;
+    }
+    if (i == pattern.size())
+    {
+      return false;
+    }
+    if (pattern[i] == '%')
+    {
+      literal.text.push_back('%');
+      i++;
+      continue;
+    }
+    if (pattern[i] == 'n')
+    {
+      literal.text.push_back('\n');
+      i++;
+      continue;
+    }
+
+    //Modifiers: [-][minimum][.maximum]
+    Step step = literal;
+    step.text.clear();
+    if (pattern[i] == '-')
+    {
+      step.leftAlign = true;
+      i++;
+    }
+    while ((i < pattern.size()) && isdigit((unsigned char) pattern[i]))
+    {
+      step.minWidth = step.minWidth * 10 + (pattern[i++] - '0');
+    }
+    if ((i < pattern.size()) && (pattern[i] == '.'))
+    {
+      i++;
+      if ((i == pattern.size()) || !isdigit((unsigned char) pattern[i]))
+      {
+        return false;
+      }
+      step.maxWidth = 0;
+      while ((i < pattern.size()) && isdigit((unsigned char) pattern[i]))
+      {
+        step.maxWidth = step.maxWidth * 10 + (pattern[i++] - '0');
+      }
+    }
+    if (i == pattern.size())
+    {
+      return false;
+    }
+
+    //Only these conversions take an option, "{" is a literal after the others
+    char conversion = pattern[i++];
+    std::string option;
+    bool hasOption = false;
+    if (((conversion == 'c') || (conversion == 'd') || (conversion == 'D') || (conversion == 'X')) &&
+        (i < pattern.size()) && (pattern[i] == '{'))
+    {
+      size_t end = pattern.find('}', i);
+      if (end == std::string::npos)
+      {
+        return false;
+      }
+      option = pattern.substr(i + 1, end - i - 1);
+      hasOption = true;
+      i = end + 1;
+    }
+
+    switch (conversion)
+    {
+      case 'c':
+        if (hasOption)
+        {
+          return false;
+        }
+        step.kind = LOGGER;
+        step.text = loggerName;
+        step.rendered.push_back(loggerName);
+        pad(step.rendered[0], 0, step);
+        break;
+      case 'p':
+        step.kind = LEVEL;
+        for (size_t level = 0; level < RENDERED_LEVELS; level++)
+        {
+          step.rendered.push_back(log4cplus::getLogLevelManager().toString(
+                                    (log4cplus::LogLevel) (level * 10000)));
+          pad(step.rendered.back(), 0, step);
+        }
+        break;
+      case 't':
+        step.kind = THREAD;
+        break;
+      case 'T':
+        step.kind = THREAD2;
+        break;
+      case 'M':
+        step.kind = FUNCTION;
+        break;
+      case 'F':
+        step.kind = FILE_NAME;
+        break;
+      case 'L':
+        step.kind = LINE;
+        break;
+      case 'l':
+        step.kind = LOCATION;
+        break;
+      case 'm':
+        step.kind = MESSAGE;
+        break;
+      case 'd':
+      case 'D':
+        //log4cplus renders %s itself, and its default format is kept to it
+        if (!hasOption || (option.find("%s") != std::string::npos) ||
+            (option.find("%f") != std::string::npos))
+        {
+          return false;
+        }
+        step.kind = DATE;
+        step.date = _dates.size();
+        _dates.push_back(FtylogTimestampFormat(option, conversion == 'd'));
+        break;
+      case 'X':
+        if (option.empty())
+        {
+          return false;
+        }
+        step.kind = MDC;
+        step.text = option;
+        break;
+      default:
+        return false;
+    }
+
+    if (!literal.text.empty())
+    {
+      _steps.push_back(literal);
+      literal.text.clear();
+    }
+    _steps.push_back(step);
+  }
+  if (!literal.text.empty())
+  {
+    _steps.push_back(literal);
+  }
+  return true;
+}
+
+void FtylogPatternLayout::pad(std::string & out, size_t start, const Step & step)
+{
+  size_t length = out.size() - start;
+  //Like log4cplus, the beginning of a long text is cut
+  if (length > step.maxWidth)
+  {
+    out.erase(start, length - step.maxWidth);
+  }
+  else if (length < step.minWidth)
+  {
+    if (step.leftAlign)
+    {
+      out.append(step.minWidth - length, ' ');
+    }
+    else
+    {
+      out.insert(start, step.minWidth - length, ' ');
+    }
+  }
+}
+
+void FtylogPatternLayout::formatAndAppend(log4cplus::tostream & output,
+                                          const log4cplus::spi::InternalLoggingEvent & event)
+{
+  static thread_local std::string line;
+  line.clear();
+  format(line, event);
+  output.write(line.data(), line.size());
+}
+
+void FtylogPatternLayout::format(std::string & out,
+                                 const log4cplus::spi::InternalLoggingEvent & event) const
+{
+  for (const Step & step : _steps)
+  {
+    size_t start = out.size();
+    switch (step.kind)
+    {
+      case LITERAL:
+        out.append(step.text);
+        continue;
+      case LOGGER:
+      {
+        const std::string & name = event.getLoggerName();
+        if (name == step.text)
+        {
+          out.append(step.rendered[0]);
+          continue;
+        }
+        out.append(name);
+        break;
+      }
+      case LEVEL:
+      {
+        log4cplus::LogLevel level = event.getLogLevel();
+        if ((level >= 0) && (level % 10000 == 0) && ((size_t) (level / 10000) < RENDERED_LEVELS))
+        {
+          out.append(step.rendered[level / 10000]);
+          continue;
+        }
+        out.append(log4cplus::getLogLevelManager().toString(level));
+        break;
+      }
+      case THREAD:
+        out.append(event.getThread());
+        break;
+      case THREAD2:
+        out.append(event.getThread2());
+        break;
+      case FUNCTION:
+        out.append(event.getFunction());
+        break;
+      case FILE_NAME:
+        out.append(event.getFile());
+        break;
+      case LINE:
+        if (event.getLine() != -1)
+        {
+          appendInteger(out, event.getLine());
+        }
+        break;
+      case LOCATION:
+        if (!event.getFile().empty())
+        {
+          out.append(event.getFile());
+          out.push_back(':');
+          appendInteger(out, event.getLine());
+        }
+        else
+        {
+          out.push_back(':');
+        }
+        break;
+      case MESSAGE:
+        out.append(event.getMessage());
+        break;
+      case DATE:
+        _dates[step.date].append(out, event.getTimestamp());
+        break;
+      case MDC:
+        FtylogEventContext::append(out, event, step.text);
+        break;
+    }
+    if ((step.minWidth != 0) || (step.maxWidth != std::string::npos))
+    {
+      pad(out, start, step);
+    }
+  }
+}
+
+std::unique_ptr<log4cplus::Layout> FtylogPatternLayout::create(const std::string & pattern,
+                                                               const std::string & loggerName)
+{
+  std::unique_ptr<FtylogPatternLayout> layout(new FtylogPatternLayout());
+  if (layout->compile(pattern, loggerName))
+  {
+    return std::unique_ptr<log4cplus::Layout>(layout.release());
+  }
+  return std::unique_ptr<log4cplus::Layout>(new log4cplus::PatternLayout(pattern));
+}
@@ -0,0 +1,97 @@
+/*  =========================================================================
+    fty_log_pattern - Pattern layout compiled when the appenders are loaded
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_PATTERN_H_INCLUDED
+#define FTY_LOG_PATTERN_H_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <log4cplus/layout.h>
+#include "fty-log/fty_log_timestamp.h"
+
+//  @interface
+
+//Same output as log4cplus::PatternLayout, from a list of steps built once
+//from the pattern. The logger name of the agent and the level names are
+//rendered with their padding in advance.
+//Supported: literals, %%, %n, %m, %c, %p, %t, %T, %M, %F, %L, %l,
+//%d{format}, %D{format} and %X{key}, with the -, minimum and .maximum
+//width modifiers.
+class FtylogPatternLayout : public log4cplus::Layout
+{
+private:
+  enum Kind
+  {
+    LITERAL,
+    LOGGER,
+    LEVEL,
+    THREAD,
+    THREAD2,
+    FUNCTION,
+    FILE_NAME,
+    LINE,
+    LOCATION,
+    MESSAGE,
+    DATE,
+    MDC
+  };
+
+  struct Step
+  {
+    Kind kind;
+    bool leftAlign;
+    size_t minWidth;
+    size_t maxWidth;
+    //Literal text, logger name or MDC key
+    std::string text;
+    //Index in _dates
+    size_t date;
+    //Padded logger name, or padded names of the levels by level / 10000
+    std::vector<std::string> rendered;
+  };
+
+  std::vector<Step> _steps;
+  std::vector<FtylogTimestampFormat> _dates;
+
+  FtylogPatternLayout();
+
+  //Return false if the pattern uses something not supported
+  bool compile(const std::string & pattern, const std::string & loggerName);
+  //Apply the width modifiers to the text appended to out after start
+  static void pad(std::string & out, size_t start, const Step & step);
+
+public:
+  virtual void formatAndAppend(log4cplus::tostream & output,
+                               const log4cplus::spi::InternalLoggingEvent & event);
+
+  //Append the text of event to out
+  void format(std::string & out, const log4cplus::spi::InternalLoggingEvent & event) const;
+
+  //Layout for the pattern: a FtylogPatternLayout when the pattern is
+  //supported, a log4cplus::PatternLayout otherwise. loggerName is the
+  //name of the logger whose messages the layout mostly formats.
+  static std::unique_ptr<log4cplus::Layout> create(const std::string & pattern,
+                                                   const std::string & loggerName);
+};
+
+//  @end
+#endif
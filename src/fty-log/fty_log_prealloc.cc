@@ -0,0 +1,324 @@
+/*  =========================================================================
+    fty_log_prealloc - Rolling file appender rotating to a preallocated file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_prealloc - Rolling file appender rotating to a preallocated file
+@discuss
+    The blocks of File.next are reserved with FALLOC_FL_KEEP_SIZE: its size
+    stays 0, so the writes of O_APPEND still go to its end, and the file
+    system does not look for free blocks while the messages are written.
+    Only one rotation is in progress at a time: the next file is prepared
+    once the previous one has been renamed to File.
+@end
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/factory.h>
+
+#include "fty_common_logging_classes.h"
+
+const char * const FtylogPreallocatedRollingFileAppender::TYPE_NAME =
+  "fty::PreallocatedRollingFileAppender";
+
+namespace
+{
+
+const char NEXT[] = ".next";
+
+std::string backupName(const std::string & file, int index)
+{
+  return file + "." + std::to_string(index);
+}
+
+int openFile(const std::string & file, int flags)
+{
+  int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | flags, 0644);
+  if (fd < 0)
+  {
+    log4cplus::helpers::getLogLog().error("Can not open the log file " + file +
+                                          ": " + strerror(errno));
+  }
+  return fd;
+}
+
+}
+
+FtylogPreallocatedRollingFileAppender::FtylogPreallocatedRollingFileAppender(
+  const log4cplus::helpers::Properties & properties)
+  : log4cplus::Appender(properties), _file(properties.getProperty("File")),
+    _maxFileSize(DEFAULT_MAX_FILE_SIZE), _maxBackupIndex(DEFAULT_MAX_BACKUP_INDEX),
+    _fd(-1), _size(0), _nextFd(-1), _nextFailed(false), _rotatedFd(-1), _late(false),
+    _lateRotations(0), _stop(false)
+{
+  if (properties.exists("MaxFileSize"))
+  {
+    _maxFileSize = FtylogRingFileAppender::parseSize(properties.getProperty("MaxFileSize"));
+  }
+  if (properties.exists("MaxBackupIndex"))
+  {
+    _maxBackupIndex = atoi(properties.getProperty("MaxBackupIndex").c_str());
+  }
+  open();
+}
+
+FtylogPreallocatedRollingFileAppender::FtylogPreallocatedRollingFileAppender(
+  const std::string & file, size_t maxFileSize, int maxBackupIndex)
+  : _file(file), _maxFileSize(maxFileSize), _maxBackupIndex(maxBackupIndex),
+    _fd(-1), _size(0), _nextFd(-1), _nextFailed(false), _rotatedFd(-1), _late(false),
+    _lateRotations(0), _stop(false)
+{
+  open();
+}
+
+FtylogPreallocatedRollingFileAppender::~FtylogPreallocatedRollingFileAppender()
+{
+  destructorImpl();
+}
+
+void FtylogPreallocatedRollingFileAppender::open()
+{
+  if (_maxFileSize == 0)
+  {
+    _maxFileSize = DEFAULT_MAX_FILE_SIZE;
+  }
+  //Messages in File.next: the previous process swapped it in, but ended
+  //before the helper thread renamed it
+  std::string next = _file + NEXT;
+  struct stat fileStat;
+  if (stat(next.c_str(), &fileStat) == 0)
+  {
+    if (fileStat.st_size > 0)
+    {
+      shiftBackups();
+      rename(next.c_str(), _file.c_str());
+    }
+    else
+    {
+      unlink(next.c_str());
+    }
+  }
+
+  _fd = openFile(_file, 0);
+  if ((_fd >= 0) && (fstat(_fd, &fileStat) == 0))
+  {
+    _size = (size_t) fileStat.st_size;
+  }
+  _thread = std::thread(&FtylogPreallocatedRollingFileAppender::run, this);
+}
+
+void FtylogPreallocatedRollingFileAppender::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    _wakeUp.notify_one();
+  }
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+  if (_nextFd >= 0)
+  {
+    ::close(_nextFd);
+    _nextFd = -1;
+    unlink((_file + NEXT).c_str());
+  }
+  if (_fd >= 0)
+  {
+    //Truncating at the end of the file frees the blocks reserved after it
+    struct stat fileStat;
+    if ((fstat(_fd, &fileStat) == 0) && (ftruncate(_fd, fileStat.st_size) != 0))
+    {
+      log4cplus::helpers::getLogLog().warn("Can not free the disk reserved for " + _file +
+                                           ": " + strerror(errno));
+    }
+    ::close(_fd);
+    _fd = -1;
+  }
+  closed = true;
+}
+
+void FtylogPreallocatedRollingFileAppender::append(const log4cplus::spi::InternalLoggingEvent & event)
+{
+  if (_fd < 0)
+  {
+    return;
+  }
+  const log4cplus::tstring & message = formatEvent(event);
+  size_t written = 0;
+  while (written < message.size())
+  {
+    ssize_t size = write(_fd, message.data() + written, message.size() - written);
+    if (size < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      log4cplus::helpers::getLogLog().error("Can not write to the log file " + _file +
+                                            ": " + strerror(errno));
+      break;
+    }
+    written += size;
+  }
+  _size += written;
+  if (_size >= _maxFileSize)
+  {
+    rollover();
+  }
+}
+
+void FtylogPreallocatedRollingFileAppender::rollover()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_nextFd >= 0)
+  {
+    _rotatedFd = _fd;
+    _fd = _nextFd;
+    _nextFd = -1;
+    _size = 0;
+    _late = false;
+    _wakeUp.notify_one();
+    return;
+  }
+  if (!_nextFailed)
+  {
+    //Still busy with the previous rotation, the file grows a bit more
+    if (!_late)
+    {
+      _late = true;
+      _lateRotations++;
+    }
+    return;
+  }
+
+  //No File.next, rotate like log4cplus::RollingFileAppender. The helper
+  //thread has nothing to do until it is asked to try again.
+  ::close(_fd);
+  shiftBackups();
+  _fd = openFile(_file, O_TRUNC);
+  _size = 0;
+  _nextFailed = false;
+  _wakeUp.notify_one();
+}
+
+void FtylogPreallocatedRollingFileAppender::run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true)
+  {
+    if (_rotatedFd >= 0)
+    {
+      int rotated = _rotatedFd;
+      lock.unlock();
+      ::close(rotated);
+      shiftBackups();
+      if (rename((_file + NEXT).c_str(), _file.c_str()) != 0)
+      {
+        log4cplus::helpers::getLogLog().error("Can not rename " + _file + NEXT + ": " +
+                                              strerror(errno));
+      }
+      lock.lock();
+      _rotatedFd = -1;
+    }
+    if (_stop)
+    {
+      break;
+    }
+    if ((_nextFd < 0) && !_nextFailed)
+    {
+      lock.unlock();
+      int next = prepareNext();
+      lock.lock();
+      _nextFd = next;
+      _nextFailed = (next < 0);
+      continue;
+    }
+    _idle.notify_all();
+    _wakeUp.wait(lock, [this]()
+    {
+      return _stop || (_rotatedFd >= 0) || ((_nextFd < 0) && !_nextFailed);
+    });
+  }
+  _idle.notify_all();
+}
+
+int FtylogPreallocatedRollingFileAppender::prepareNext()
+{
+  int fd = openFile(_file + NEXT, O_TRUNC);
+  //Without support of the file system, the file is used as it is
+  if ((fd >= 0) && (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t) _maxFileSize) != 0) &&
+      (errno != EOPNOTSUPP) && (errno != ENOSYS))
+  {
+    log4cplus::helpers::getLogLog().warn("Can not reserve the disk of " + _file + NEXT +
+                                         ": " + strerror(errno));
+  }
+  return fd;
+}
+
+void FtylogPreallocatedRollingFileAppender::shiftBackups()
+{
+  if (_maxBackupIndex <= 0)
+  {
+    unlink(_file.c_str());
+    return;
+  }
+  unlink(backupName(_file, _maxBackupIndex).c_str());
+  for (int index = _maxBackupIndex - 1; index >= 1; index--)
+  {
+    rename(backupName(_file, index).c_str(), backupName(_file, index + 1).c_str());
+  }
+  rename(_file.c_str(), backupName(_file, 1).c_str());
+}
+
+void FtylogPreallocatedRollingFileAppender::waitForHelper()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _idle.wait(lock, [this]()
+  {
+    return _stop || ((_rotatedFd < 0) && ((_nextFd >= 0) || _nextFailed));
+  });
+}
+
+unsigned long long FtylogPreallocatedRollingFileAppender::lateRotations()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _lateRotations;
+}
+
+void FtylogPreallocatedRollingFileAppender::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getAppenderFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::AppenderFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogPreallocatedRollingFileAppender,
+                                         log4cplus::spi::AppenderFactory>(TYPE_NAME)));
+  });
+}
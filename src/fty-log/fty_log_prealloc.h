@@ -0,0 +1,119 @@
+/*  =========================================================================
+    fty_log_prealloc - Rolling file appender rotating to a preallocated file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_PREALLOC_H_INCLUDED
+#define FTY_LOG_PREALLOC_H_INCLUDED
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <log4cplus/appender.h>
+#include <log4cplus/helpers/property.h>
+
+//  @interface
+
+//Appender writing to a file rotated when it reaches a size, with the
+//backups of log4cplus::RollingFileAppender (File.1 is the newest), whose
+//rotation does not block the logging threads. A helper thread creates the
+//next file, File.next, in advance and reserves MaxFileSize bytes of disk
+//for it (fallocate); at the threshold the appender only swaps the file
+//descriptors, and the helper thread renames the backups, deletes the
+//oldest one and renames File.next to File. Selected in a log configuration
+//file with:
+//  log4cplus.appender.file=fty::PreallocatedRollingFileAppender
+//  log4cplus.appender.file.File=/var/log/agent.log
+//  log4cplus.appender.file.MaxFileSize=16MB
+//  log4cplus.appender.file.MaxBackupIndex=5
+//  log4cplus.appender.file.layout=log4cplus::PatternLayout
+//If the helper thread is still busy with the previous rotation, the
+//messages go on to the current file until the next one is ready.
+class FtylogPreallocatedRollingFileAppender : public log4cplus::Appender
+{
+public:
+  //Name of the appender type in the log configuration files
+  static const char * const TYPE_NAME;
+  static const size_t DEFAULT_MAX_FILE_SIZE = 10 * 1024 * 1024;
+  static const int DEFAULT_MAX_BACKUP_INDEX = 1;
+
+  explicit FtylogPreallocatedRollingFileAppender(const log4cplus::helpers::Properties & properties);
+  FtylogPreallocatedRollingFileAppender(const std::string & file,
+                                        size_t maxFileSize = DEFAULT_MAX_FILE_SIZE,
+                                        int maxBackupIndex = DEFAULT_MAX_BACKUP_INDEX);
+  virtual ~FtylogPreallocatedRollingFileAppender();
+
+  //Stop the helper thread once the last rotation is done, and give back
+  //the disk reserved beyond the end of the file
+  virtual void close();
+
+  //Wait until the helper thread has finished the last rotation and
+  //prepared the next file
+  void waitForHelper();
+  //Number of rotations which waited for the helper thread
+  unsigned long long lateRotations();
+
+  //Make the appender available to the log configuration files
+  static void registerFactory();
+
+protected:
+  virtual void append(const log4cplus::spi::InternalLoggingEvent & event);
+
+private:
+  std::string _file;
+  size_t _maxFileSize;
+  int _maxBackupIndex;
+  //File being written, -1 if it could not be opened, and its size. Only
+  //used by append(), under the lock of the appender.
+  int _fd;
+  size_t _size;
+
+  std::mutex _mutex;
+  std::condition_variable _wakeUp;
+  std::condition_variable _idle;
+  //File.next once prepared, -1 before
+  int _nextFd;
+  //File.next could not be created, the appender rotates by itself
+  bool _nextFailed;
+  //File swapped out, closed and renamed by the helper thread, -1 if none
+  int _rotatedFd;
+  //The current rotation waits for the helper thread
+  bool _late;
+  unsigned long long _lateRotations;
+  bool _stop;
+  std::thread _thread;
+
+  //Finish a rotation interrupted by the end of the previous process, open
+  //the file and start the helper thread
+  void open();
+  void rollover();
+  //Body of the helper thread
+  void run();
+  //Create File.next with its disk reserved, -1 on failure
+  int prepareNext();
+  //Shift the backups and rename File to File.1 (or remove it)
+  void shiftBackups();
+
+  FtylogPreallocatedRollingFileAppender(const FtylogPreallocatedRollingFileAppender&) = delete;
+  FtylogPreallocatedRollingFileAppender& operator=(const FtylogPreallocatedRollingFileAppender&) = delete;
+};
+
+//  @end
+#endif
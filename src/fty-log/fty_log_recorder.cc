@@ -0,0 +1,310 @@
+/*  =========================================================================
+    fty_log_recorder - Flight recorder of suppressed log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+/*
+@header
+    fty_log_recorder - Flight recorder of suppressed log messages
+@discuss
+    A recorded message is not formatted: the format and the arguments are
+    captured by FtylogDeferredFormat (strings copied) into a preallocated
+    slot of the ring of the calling thread, and formatted when the rings
+    are dumped. A format which can not be deferred, or which does not fit
+    in a slot with its arguments, is formatted by the caller and truncated.
+    The mutex of a ring is only contended by a dump, or by the threads
+    sharing the ring; the thread looks its ring up like the blocks of
+    FtylogStatsCounters. The ring of a thread which exited is taken over by
+    the next thread which registers one, and once there are MAX_RINGS rings
+    the new threads share them in turn: the memory of the recorder is at
+    most MAX_RINGS rings of capacity slots. The MDC is not kept.
+@end
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <log4cplus/mdc.h>
+#include <log4cplus/spi/loggingevent.h>
+#include <log4cplus/thread/threads.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+std::atomic<unsigned long long> recorderIds(0);
+
+//Rings of the calling thread, one per FtylogFlightRecorder it recorded in
+struct ThreadRings
+{
+  unsigned long long lastId;
+  FtylogFlightRecorder::Ring * last;
+  std::vector<std::pair<unsigned long long, std::shared_ptr<FtylogFlightRecorder::Ring>>> rings;
+
+  ThreadRings()
+    : lastId(0), last(NULL)
+  {
+  }
+
+  ~ThreadRings()
+  {
+    for (auto & ring : rings)
+    {
+      ring.second->users.fetch_sub(1, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ThreadRings threadRings;
+
+//Copy a thread name, truncated to the size of the slot field
+void copyName(char * destination, size_t size, const log4cplus::tstring & name)
+{
+  size_t length = std::min(name.size(), size - 1);
+  memcpy(destination, name.data(), length);
+  destination[length] = '\0';
+}
+
+//A message taken out of a ring by dump()
+struct Recorded
+{
+  FtylogFlightRecorder::Slot slot;
+  std::string data;
+};
+
+}
+
+FtylogFlightRecorder::Ring::Ring(size_t capacity, size_t maxLength)
+  : slots(capacity), data(capacity * maxLength), next(0), count(0),
+    users(1), orphaned(false)
+{
+}
+
+FtylogFlightRecorder::FtylogFlightRecorder(size_t capacity, log4cplus::LogLevel triggerLevel,
+                                           size_t maxLength)
+  : _triggerLevel(triggerLevel), _capacity(std::max(capacity, (size_t) 1)),
+    _maxLength(maxLength), _id(++recorderIds), _nextShared(0)
+{
+}
+
+FtylogFlightRecorder::~FtylogFlightRecorder()
+{
+  //The threads still holding a ring drop it when they look for another
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (std::shared_ptr<Ring> & ring : _rings)
+  {
+    ring->orphaned.store(true, std::memory_order_relaxed);
+  }
+}
+
+FtylogFlightRecorder::Ring & FtylogFlightRecorder::forThisThread()
+{
+  if (threadRings.lastId == _id)
+  {
+    return *threadRings.last;
+  }
+  auto & rings = threadRings.rings;
+  for (size_t i = 0; i < rings.size(); )
+  {
+    if (rings[i].first == _id)
+    {
+      threadRings.lastId = _id;
+      threadRings.last = rings[i].second.get();
+      return *threadRings.last;
+    }
+    if (rings[i].second->orphaned.load(std::memory_order_relaxed))
+    {
+      if (threadRings.lastId == rings[i].first)
+      {
+        threadRings.lastId = 0;
+      }
+      rings.erase(rings.begin() + i);
+      continue;
+    }
+    i++;
+  }
+  std::shared_ptr<Ring> ring;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    //Take over the ring of a thread which exited, so that starting and
+    //ending threads does not add rings until the next dump: its messages
+    //are dumped with ours until ours replace them
+    for (std::shared_ptr<Ring> & released : _rings)
+    {
+      if (released->users.load(std::memory_order_acquire) == 0)
+      {
+        ring = released;
+        ring->users.store(1, std::memory_order_relaxed);
+        break;
+      }
+    }
+    if (!ring && (_rings.size() >= MAX_RINGS))
+    {
+      //All the rings are in use: share one, the threads take turns
+      ring = _rings[_nextShared++ % _rings.size()];
+      ring->users.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!ring)
+    {
+      ring = std::make_shared<Ring>(_capacity, _maxLength);
+      _rings.push_back(ring);
+    }
+  }
+  rings.push_back(std::make_pair(_id, ring));
+  threadRings.lastId = _id;
+  threadRings.last = ring.get();
+  return *ring;
+}
+
+size_t FtylogFlightRecorder::size()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  size_t size = 0;
+  for (std::shared_ptr<Ring> & ring : _rings)
+  {
+    std::lock_guard<std::mutex> ringLock(ring->mutex);
+    size += ring->count;
+  }
+  return size;
+}
+
+void FtylogFlightRecorder::record(log4cplus::LogLevel level, const char* file, int line,
+                                  const char* func, const char* format, va_list args)
+{
+  //Format and arguments, reusing the memory of the previous message
+  static thread_local std::string captured;
+  captured.clear();
+  size_t formatLength = strlen(format);
+  if ((formatLength > 0) && (formatLength < _maxLength))
+  {
+    captured.append(format, formatLength);
+    if (FtylogDeferredFormat::capture(format, args, captured) &&
+        (captured.size() <= _maxLength))
+    {
+      store(level, file, line, func, captured.data(), formatLength, captured.size());
+      return;
+    }
+  }
+
+  FtylogFormatBuffer & buffer = FtylogFormatBuffer::forThisThread();
+  int r = buffer.format(format, args);
+  if (r != -1)
+  {
+    record(level, file, line, func, buffer.data(), (size_t) r);
+  }
+}
+
+void FtylogFlightRecorder::record(log4cplus::LogLevel level, const char* file, int line,
+                                  const char* func, const char* message, size_t length)
+{
+  store(level, file, line, func, message, 0, std::min(length, _maxLength));
+}
+
+void FtylogFlightRecorder::store(log4cplus::LogLevel level, const char* file, int line,
+                                 const char* func, const char* data, size_t formatLength,
+                                 size_t length)
+{
+  //Read the clock and the thread names before taking the lock
+  log4cplus::helpers::Time timestamp = FtylogClock::now();
+  const log4cplus::tstring & thread = log4cplus::thread::getCurrentThreadName();
+  const log4cplus::tstring & thread2 = log4cplus::thread::getCurrentThreadName2();
+  Ring & ring = forThisThread();
+
+  std::lock_guard<std::mutex> lock(ring.mutex);
+  Slot & slot = ring.slots[ring.next];
+  slot.level = level;
+  slot.file = file;
+  slot.line = line;
+  slot.func = func;
+  slot.timestamp = timestamp;
+  copyName(slot.thread, sizeof(slot.thread), thread);
+  copyName(slot.thread2, sizeof(slot.thread2), thread2);
+  slot.formatLength = formatLength;
+  slot.length = length;
+  memcpy(&ring.data[ring.next * _maxLength], data, length);
+
+  ring.next = (ring.next + 1) % ring.slots.size();
+  if (ring.count < ring.slots.size())
+  {
+    ring.count++;
+  }
+}
+
+void FtylogFlightRecorder::dump(log4cplus::Logger & logger)
+{
+  //Take the messages out of the rings, then format and write them without
+  //holding any lock
+  std::vector<Recorded> recorded;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < _rings.size(); )
+    {
+      Ring & ring = *_rings[i];
+      //Read the users first: a message recorded before the last thread
+      //exited is still taken below
+      bool released = ring.users.load(std::memory_order_acquire) == 0;
+      {
+        std::lock_guard<std::mutex> ringLock(ring.mutex);
+        size_t index = (ring.next + ring.slots.size() - ring.count) % ring.slots.size();
+        for (; ring.count > 0; ring.count--)
+        {
+          Recorded message;
+          message.slot = ring.slots[index];
+          message.data.assign(&ring.data[index * _maxLength], message.slot.length);
+          recorded.push_back(std::move(message));
+          index = (index + 1) % ring.slots.size();
+        }
+      }
+      if (released)
+      {
+        _rings.erase(_rings.begin() + i);
+        continue;
+      }
+      i++;
+    }
+  }
+  //The rings are each in chronological order
+  std::stable_sort(recorded.begin(), recorded.end(),
+    [](const Recorded & a, const Recorded & b) { return a.slot.timestamp < b.slot.timestamp; });
+
+  log4cplus::MappedDiagnosticContextMap mdc;
+  std::string text;
+  for (const Recorded & message : recorded)
+  {
+    const Slot & slot = message.slot;
+    if (slot.formatLength > 0)
+    {
+      std::string format = message.data.substr(0, slot.formatLength);
+      FtylogDeferredFormat::format(format.c_str(), message.data.substr(slot.formatLength), text);
+      if (text.size() > _maxLength)
+      {
+        text.resize(_maxLength);
+      }
+    }
+    else
+    {
+      text = message.data;
+    }
+    log4cplus::spi::InternalLoggingEvent event(logger.getName(), slot.level,
+      log4cplus::tstring(), mdc, text, slot.thread, slot.thread2, slot.timestamp,
+      slot.file, slot.line, slot.func);
+    logger.forcedLog(event);
+  }
+}
@@ -0,0 +1,136 @@
+/*  =========================================================================
+    fty_log_recorder - Flight recorder of suppressed log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+#ifndef FTY_LOG_RECORDER_H_INCLUDED
+#define FTY_LOG_RECORDER_H_INCLUDED
+
+#include <stdarg.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <log4cplus/logger.h>
+#include <log4cplus/helpers/timehelper.h>
+
+//  @interface
+
+//Keeps the last messages rejected by the level of a logger (typically
+//TRACE and DEBUG while running at INFO), and writes them to the appenders
+//when a message of the trigger level is logged, so that an error comes with
+//the details which led to it.
+//Each thread records in its own ring, allocated once on its first message
+//or taken over from a thread which exited: a ring holds a fixed number of
+//messages, each truncated to a fixed length. There are at most MAX_RINGS
+//rings; past them, the new threads share the existing ones, so the memory
+//is bounded by MAX_RINGS rings whatever the number of threads.
+class FtylogFlightRecorder
+{
+public:
+  //One message kept: its format and the arguments captured by
+  //FtylogDeferredFormat, or the message itself
+  struct Slot
+  {
+    log4cplus::LogLevel level;
+    const char * file;
+    int line;
+    const char * func;
+    log4cplus::helpers::Time timestamp;
+    char thread[24];
+    char thread2[24];
+    //The data of the slot is the format (formatLength characters) followed
+    //by the arguments; or the message if formatLength is zero
+    size_t formatLength;
+    size_t length;
+  };
+
+  //Messages of one thread, or of the threads sharing the ring
+  struct Ring
+  {
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    //Data of the slots, maxLength bytes each
+    std::vector<char> data;
+    //Slot of the next message, and number of slots in use
+    size_t next;
+    size_t count;
+    //Number of threads recording in the ring. Once they have all exited,
+    //the ring is dropped when dumped, or taken over by a new thread.
+    std::atomic<unsigned int> users;
+    //Set when the recorder is destroyed: the thread forgets the ring
+    std::atomic<bool> orphaned;
+
+    Ring(size_t capacity, size_t maxLength);
+  };
+
+  //Length kept of each message
+  static const size_t DEFAULT_MESSAGE_LENGTH = 256;
+  //Number of rings of a recorder
+  static const size_t MAX_RINGS = 16;
+
+  //capacity is the number of messages kept for each ring
+  FtylogFlightRecorder(size_t capacity, log4cplus::LogLevel triggerLevel,
+                       size_t maxLength = DEFAULT_MESSAGE_LENGTH);
+  ~FtylogFlightRecorder();
+
+  log4cplus::LogLevel triggerLevel() const { return _triggerLevel; }
+  size_t capacity() const { return _capacity; }
+  //Number of messages currently kept, all threads together
+  size_t size();
+
+  //Keep the format and a copy of the arguments, replacing the oldest
+  //message of the ring of the thread if it is full. The message is formatted
+  //when dumped, unless the format can not be deferred or is too long.
+  void record(log4cplus::LogLevel level, const char* file, int line,
+              const char* func, const char* format, va_list args);
+  //Keep a message already formatted
+  void record(log4cplus::LogLevel level, const char* file, int line,
+              const char* func, const char* message, size_t length);
+  //Write the messages kept by all the threads to the appenders of the
+  //logger, oldest first, with their original level, time and thread, then
+  //forget them
+  void dump(log4cplus::Logger & logger);
+
+private:
+  log4cplus::LogLevel _triggerLevel;
+  size_t _capacity;
+  size_t _maxLength;
+  //Identifies the recorder in the rings the threads keep; an address
+  //could be reused by another recorder
+  unsigned long long _id;
+  //Rings of the threads, added on their first message
+  std::mutex _mutex;
+  std::vector<std::shared_ptr<Ring>> _rings;
+  //Next ring shared by a new thread once there are MAX_RINGS of them
+  size_t _nextShared;
+
+  FtylogFlightRecorder(const FtylogFlightRecorder&) = delete;
+  FtylogFlightRecorder& operator=(const FtylogFlightRecorder&) = delete;
+
+  //Ring of the calling thread, registered on first use
+  Ring & forThisThread();
+  //Store the data of a message in the next slot of the ring of the calling thread
+  void store(log4cplus::LogLevel level, const char* file, int line, const char* func,
+             const char* data, size_t formatLength, size_t length);
+};
+
+//  @end
+#endif
@@ -0,0 +1,343 @@
+/*  =========================================================================
+    fty_log_ringfile - Memory-mapped circular log file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+/*
+@header
+    fty_log_ringfile - Memory-mapped circular log file
+@discuss
+    The file starts with a header, followed by the data area holding the
+    records. Each record is a RecordHeader followed by the formatted
+    message, padded to 8 bytes. When a record does not fit before the end
+    of the data area, writing starts again at its beginning, over the
+    oldest records. There is no pointer to the newest record: the readers
+    look for every valid record and sort them by sequence number, so the
+    file is consistent whenever the process is killed.
+@end
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <log4cplus/helpers/loglog.h>
+#include <log4cplus/spi/factory.h>
+
+#include "fty_common_logging_classes.h"
+
+static const char RING_MAGIC[8] = { 'F', 'T', 'Y', 'R', 'I', 'N', 'G', '1' };
+static const uint32_t RECORD_MAGIC = 0x52474c46;
+
+struct FileHeader
+{
+  char magic[8];
+  //Size of the whole file
+  uint64_t size;
+  uint64_t reserved[6];
+};
+
+struct RecordHeader
+{
+  uint32_t magic;
+  uint32_t length;
+  uint64_t sequence;
+  //FNV-1a of the message: a record partially overwritten is not valid
+  uint32_t checksum;
+  //Check of the other fields, so that scanning the data area rarely
+  //computes the checksum of something which is not a record
+  uint32_t check;
+};
+
+const char * const FtylogRingFileAppender::TYPE_NAME = "fty::RingFileAppender";
+
+static size_t recordSize(size_t length)
+{
+  return (sizeof(RecordHeader) + length + 7) & ~((size_t) 7);
+}
+
+static uint32_t messageChecksum(const char * message, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= (unsigned char) message[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t headerCheck(const RecordHeader & header)
+{
+  return ~(header.length ^ (uint32_t) header.sequence ^
+           (uint32_t) (header.sequence >> 32) ^ header.checksum);
+}
+
+//Call found(offset, header) for each valid record of the data area
+template <typename Found>
+static void scanRecords(const char * data, size_t dataSize, Found found)
+{
+  size_t offset = 0;
+  while (offset + sizeof(RecordHeader) <= dataSize)
+  {
+    const RecordHeader * header = (const RecordHeader *) (data + offset);
+    if ((header->magic == RECORD_MAGIC) && (header->check == headerCheck(*header)) &&
+        (header->length <= dataSize - offset - sizeof(RecordHeader)) &&
+        (header->checksum == messageChecksum(data + offset + sizeof(RecordHeader), header->length)))
+    {
+      found(offset, *header);
+      offset += recordSize(header->length);
+    }
+    else
+    {
+      offset += 8;
+    }
+  }
+}
+
+size_t FtylogRingFileAppender::parseSize(const std::string & value)
+{
+  char * end = NULL;
+  unsigned long long size = strtoull(value.c_str(), &end, 10);
+  std::string unit(end);
+  if ((unit == "KB") || (unit == "kb") || (unit == "K") || (unit == "k"))
+  {
+    size *= 1024;
+  }
+  else if ((unit == "MB") || (unit == "mb") || (unit == "M") || (unit == "m"))
+  {
+    size *= 1024 * 1024;
+  }
+  else if ((unit == "GB") || (unit == "gb") || (unit == "G") || (unit == "g"))
+  {
+    size *= 1024 * 1024 * 1024;
+  }
+  return (size_t) size;
+}
+
+FtylogRingFileAppender::FtylogRingFileAppender(const log4cplus::helpers::Properties & properties)
+  : log4cplus::Appender(properties), _file(properties.getProperty("File")),
+    _size(DEFAULT_SIZE), _map(NULL), _position(0), _sequence(1)
+{
+  if (properties.exists("Size"))
+  {
+    _size = parseSize(properties.getProperty("Size"));
+  }
+  open();
+}
+
+FtylogRingFileAppender::FtylogRingFileAppender(const std::string & file, size_t size)
+  : _file(file), _size(size), _map(NULL), _position(0), _sequence(1)
+{
+  open();
+}
+
+FtylogRingFileAppender::~FtylogRingFileAppender()
+{
+  destructorImpl();
+}
+
+void FtylogRingFileAppender::open()
+{
+  _size = std::max(_size, (size_t) MIN_SIZE) & ~((size_t) 7);
+  int fd = ::open(_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    log4cplus::helpers::getLogLog().error("Can not open the ring file " + _file +
+                                          ": " + strerror(errno));
+    return;
+  }
+
+  //Keep the records of a previous run, unless the size changed
+  FileHeader existing;
+  struct stat fileStat;
+  bool valid = (fstat(fd, &fileStat) == 0) && ((size_t) fileStat.st_size == _size) &&
+    (pread(fd, &existing, sizeof(existing), 0) == (ssize_t) sizeof(existing)) &&
+    (memcmp(existing.magic, RING_MAGIC, sizeof(RING_MAGIC)) == 0) &&
+    (existing.size == _size);
+  if (!valid && (ftruncate(fd, 0) != 0))
+  {
+    log4cplus::helpers::getLogLog().error("Can not reset the ring file " + _file +
+                                          ": " + strerror(errno));
+    ::close(fd);
+    return;
+  }
+  //Allocate the blocks now: writing to a hole of a full file system
+  //through the mapping would raise SIGBUS
+  int error = posix_fallocate(fd, 0, _size);
+  void * map = MAP_FAILED;
+  if (error == 0)
+  {
+    map = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    error = errno;
+  }
+  ::close(fd);
+  if (map == MAP_FAILED)
+  {
+    log4cplus::helpers::getLogLog().error("Can not map the ring file " + _file +
+                                          ": " + strerror(error));
+    return;
+  }
+  _map = (char *) map;
+
+  if (valid)
+  {
+    //Continue after the newest record
+    scanRecords(_map + sizeof(FileHeader), _size - sizeof(FileHeader),
+      [this](size_t offset, const RecordHeader & header)
+      {
+        if (header.sequence >= _sequence)
+        {
+          _sequence = header.sequence + 1;
+          _position = offset + recordSize(header.length);
+        }
+      });
+  }
+  else
+  {
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RING_MAGIC, sizeof(RING_MAGIC));
+    header.size = _size;
+    memcpy(_map, &header, sizeof(header));
+  }
+}
+
+void FtylogRingFileAppender::close()
+{
+  if (NULL != _map)
+  {
+    munmap(_map, _size);
+    _map = NULL;
+  }
+  closed = true;
+}
+
+void FtylogRingFileAppender::append(const log4cplus::spi::InternalLoggingEvent & event)
+{
+  if (NULL == _map)
+  {
+    return;
+  }
+  const log4cplus::tstring & message = formatEvent(event);
+  char * data = _map + sizeof(FileHeader);
+  size_t dataSize = _size - sizeof(FileHeader);
+
+  //A message uses at most a quarter of the ring, so that a huge message
+  //does not wipe all the others
+  size_t length = std::min(message.size(), dataSize / 4 - sizeof(RecordHeader));
+  if (_position + recordSize(length) > dataSize)
+  {
+    _position = 0;
+  }
+  RecordHeader * header = (RecordHeader *) (data + _position);
+
+  //Invalidate the record being overwritten before changing its message,
+  //and validate the new one last: if the process dies in the middle, the
+  //reader sees neither of them
+  header->magic = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(data + _position + sizeof(RecordHeader), message.data(), length);
+  header->length = (uint32_t) length;
+  header->sequence = _sequence;
+  header->checksum = messageChecksum(message.data(), length);
+  header->check = headerCheck(*header);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = RECORD_MAGIC;
+
+  _position += recordSize(length);
+  _sequence++;
+}
+
+void FtylogRingFileAppender::registerFactory()
+{
+  static std::once_flag registered;
+  std::call_once(registered, []()
+  {
+    log4cplus::spi::getAppenderFactoryRegistry().put(
+      std::unique_ptr<log4cplus::spi::AppenderFactory>(
+        new log4cplus::spi::FactoryTempl<FtylogRingFileAppender,
+                                         log4cplus::spi::AppenderFactory>(TYPE_NAME)));
+  });
+}
+
+bool FtylogRingFileAppender::readRecords(const std::string & file, std::vector<Record> & records,
+                                         std::string & error)
+{
+  records.clear();
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    error = file + ": " + strerror(errno);
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0)
+  {
+    error = file + ": " + strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  //The file may be in use: read a copy rather than a shared mapping
+  std::string content((size_t) fileStat.st_size, '\0');
+  size_t done = 0;
+  while (done < content.size())
+  {
+    ssize_t r = pread(fd, &content[done], content.size() - done, done);
+    if (r <= 0)
+    {
+      break;
+    }
+    done += r;
+  }
+  ::close(fd);
+
+  const FileHeader * header = (const FileHeader *) content.data();
+  if ((done != content.size()) || (content.size() < sizeof(FileHeader)) ||
+      (memcmp(header->magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0) ||
+      (header->size != content.size()))
+  {
+    error = file + ": not a ring log file";
+    return false;
+  }
+
+  const char * data = content.data() + sizeof(FileHeader);
+  scanRecords(data, content.size() - sizeof(FileHeader),
+    [&records, data](size_t offset, const RecordHeader & recordHeader)
+    {
+      Record record;
+      record.sequence = recordHeader.sequence;
+      record.message.assign(data + offset + sizeof(RecordHeader), recordHeader.length);
+      records.push_back(std::move(record));
+    });
+  std::sort(records.begin(), records.end(),
+    [](const Record & a, const Record & b) { return a.sequence < b.sequence; });
+  return true;
+}
+
+bool ftylog_readRingFile(const std::string & file, std::vector<FtylogRingRecord> & records,
+                         std::string & error)
+{
+  return FtylogRingFileAppender::readRecords(file, records, error);
+}
@@ -0,0 +1,93 @@
+/*  =========================================================================
+    fty_log_ringfile - Memory-mapped circular log file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+
+#ifndef FTY_LOG_RINGFILE_H_INCLUDED
+#define FTY_LOG_RINGFILE_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <log4cplus/appender.h>
+#include <log4cplus/helpers/property.h>
+
+//  @interface
+
+//Appender writing the formatted events into a fixed size memory-mapped file
+//used as a circular log. Writing a message is a memcpy, without system call,
+//and the last messages survive a crash or a SIGKILL of the process since the
+//pages belong to the kernel. Selected in a log configuration file with:
+//  log4cplus.appender.ring=fty::RingFileAppender
+//  log4cplus.appender.ring.File=/var/log/agent.ring
+//  log4cplus.appender.ring.Size=4MB
+//  log4cplus.appender.ring.layout=log4cplus::PatternLayout
+//The records are read back with ftylog_readRingFile() or the
+//fty-log-ring-reader tool.
+class FtylogRingFileAppender : public log4cplus::Appender
+{
+public:
+  //One record read back from a ring file
+  typedef FtylogRingRecord Record;
+
+  //Name of the appender type in the log configuration files
+  static const char * const TYPE_NAME;
+  static const size_t DEFAULT_SIZE = 4 * 1024 * 1024;
+  static const size_t MIN_SIZE = 64 * 1024;
+
+  explicit FtylogRingFileAppender(const log4cplus::helpers::Properties & properties);
+  FtylogRingFileAppender(const std::string & file, size_t size = DEFAULT_SIZE);
+  virtual ~FtylogRingFileAppender();
+
+  virtual void close();
+
+  //Make the appender available to the log configuration files
+  static void registerFactory();
+
+  //Parse sizes of the configuration files like "4MB", "512KB" or "65536"
+  static size_t parseSize(const std::string & value);
+
+  //Read the records which are still in a ring file, in chronological order.
+  //Return false and set error if the file can not be read or is not a ring file.
+  static bool readRecords(const std::string & file, std::vector<Record> & records,
+                          std::string & error);
+
+protected:
+  virtual void append(const log4cplus::spi::InternalLoggingEvent & event);
+
+private:
+  std::string _file;
+  //Size of the whole file, header included
+  size_t _size;
+  //Mapping of the file, NULL if it could not be opened
+  char * _map;
+  //Offset in the data area of the next record, and its sequence number
+  size_t _position;
+  uint64_t _sequence;
+
+  //Map the file, keeping the records of a valid existing file
+  void open();
+
+  FtylogRingFileAppender(const FtylogRingFileAppender&) = delete;
+  FtylogRingFileAppender& operator=(const FtylogRingFileAppender&) = delete;
+};
+
+//  @end
+#endif
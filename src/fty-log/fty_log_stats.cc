@@ -0,0 +1,224 @@
+/*  =========================================================================
+    fty_log_stats - Counters of the logging functions
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_stats - Counters of the logging functions
+@discuss
+    A thread keeps the blocks of the counters it logged to, the last one
+    used first so that a thread logging to one Ftylog object finds it with
+    one compare. A block outlives its thread (its counters are added to the
+    retired ones on the next read, or when another thread registers its
+    block) and the Ftylog object (the thread drops it when it looks for
+    another block).
+@end
+ */
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+std::atomic<unsigned long long> countersIds(0);
+
+//Blocks of the calling thread, one per FtylogStatsCounters it counted in
+struct ThreadBlocks
+{
+  unsigned long long lastId;
+  FtylogStatsCounters::Block * last;
+  std::vector<std::pair<unsigned long long, std::shared_ptr<FtylogStatsCounters::Block>>> blocks;
+
+  ThreadBlocks()
+    : lastId(0), last(NULL)
+  {
+  }
+
+  ~ThreadBlocks()
+  {
+    for (auto & block : blocks)
+    {
+      block.second->released.store(true, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ThreadBlocks threadBlocks;
+
+void addBlock(FtylogStats & stats, const FtylogStatsCounters::Block & block)
+{
+  for (size_t i = 0; i < FTYLOG_STATS_LEVELS; i++)
+  {
+    stats.emitted[i] += block.emitted[i].load(std::memory_order_relaxed);
+    stats.filtered[i] += block.filtered[i].load(std::memory_order_relaxed);
+  }
+  stats.bytesFormatted += block.bytesFormatted.load(std::memory_order_relaxed);
+  stats.formatFailures += block.formatFailures.load(std::memory_order_relaxed);
+  stats.dropped += block.dropped.load(std::memory_order_relaxed);
+  stats.suppressed += block.suppressed.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < FTYLOG_STATS_LATENCY_BUCKETS; i++)
+  {
+    unsigned long long calls = block.latency[i].load(std::memory_order_relaxed);
+    stats.latency[i] += calls;
+    stats.calls += calls;
+  }
+  stats.latencyTotalNs += block.latencyTotalNs.load(std::memory_order_relaxed);
+}
+
+}
+
+FtylogStatsCounters::Block::Block()
+  : released(false), orphaned(false)
+{
+  for (size_t i = 0; i < FTYLOG_STATS_LEVELS; i++)
+  {
+    emitted[i].store(0, std::memory_order_relaxed);
+    filtered[i].store(0, std::memory_order_relaxed);
+  }
+  bytesFormatted.store(0, std::memory_order_relaxed);
+  formatFailures.store(0, std::memory_order_relaxed);
+  dropped.store(0, std::memory_order_relaxed);
+  suppressed.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < FTYLOG_STATS_LATENCY_BUCKETS; i++)
+  {
+    latency[i].store(0, std::memory_order_relaxed);
+  }
+  latencyTotalNs.store(0, std::memory_order_relaxed);
+}
+
+FtylogStatsCounters::FtylogStatsCounters()
+  : _id(++countersIds)
+{
+  memset(&_retired, 0, sizeof(_retired));
+  _queueFullWaits.store(0);
+}
+
+FtylogStatsCounters::~FtylogStatsCounters()
+{
+  //The threads still holding a block drop it when they look for another
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (std::shared_ptr<Block> & block : _blocks)
+  {
+    block->orphaned.store(true, std::memory_order_relaxed);
+  }
+}
+
+FtylogStatsCounters::Block & FtylogStatsCounters::forThisThread()
+{
+  if (threadBlocks.lastId == _id)
+  {
+    return *threadBlocks.last;
+  }
+  auto & blocks = threadBlocks.blocks;
+  for (size_t i = 0; i < blocks.size(); )
+  {
+    if (blocks[i].first == _id)
+    {
+      threadBlocks.lastId = _id;
+      threadBlocks.last = blocks[i].second.get();
+      return *threadBlocks.last;
+    }
+    if (blocks[i].second->orphaned.load(std::memory_order_relaxed))
+    {
+      if (threadBlocks.lastId == blocks[i].first)
+      {
+        threadBlocks.lastId = 0;
+      }
+      blocks.erase(blocks.begin() + i);
+      continue;
+    }
+    i++;
+  }
+  std::shared_ptr<Block> block = std::make_shared<Block>();
+  {
+    //A process starting short-lived threads may never read the
+    //statistics: the blocks of the exited ones are retired here too
+    std::lock_guard<std::mutex> lock(_mutex);
+    retireReleased();
+    _blocks.push_back(block);
+  }
+  blocks.push_back(std::make_pair(_id, block));
+  threadBlocks.lastId = _id;
+  threadBlocks.last = block.get();
+  return *block;
+}
+
+size_t FtylogStatsCounters::levelIndex(int level)
+{
+  if (level < 0)
+  {
+    return 0;
+  }
+  size_t index = (size_t) level / 10000;
+  return (index < FTYLOG_STATS_LEVELS) ? index : FTYLOG_STATS_LEVELS - 1;
+}
+
+void FtylogStatsCounters::addLatency(Block & block, unsigned long long ns)
+{
+  //Bucket i counts the calls shorter than 256 << i nanoseconds
+  size_t bucket = 0;
+  if (ns >= 256)
+  {
+    bucket = (size_t) (63 - __builtin_clzll(ns)) - 7;
+    if (bucket >= FTYLOG_STATS_LATENCY_BUCKETS)
+    {
+      bucket = FTYLOG_STATS_LATENCY_BUCKETS - 1;
+    }
+  }
+  add(block.latency[bucket], 1);
+  add(block.latencyTotalNs, ns);
+}
+
+void FtylogStatsCounters::addQueueFullWait()
+{
+  _queueFullWaits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FtylogStatsCounters::retireReleased()
+{
+  //The blocks of the threads which exited are read one last time
+  size_t kept = 0;
+  for (size_t i = 0; i < _blocks.size(); i++)
+  {
+    if (_blocks[i]->released.load(std::memory_order_acquire))
+    {
+      addBlock(_retired, *_blocks[i]);
+      continue;
+    }
+    if (kept != i)
+    {
+      _blocks[kept].swap(_blocks[i]);
+    }
+    kept++;
+  }
+  _blocks.resize(kept);
+}
+
+void FtylogStatsCounters::get(FtylogStats & stats)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  retireReleased();
+  stats = _retired;
+  for (const std::shared_ptr<Block> & block : _blocks)
+  {
+    addBlock(stats, *block);
+  }
+  stats.queueFullWaits = _queueFullWaits.load(std::memory_order_relaxed);
+}
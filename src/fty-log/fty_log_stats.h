@@ -0,0 +1,100 @@
+/*  =========================================================================
+    fty_log_stats - Counters of the logging functions
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_STATS_H_INCLUDED
+#define FTY_LOG_STATS_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//  @interface
+
+//Statistics of one Ftylog object. Each thread counts in its own block,
+//written by that thread only (a relaxed load and store per counter, no
+//locked instruction); the blocks are summed when the statistics are read.
+class FtylogStatsCounters
+{
+public:
+  //Counters of one thread
+  struct Block
+  {
+    std::atomic<unsigned long long> emitted[FTYLOG_STATS_LEVELS];
+    std::atomic<unsigned long long> filtered[FTYLOG_STATS_LEVELS];
+    std::atomic<unsigned long long> bytesFormatted;
+    std::atomic<unsigned long long> formatFailures;
+    std::atomic<unsigned long long> dropped;
+    std::atomic<unsigned long long> suppressed;
+    std::atomic<unsigned long long> latency[FTYLOG_STATS_LATENCY_BUCKETS];
+    std::atomic<unsigned long long> latencyTotalNs;
+    //Set when the thread has exited: the block does not change anymore
+    std::atomic<bool> released;
+    //Set when the counters are destroyed: the thread forgets the block
+    std::atomic<bool> orphaned;
+
+    Block();
+  };
+
+  FtylogStatsCounters();
+  ~FtylogStatsCounters();
+
+  //Block of the calling thread, registered on first use
+  Block & forThisThread();
+
+  //Increment a counter of the block of the calling thread
+  static void add(std::atomic<unsigned long long> & counter, unsigned long long value)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  //Index of a level in the counters of the levels
+  static size_t levelIndex(int level);
+  //Count one call of the logging functions which lasted ns nanoseconds
+  static void addLatency(Block & block, unsigned long long ns);
+
+  //Counted for all the threads: a producer waiting for room in the queue
+  //of the asynchronous mode, rare and already slow
+  void addQueueFullWait();
+
+  //Sum of the counters of all the threads
+  void get(FtylogStats & stats);
+
+private:
+  //Identifies the counters in the blocks the threads keep; an address
+  //could be reused by other counters
+  unsigned long long _id;
+  std::mutex _mutex;
+  std::vector<std::shared_ptr<Block>> _blocks;
+  //Counters of the threads which exited
+  FtylogStats _retired;
+  std::atomic<unsigned long long> _queueFullWaits;
+
+  //Add the blocks of the threads which exited to _retired and drop them,
+  //with _mutex held
+  void retireReleased();
+
+  FtylogStatsCounters(const FtylogStatsCounters&) = delete;
+  FtylogStatsCounters& operator=(const FtylogStatsCounters&) = delete;
+};
+
+//  @end
+#endif
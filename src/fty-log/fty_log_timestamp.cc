@@ -0,0 +1,316 @@
+/*  =========================================================================
+    fty_log_timestamp - Clock and cached rendering of log timestamps
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_timestamp - Clock and cached rendering of log timestamps
+@discuss
+    Reading the clock and running strftime() for every message are among
+    the largest costs of a log line after the formatting of the message.
+    The clock source can be made cheaper, and the text of a time stamp is
+    only rebuilt when the second changes.
+@end
+ */
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+log4cplus::helpers::Time fromTimespec(const struct timespec & ts)
+{
+  return log4cplus::helpers::time_from_parts(ts.tv_sec, ts.tv_nsec / 1000);
+}
+
+int64_t toNanoseconds(const struct timespec & ts)
+{
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//Real time of one thread at a value of the counter
+struct TscAnchor
+{
+  uint64_t tsc;
+  int64_t nanoseconds;
+  bool valid;
+};
+
+thread_local TscAnchor tscAnchor = { 0, 0, false };
+#endif
+
+//Append the digits of value, on width characters
+void writeDigits(char * text, unsigned long value, int width)
+{
+  for (int i = width - 1; i >= 0; i--)
+  {
+    text[i] = (char) ('0' + (value % 10));
+    value /= 10;
+  }
+}
+
+}
+
+////////////////////////
+//FtylogClock
+////////////////////////
+
+std::atomic<int> FtylogClock::_source(FtylogClock::REALTIME);
+std::atomic<double> FtylogClock::_nsPerTick(0.0);
+std::atomic<uint64_t> FtylogClock::_ticksPerSecond(0);
+
+FtylogClock::Source FtylogClock::setSource(Source source)
+{
+  if ((source == TSC) && !calibrateTsc())
+  {
+    source = REALTIME;
+  }
+  _source.store(source, std::memory_order_relaxed);
+  return source;
+}
+
+FtylogClock::Source FtylogClock::getSource()
+{
+  return (Source) _source.load(std::memory_order_relaxed);
+}
+
+bool FtylogClock::parseSource(const std::string & name, Source & source)
+{
+  if (name == "realtime")
+  {
+    source = REALTIME;
+  }
+  else if (name == "coarse")
+  {
+    source = REALTIME_COARSE;
+  }
+  else if (name == "tsc")
+  {
+    source = TSC;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+log4cplus::helpers::Time FtylogClock::now()
+{
+  struct timespec ts;
+  switch (_source.load(std::memory_order_relaxed))
+  {
+    case REALTIME_COARSE:
+      clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+      break;
+    case TSC:
+      return nowTsc();
+    default:
+      clock_gettime(CLOCK_REALTIME, &ts);
+      break;
+  }
+  return fromTimespec(ts);
+}
+
+log4cplus::helpers::Time FtylogClock::nowTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t tsc = __rdtsc();
+  //Bound the drift from the real time to what the counter gains in a second
+  if (!tscAnchor.valid ||
+      (tsc - tscAnchor.tsc > _ticksPerSecond.load(std::memory_order_relaxed)))
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    tscAnchor.tsc = __rdtsc();
+    tscAnchor.nanoseconds = toNanoseconds(ts);
+    tscAnchor.valid = true;
+    return fromTimespec(ts);
+  }
+  int64_t nanoseconds = tscAnchor.nanoseconds +
+    (int64_t) ((double) (tsc - tscAnchor.tsc) * _nsPerTick.load(std::memory_order_relaxed));
+  return log4cplus::helpers::time_from_parts((time_t) (nanoseconds / 1000000000),
+                                             (long) ((nanoseconds % 1000000000) / 1000));
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return fromTimespec(ts);
+#endif
+}
+
+bool FtylogClock::calibrateTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (_ticksPerSecond.load() != 0)
+  {
+    return true;
+  }
+  //The rate of the counter must not depend on the frequency of the core
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8)))
+  {
+    return false;
+  }
+  //Count the ticks during 10ms
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  uint64_t tscStart = __rdtsc();
+  do
+  {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  }
+  while (toNanoseconds(end) - toNanoseconds(start) < 10000000);
+  uint64_t ticks = __rdtsc() - tscStart;
+  int64_t elapsed = toNanoseconds(end) - toNanoseconds(start);
+  if (ticks == 0)
+  {
+    return false;
+  }
+  double nsPerTick = (double) elapsed / (double) ticks;
+  _nsPerTick.store(nsPerTick);
+  _ticksPerSecond.store((uint64_t) (1e9 / nsPerTick));
+  return true;
+#else
+  return false;
+#endif
+}
+
+////////////////////////
+//FtylogTimestampFormat
+////////////////////////
+
+FtylogTimestampFormat::FtylogTimestampFormat(const std::string & format, bool utc)
+  : _utc(utc)
+{
+  static std::atomic<unsigned long long> ids(0);
+  _id = ++ids;
+
+  //Cut the format after each fraction of a second
+  Part part;
+  part.conversion = '\0';
+  for (size_t i = 0; i < format.size(); i++)
+  {
+    if ((format[i] == '%') && (i + 1 < format.size()))
+    {
+      char conversion = format[i + 1];
+      if ((conversion == 'q') || (conversion == 'Q') || (conversion == 'f'))
+      {
+        part.conversion = conversion;
+        _parts.push_back(part);
+        part.format.clear();
+        part.conversion = '\0';
+      }
+      else
+      {
+        //Also keeps "%%" whole
+        part.format.append(format, i, 2);
+      }
+      i++;
+      continue;
+    }
+    part.format.push_back(format[i]);
+  }
+  if (!part.format.empty() || _parts.empty())
+  {
+    _parts.push_back(part);
+  }
+}
+
+void FtylogTimestampFormat::render(Cache & cache, time_t second) const
+{
+  cache.id = _id;
+  cache.second = second;
+  cache.text.clear();
+  cache.fields.clear();
+
+  struct tm date;
+  if (_utc)
+  {
+    gmtime_r(&second, &date);
+  }
+  else
+  {
+    localtime_r(&second, &date);
+  }
+  char text[256];
+  for (const Part & part : _parts)
+  {
+    if (!part.format.empty())
+    {
+      //strftime() returns 0 for an empty result as for a too small buffer:
+      //add a character to tell them apart
+      std::string format = part.format + " ";
+      size_t length = strftime(text, sizeof(text), format.c_str(), &date);
+      if (length > 0)
+      {
+        cache.text.append(text, length - 1);
+      }
+    }
+    if (part.conversion != '\0')
+    {
+      Field field;
+      field.offset = cache.text.size();
+      field.conversion = part.conversion;
+      cache.fields.push_back(field);
+      cache.text.append((part.conversion == 'Q') ? "000.000" :
+                        (part.conversion == 'f') ? "000000" : "000");
+    }
+  }
+}
+
+void FtylogTimestampFormat::append(std::string & out, const log4cplus::helpers::Time & time) const
+{
+  static thread_local Cache caches[CACHE_SLOTS];
+  time_t second = log4cplus::helpers::to_time_t(time);
+  unsigned long microseconds = (unsigned long) log4cplus::helpers::microseconds_part(time);
+
+  Cache & cache = caches[_id % CACHE_SLOTS];
+  if ((cache.id != _id) || (cache.second != second))
+  {
+    render(cache, second);
+  }
+
+  size_t start = out.size();
+  out.append(cache.text);
+  char * text = &out[start];
+  for (const Field & field : cache.fields)
+  {
+    switch (field.conversion)
+    {
+      case 'q':
+        writeDigits(text + field.offset, microseconds / 1000, 3);
+        break;
+      case 'Q':
+        writeDigits(text + field.offset, microseconds / 1000, 3);
+        writeDigits(text + field.offset + 4, microseconds % 1000, 3);
+        break;
+      default:
+        writeDigits(text + field.offset, microseconds, 6);
+        break;
+    }
+  }
+}
@@ -0,0 +1,126 @@
+/*  =========================================================================
+    fty_log_timestamp - Clock and cached rendering of log timestamps
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_TIMESTAMP_H_INCLUDED
+#define FTY_LOG_TIMESTAMP_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <log4cplus/helpers/timehelper.h>
+
+//  @interface
+
+//Clock giving the time stamps of the log messages the library creates
+//itself (asynchronous mode). The source is chosen for the whole process,
+//with the BIOS_LOG_CLOCK environment variable or setSource().
+class FtylogClock
+{
+public:
+  enum Source
+  {
+    //clock_gettime(CLOCK_REALTIME), through the vDSO
+    REALTIME,
+    //clock_gettime(CLOCK_REALTIME_COARSE): cheaper, resolution of a tick
+    //of the kernel (1 to 10ms)
+    REALTIME_COARSE,
+    //Time stamp counter of the processor, converted with a rate measured
+    //when the source is selected; each thread takes the real time again
+    //every second. Only with an invariant counter on x86, REALTIME otherwise.
+    TSC
+  };
+
+  //Select the source; return the one actually used
+  static Source setSource(Source source);
+  static Source getSource();
+
+  //Source named "realtime", "coarse" or "tsc"; return false for other names
+  static bool parseSource(const std::string & name, Source & source);
+
+  static log4cplus::helpers::Time now();
+
+private:
+  static std::atomic<int> _source;
+  //Nanoseconds per tick of the time stamp counter, and ticks per second
+  static std::atomic<double> _nsPerTick;
+  static std::atomic<uint64_t> _ticksPerSecond;
+
+  static log4cplus::helpers::Time nowTsc();
+  //Measure the rate of the counter; return false if it can not be used
+  static bool calibrateTsc();
+};
+
+//Renders time stamps with a strftime() format. The text of the current
+//second is kept by each thread, only the digits below the second are
+//written for each time stamp; strftime() runs once per second.
+//Besides the conversions of strftime(), the format accepts the ones of
+//log4cplus for the fractions of a second: %q (milliseconds, "mmm") and
+//%Q (milliseconds with microseconds, "mmm.uuu"), and %f (microseconds,
+//"uuuuuu").
+class FtylogTimestampFormat
+{
+private:
+  //Fraction of a second in the rendered text
+  struct Field
+  {
+    size_t offset;
+    char conversion;
+  };
+
+  //Part of the format rendered with strftime(), and the fraction of a
+  //second which follows it (or '\0')
+  struct Part
+  {
+    std::string format;
+    char conversion;
+  };
+
+  //Text of one second, per thread
+  struct Cache
+  {
+    unsigned long long id;
+    time_t second;
+    std::string text;
+    std::vector<Field> fields;
+  };
+
+  //Identifies the format in the caches of the threads
+  unsigned long long _id;
+  std::vector<Part> _parts;
+  bool _utc;
+
+  void render(Cache & cache, time_t second) const;
+
+public:
+  //Number of formats whose current second each thread keeps
+  static const size_t CACHE_SLOTS = 8;
+
+  //utc: render the time in UTC instead of the local time zone
+  FtylogTimestampFormat(const std::string & format, bool utc);
+
+  //Append the text of the time stamp to out
+  void append(std::string & out, const log4cplus::helpers::Time & time) const;
+};
+
+//  @end
+#endif
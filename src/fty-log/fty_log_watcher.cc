@@ -0,0 +1,274 @@
+/*  =========================================================================
+    fty_log_watcher - Watch the log configuration file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_log_watcher - Watch the log configuration file
+@discuss
+    The thread sleeps in poll() on an inotify descriptor watching the
+    directory of the file (and the file itself, to follow symbolic links).
+    Each event about the file restarts a short debounce delay; when it
+    expires, the file is compared with its last known state and onChange
+    is called if it exists and changed. Without inotify, or while the
+    directory is missing, the file is checked periodically instead.
+@end
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <chrono>
+
+#include "fty_common_logging_classes.h"
+
+//Events of the directory which may concern the file
+static const uint32_t DIRECTORY_EVENTS = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB |
+  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+//Events of the file itself (or of the target of a symbolic link)
+static const uint32_t FILE_EVENTS = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB |
+  IN_DELETE_SELF | IN_MOVE_SELF;
+
+FtylogConfigWatcher::FtylogConfigWatcher(const std::string & file,
+                                         std::function<void(const std::string &)> onChange,
+                                         unsigned int pollMillis,
+                                         unsigned int debounceMillis)
+  : _file(file), _onChange(onChange), _pollMillis(pollMillis),
+    _debounceMillis(debounceMillis), _exists(false), _size(0), _inode(0),
+    _directoryWatch(-1), _fileWatch(-1)
+{
+  _mtime.tv_sec = _mtime.tv_nsec = 0;
+  _ctime.tv_sec = _ctime.tv_nsec = 0;
+  size_t slash = _file.rfind('/');
+  if (slash == std::string::npos)
+  {
+    _directory = ".";
+    _name = _file;
+  }
+  else
+  {
+    _directory = (slash == 0) ? "/" : _file.substr(0, slash);
+    _name = _file.substr(slash + 1);
+  }
+
+  if (pipe2(_stopPipe, O_CLOEXEC) != 0)
+  {
+    //The thread could not be stopped
+    _stopPipe[0] = _stopPipe[1] = -1;
+    _inotifyFd = -1;
+    return;
+  }
+  //Watch the directory before recording the state the configuration was
+  //loaded from, so that a change made as soon as the constructor returns
+  //is not missed; the file itself can only be watched once it exists
+  _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  addWatches();
+  checkForFileModification();
+  addWatches();
+  _thread = std::thread(&FtylogConfigWatcher::run, this);
+}
+
+FtylogConfigWatcher::~FtylogConfigWatcher()
+{
+  if (!_thread.joinable())
+  {
+    return;
+  }
+  char stop = 0;
+  while ((write(_stopPipe[1], &stop, 1) < 0) && (errno == EINTR))
+  {
+  }
+  _thread.join();
+  close(_stopPipe[0]);
+  close(_stopPipe[1]);
+  if (_inotifyFd >= 0)
+  {
+    close(_inotifyFd);
+  }
+}
+
+bool FtylogConfigWatcher::checkForFileModification()
+{
+  struct stat fileStat;
+  bool exists = (stat(_file.c_str(), &fileStat) == 0);
+  bool modified = (exists != _exists);
+  if (exists)
+  {
+    //ctime also changes with the permissions, e.g. a file made readable
+    modified = modified
+      || (fileStat.st_mtim.tv_sec != _mtime.tv_sec)
+      || (fileStat.st_mtim.tv_nsec != _mtime.tv_nsec)
+      || (fileStat.st_ctim.tv_sec != _ctime.tv_sec)
+      || (fileStat.st_ctim.tv_nsec != _ctime.tv_nsec)
+      || (fileStat.st_size != _size)
+      || (fileStat.st_ino != _inode);
+    _mtime = fileStat.st_mtim;
+    _ctime = fileStat.st_ctim;
+    _size = fileStat.st_size;
+    _inode = fileStat.st_ino;
+  }
+  _exists = exists;
+  return modified;
+}
+
+bool FtylogConfigWatcher::addWatches()
+{
+  bool added = false;
+  if (_inotifyFd < 0)
+  {
+    return false;
+  }
+  if (_directoryWatch < 0)
+  {
+    _directoryWatch = inotify_add_watch(_inotifyFd, _directory.c_str(), DIRECTORY_EVENTS);
+    added = (_directoryWatch >= 0);
+  }
+  if ((_fileWatch < 0) && _exists)
+  {
+    _fileWatch = inotify_add_watch(_inotifyFd, _file.c_str(), FILE_EVENTS);
+    added = added || (_fileWatch >= 0);
+  }
+  return added;
+}
+
+bool FtylogConfigWatcher::readEvents()
+{
+  bool relevant = false;
+  char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  for (;;)
+  {
+    ssize_t length = read(_inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+      //EAGAIN: no more events
+      break;
+    }
+    for (char * p = buffer; p < buffer + length; )
+    {
+      const struct inotify_event * event = (const struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW)
+      {
+        relevant = true;
+      }
+      else if (event->wd == _fileWatch)
+      {
+        relevant = true;
+        if (event->mask & IN_IGNORED)
+        {
+          _fileWatch = -1;
+        }
+      }
+      else if (event->wd == _directoryWatch)
+      {
+        if (event->mask & IN_IGNORED)
+        {
+          //The directory was removed: poll until it comes back
+          _directoryWatch = -1;
+          relevant = true;
+        }
+        else if ((event->len > 0) && (_name == event->name))
+        {
+          relevant = true;
+        }
+      }
+    }
+  }
+  return relevant;
+}
+
+void FtylogConfigWatcher::run()
+{
+  bool pending = false;
+  std::chrono::steady_clock::time_point deadline;
+
+  for (;;)
+  {
+    //The file may have changed before a watch lost earlier was added again
+    if (addWatches() && !pending)
+    {
+      pending = true;
+      deadline = std::chrono::steady_clock::now();
+    }
+    bool watching = (_directoryWatch >= 0);
+
+    int timeout = -1;
+    if (pending)
+    {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+      //Round up, poll() must not return before the deadline
+      timeout = (remaining >= 0) ? (int) remaining + 1 : 0;
+    }
+    else if (!watching)
+    {
+      timeout = (int) _pollMillis;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = _stopPipe[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = _inotifyFd;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    int r = poll(fds, (_inotifyFd >= 0) ? 2 : 1, timeout);
+    if ((r < 0) && (errno != EINTR))
+    {
+      break;
+    }
+    if (fds[0].revents != 0)
+    {
+      break;
+    }
+
+    if ((fds[1].revents & POLLIN) && readEvents())
+    {
+      //Wait for the end of the burst of writes
+      pending = true;
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_debounceMillis);
+      continue;
+    }
+
+    bool check;
+    if (pending)
+    {
+      check = (std::chrono::steady_clock::now() >= deadline);
+    }
+    else
+    {
+      //Periodic check without inotify
+      check = (!watching && (r == 0));
+    }
+    if (check)
+    {
+      pending = false;
+      //A file being removed is not a new configuration
+      if (checkForFileModification() && _exists)
+      {
+        _onChange(_file);
+      }
+    }
+  }
+}
@@ -0,0 +1,95 @@
+/*  =========================================================================
+    fty_log_watcher - Watch the log configuration file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+#ifndef FTY_LOG_WATCHER_H_INCLUDED
+#define FTY_LOG_WATCHER_H_INCLUDED
+
+#include <sys/types.h>
+#include <time.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+//  @interface
+
+//Thread watching a file with inotify, and calling a function when the file
+//was modified, replaced or created. Unlike log4cplus::ConfigureAndWatchThread,
+//the owner is told about the reload and can update its state after it.
+//The directory of the file is watched, so a file missing at first, or
+//replaced by an editor (write to a temporary file and rename), is seen too.
+class FtylogConfigWatcher
+{
+private:
+  std::string _file;
+  std::string _directory;
+  std::string _name;
+  std::function<void(const std::string &)> _onChange;
+  unsigned int _pollMillis;
+  unsigned int _debounceMillis;
+
+  //Last known state of the file
+  bool _exists;
+  struct timespec _mtime;
+  struct timespec _ctime;
+  off_t _size;
+  ino_t _inode;
+
+  //inotify descriptor and watches, -1 when not available
+  int _inotifyFd;
+  int _directoryWatch;
+  int _fileWatch;
+  //Written by the destructor to stop the thread
+  int _stopPipe[2];
+  std::thread _thread;
+
+  //Update the last known state, return true if it changed
+  bool checkForFileModification();
+  //Add the watches which are missing, return true if one was added
+  bool addWatches();
+  //Read the pending inotify events, return true if one is about the file.
+  //Forget the watches which were removed.
+  bool readEvents();
+  //Body of the watching thread
+  void run();
+
+  FtylogConfigWatcher(const FtylogConfigWatcher&) = delete;
+  FtylogConfigWatcher& operator=(const FtylogConfigWatcher&) = delete;
+
+public:
+  //Time without new event before the file is checked, so that a burst of
+  //writes causes a single reload
+  static const unsigned int DEFAULT_DEBOUNCE_MILLIS = 50;
+  //Period of the checks when inotify can not be used (e.g. the directory
+  //does not exist)
+  static const unsigned int DEFAULT_POLL_MILLIS = 60000;
+
+  //Call onChange(file) from the watching thread each time file is found
+  //modified or created. The path passed is owned by the watcher, so the
+  //owner may change its own copy once the watcher is destroyed.
+  FtylogConfigWatcher(const std::string & file,
+                      std::function<void(const std::string &)> onChange,
+                      unsigned int pollMillis = DEFAULT_POLL_MILLIS,
+                      unsigned int debounceMillis = DEFAULT_DEBOUNCE_MILLIS);
+  ~FtylogConfigWatcher();
+};
+
+//  @end
+#endif
@@ -25,33 +25,161 @@
 @discuss
 @end
  */
+#include <limits.h>
+#include <stddef.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
+#include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <fstream>
 #include <typeinfo>
 #include <thread>
+#include <atomic>
+#include <mutex>
 #include <sstream>
+#include <vector>
+#include <log4cplus/configurator.h>
 #include <log4cplus/hierarchy.h>
+#include <log4cplus/hierarchylocker.h>
 #include <log4cplus/loggingmacros.h>
 #include <log4cplus/loglevel.h>
 #include <log4cplus/consoleappender.h>
 #include <log4cplus/mdc.h>
 
-#include "fty_common_logging_library.h"
+#include "fty_common_logging_classes.h"
 
 using namespace log4cplus::helpers;
 
+namespace
+{
+
+//Logger and level override of the call site the calling thread is logging
+//from, see Ftylog::SiteScope
+thread_local const Ftylog * siteLog = NULL;
+thread_local int siteLevel = 0;
+
+//Time for the statistics of the logging calls
+unsigned long long monotonicNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + (unsigned long long) now.tv_nsec;
+}
+
+//Count a message lost by the calling thread
+void countFormatFailure(FtylogStatsCounters & stats)
+{
+  FtylogStatsCounters::Block & counters = stats.forThisThread();
+  FtylogStatsCounters::add(counters.formatFailures, 1);
+  FtylogStatsCounters::add(counters.dropped, 1);
+}
+
+void countFiltered(FtylogStatsCounters & stats, int level)
+{
+  FtylogStatsCounters::add(stats.forThisThread().filtered[FtylogStatsCounters::levelIndex(level)], 1);
+}
+
+//Configurator getting the loggers and adding the appenders through the
+//lock of the hierarchy, as the configuration thread of log4cplus does:
+//the hierarchy functions would wait for the lock already held
+class LockedConfigurator : public log4cplus::PropertyConfigurator
+{
+private:
+  log4cplus::HierarchyLocker & _lock;
+
+public:
+  LockedConfigurator(const std::string & file, log4cplus::HierarchyLocker & lock)
+    : log4cplus::PropertyConfigurator(LOG4CPLUS_TEXT(file)), _lock(lock)
+  {
+  }
+
+protected:
+  virtual log4cplus::Logger getLogger(const log4cplus::tstring & name)
+  {
+    return _lock.getInstance(name);
+  }
+
+  virtual void addAppender(log4cplus::Logger & logger, log4cplus::SharedAppenderPtr & appender)
+  {
+    _lock.addAppender(logger, appender);
+  }
+};
+
+//Identifier of a new logger, the oldest ones being reused after 2^23
+unsigned int nextLoggerId()
+{
+  static std::atomic<unsigned int> ids(0);
+  unsigned int id;
+  do
+  {
+    id = ids.fetch_add(1, std::memory_order_relaxed) & ((1U << FTYLOG_LOGGER_ID_BITS) - 1);
+  }
+  while (0 == id);
+  return id;
+}
+
+//Initialize log4cplus and register the appenders and layouts of this
+//library which the config files may use, once per process
+void initializeLog4cplus()
+{
+  static std::once_flag initialized;
+  std::call_once(initialized, []()
+  {
+    log4cplus::initialize();
+    FtylogBatchAppender::registerFactory();
+    FtylogRingFileAppender::registerFactory();
+    FtylogCompressedRollingFileAppender::registerFactory();
+    FtylogPreallocatedRollingFileAppender::registerFactory();
+    FtylogJournalAppender::registerFactory();
+    FtylogJsonLayout::registerFactory();
+  });
+}
+
+}
+
 //constructor
 Ftylog::Ftylog(std::string component, std::string configFile)
 {
+  effectiveLevel = log4cplus::TRACE_LOG_LEVEL;
+  levelGeneration = 0;
+  loggerId = nextLoggerId();
   _watchConfigFile = NULL;
+  _asyncMode = false;
+  _deferredFormat = false;
+  _perThreadQueues = false;
+  _backend = NULL;
+  _recorder = NULL;
+  _recordLevel = log4cplus::TRACE_LOG_LEVEL;
+  _loggerLevel = log4cplus::TRACE_LOG_LEVEL;
+  _stats = new FtylogStatsCounters();
+  _statsInterval = 0;
+  _nextStatsLine = 0;
   init(component,configFile);
 }
 
 Ftylog::Ftylog()
 {
+    effectiveLevel = log4cplus::TRACE_LOG_LEVEL;
+    levelGeneration = 0;
+    loggerId = nextLoggerId();
     _watchConfigFile = NULL;
+    _asyncMode = false;
+    _deferredFormat = false;
+    _perThreadQueues = false;
+    _backend = NULL;
+    _recorder = NULL;
+    _recordLevel = log4cplus::TRACE_LOG_LEVEL;
+    _loggerLevel = log4cplus::TRACE_LOG_LEVEL;
+    _stats = new FtylogStatsCounters();
+    _statsInterval = 0;
+    _nextStatsLine = 0;
     std::ostringstream threadId;
     threadId <<  std::this_thread::get_id();
     std::string name = "log-default-" + threadId.str();
@@ -60,22 +188,21 @@ Ftylog::Ftylog()
 
 void Ftylog::init(std::string component, std::string configFile)
 {
-  if (NULL != _watchConfigFile)
-  {
-    delete _watchConfigFile;
-    _watchConfigFile = NULL;
-  }
+  //Pending messages belong to the previous logger
+  stopBackend();
+  stopConfigWatcher();
   _logger.shutdown();
   _agentName = component;
   _configFile = configFile;
   _layoutPattern = LOGPATTERN;
 
   //initialize log4cplus
-  log4cplus::initialize();
+  initializeLog4cplus();
 
   //Create logger
   auto log = log4cplus::Logger::getInstance(LOG4CPLUS_TEXT(component));
   _logger = log;
+  refreshLogLevel();
 
   //Get log level from bios and set to the logger
   //even if there is a log configuration file
@@ -84,20 +211,31 @@ void Ftylog::init(std::string component, std::string configFile)
   //Get pattern layout from env
   setPatternFromEnv();
 
+  //Get the clock of the time stamps from env
+  setClockFromEnv();
+
+  //Get the interval of the statistics line from env
+  setStatsIntervalFromEnv();
+
   //load appenders
   loadAppenders();
+
+  startBackend();
 }
 
 
 //Clean objects in destructor
 Ftylog::~Ftylog()
 {
-  if (NULL != _watchConfigFile)
-  {
-    delete _watchConfigFile;
-    _watchConfigFile = NULL;
-  }
+  stopBackend();
+  stopConfigWatcher();
   _logger.shutdown();
+  delete _recorder;
+  delete _stats;
+  FtylogLevelOverrides::setOwnerRules(this, std::vector<FtylogLevelOverrides::Rule>());
+  //A Ftylog object created later at the same address must not use the
+  //decisions cached by the call sites for this one
+  __atomic_add_fetch(&ftylog_levelGeneration, 1, __ATOMIC_RELEASE);
 }
 
 //getter
@@ -109,6 +247,8 @@ std::string Ftylog::getAgentName()
 //setter
 void Ftylog::setConfigFile(std::string file)
 {
+  //The watching thread must not reload the previous file meanwhile
+  stopConfigWatcher();
   _configFile = file;
   loadAppenders();
 }
@@ -121,9 +261,14 @@ void Ftylog::change(std::string name,std::string configFile)
 //Initialize from environment variables
 void Ftylog::setLogLevelFromEnv()
 {
-  //get BIOS_LOG_LEVEL value and set correction logging level
+  //get BIOS_LOG_LEVEL value and set correction logging level; the
+  //"pattern=LEVEL" entries are overrides for some files or functions
   const char *varEnv = getenv("BIOS_LOG_LEVEL");
-  setLogLevelFromEnv(varEnv ? varEnv : "");
+  std::vector<FtylogLevelOverrides::Rule> rules;
+  std::string level;
+  FtylogLevelOverrides::parse(varEnv ? varEnv : "", rules, level);
+  FtylogLevelOverrides::setEnvironmentRules(rules);
+  setLogLevelFromEnv(level);
 }
 void Ftylog::setPatternFromEnv()
 {
@@ -135,15 +280,58 @@ void Ftylog::setPatternFromEnv()
   }
 }
 
+void Ftylog::setClockFromEnv()
+{
+  //Get BIOS_LOG_CLOCK for the source of the time stamps (the whole process)
+  const char * varEnv = getenv("BIOS_LOG_CLOCK");
+  FtylogClock::Source source;
+  if (varEnv && FtylogClock::parseSource(varEnv, source))
+  {
+    FtylogClock::setSource(source);
+  }
+}
+
+void Ftylog::setStatsIntervalFromEnv()
+{
+  //Get BIOS_LOG_STATS_INTERVAL for the interval of the statistics line
+  const char * varEnv = getenv("BIOS_LOG_STATS_INTERVAL");
+  if (varEnv && !std::string(varEnv).empty())
+  {
+    setStatsInterval((unsigned int) strtoul(varEnv, NULL, 10));
+  }
+}
+
+//Return true if BIOS_LOG_BATCH asks for a batching console appender
+bool Ftylog::isBatchFromEnv()
+{
+  const char * varEnv = getenv("BIOS_LOG_BATCH");
+  if (NULL == varEnv)
+  {
+    return false;
+  }
+  std::string value(varEnv);
+  return !(value.empty() || (value == "0") || (value == "false") ||
+           (value == "no") || (value == "off"));
+}
+
 //Add a simple ConsoleAppender to the logger
 void Ftylog::setConsoleAppender()
 {
   _logger.removeAllAppenders();
   //create appender
   // Note: the first bool argument controls logging to stderr(true) as output stream
-  SharedObjectPtr<log4cplus::Appender> append(new log4cplus::ConsoleAppender(true, true));
+  log4cplus::Appender * console;
+  if (isBatchFromEnv())
+  {
+    console = new FtylogBatchAppender(true);
+  }
+  else
+  {
+    console = new log4cplus::ConsoleAppender(true, true);
+  }
+  SharedObjectPtr<log4cplus::Appender> append(console);
   //Create and affect layout
-  append->setLayout(std::unique_ptr<log4cplus::Layout> (new log4cplus::PatternLayout(_layoutPattern)));
+  append->setLayout(FtylogPatternLayout::create(_layoutPattern, _logger.getName()));
   append.get()->setName(LOG4CPLUS_TEXT("Console" + this->_agentName));
 
   //Add appender to logger
@@ -156,7 +344,9 @@ void Ftylog::removeConsoleAppenders(log4cplus::Logger logger)
   {
     log4cplus::Appender & app = *appenderPtr;
 
-    if (typeid (app) == typeid (log4cplus::ConsoleAppender))
+    if ((typeid (app) == typeid (log4cplus::ConsoleAppender)) ||
+        ((typeid (app) == typeid (FtylogBatchAppender)) &&
+         static_cast<FtylogBatchAppender &>(app).isConsole()))
     {
       //If any, remove it
       logger.removeAppender(appenderPtr);
@@ -191,12 +381,231 @@ void Ftylog::setVeboseMode()
   //create and add the appender
   SharedObjectPtr<log4cplus::Appender> append(new log4cplus::ConsoleAppender(false, true));
   //Create and affect layout
-  append->setLayout(std::unique_ptr<log4cplus::Layout> (new log4cplus::PatternLayout(_layoutPattern)));
+  append->setLayout(FtylogPatternLayout::create(_layoutPattern, _logger.getName()));
   append.get()->setName(LOG4CPLUS_TEXT("Verbose-" + this->_agentName));
   //Add verbose appender to logger
   _logger.addAppender(append);
 }
 
+//Switch the asynchronous mode on or off
+void Ftylog::setAsyncMode(bool asyncMode)
+{
+  _asyncMode = asyncMode;
+  if (_asyncMode)
+  {
+    startBackend();
+  }
+  else
+  {
+    stopBackend();
+  }
+}
+
+bool Ftylog::isAsyncMode()
+{
+  return _asyncMode;
+}
+
+void Ftylog::setDeferredFormatting(bool deferredFormat)
+{
+  _deferredFormat = deferredFormat;
+}
+
+bool Ftylog::isDeferredFormatting()
+{
+  return _deferredFormat;
+}
+
+void Ftylog::setPerThreadQueues(bool perThreadQueues)
+{
+  if (perThreadQueues == _perThreadQueues)
+  {
+    return;
+  }
+  _perThreadQueues = perThreadQueues;
+  //A running backend keeps its queues: start a new one
+  if (NULL != _backend)
+  {
+    stopBackend();
+    startBackend();
+  }
+}
+
+bool Ftylog::isPerThreadQueues()
+{
+  return _perThreadQueues;
+}
+
+void Ftylog::flush()
+{
+  if (NULL != _backend)
+  {
+    _backend->flush();
+  }
+  //Then the messages waiting in the batching appenders
+  for (log4cplus::SharedAppenderPtr & appenderPtr : _logger.getAllAppenders())
+  {
+    FtylogBatchAppender * batch = dynamic_cast<FtylogBatchAppender *>(appenderPtr.get());
+    if (NULL != batch)
+    {
+      batch->flushBatch();
+    }
+    FtylogJournalAppender * journal = dynamic_cast<FtylogJournalAppender *>(appenderPtr.get());
+    if (NULL != journal)
+    {
+      journal->flushBatch();
+    }
+  }
+}
+
+void Ftylog::setFlightRecorder(size_t records, log4cplus::LogLevel triggerLevel,
+                               log4cplus::LogLevel recordLevel)
+{
+  delete _recorder;
+  _recorder = (records > 0) ? new FtylogFlightRecorder(records, triggerLevel) : NULL;
+  _recordLevel = recordLevel;
+  //The macros must let the recorded levels through
+  levelChanged();
+}
+
+void Ftylog::dumpFlightRecorder()
+{
+  if (NULL != _recorder)
+  {
+    //After the messages already queued
+    flush();
+    _recorder->dump(_logger);
+  }
+}
+
+bool Ftylog::triggerFlightRecorder(log4cplus::LogLevel level)
+{
+  if ((NULL == _recorder) || (level < _recorder->triggerLevel()))
+  {
+    return false;
+  }
+  dumpFlightRecorder();
+  return true;
+}
+
+FtylogStats Ftylog::getStats()
+{
+  FtylogStats stats;
+  _stats->get(stats);
+  return stats;
+}
+
+void Ftylog::setStatsInterval(unsigned int seconds)
+{
+  unsigned long long interval = seconds * 1000000000ULL;
+  __atomic_store_n(&_nextStatsLine, monotonicNs() + interval, __ATOMIC_RELAXED);
+  __atomic_store_n(&_statsInterval, interval, __ATOMIC_RELAXED);
+}
+
+std::string Ftylog::formatStats(const FtylogStats & stats)
+{
+  std::ostringstream line;
+  line << "Logging statistics: emitted";
+  for (size_t i = 0; i < FTYLOG_STATS_LEVELS; i++)
+  {
+    line << ((i == 0) ? " " : "/") << stats.emitted[i];
+  }
+  line << ", filtered";
+  for (size_t i = 0; i < FTYLOG_STATS_LEVELS; i++)
+  {
+    line << ((i == 0) ? " " : "/") << stats.filtered[i];
+  }
+  line << " (TRACE/DEBUG/INFO/WARN/ERROR/FATAL), "
+       << stats.bytesFormatted << " bytes formatted, "
+       << stats.formatFailures << " format failures, "
+       << stats.dropped << " dropped, "
+       << stats.suppressed << " suppressed, "
+       << stats.queueFullWaits << " queue full waits, "
+       << stats.calls << " calls";
+  if (stats.calls > 0)
+  {
+    line << ", mean " << stats.latencyTotalNs / stats.calls << " ns";
+    //Bucket holding the 99th percentile
+    unsigned long long threshold = stats.calls - stats.calls / 100;
+    unsigned long long calls = 0;
+    size_t bucket = 0;
+    while (bucket < FTYLOG_STATS_LATENCY_BUCKETS - 1)
+    {
+      calls += stats.latency[bucket];
+      if (calls >= threshold)
+      {
+        break;
+      }
+      bucket++;
+    }
+    if (bucket < FTYLOG_STATS_LATENCY_BUCKETS - 1)
+    {
+      line << ", 99% under " << (256ULL << bucket) << " ns";
+    }
+    else
+    {
+      line << ", more than 1% over " << (256ULL << (bucket - 1)) << " ns";
+    }
+  }
+  return line.str();
+}
+
+void Ftylog::insertStatsLine()
+{
+  std::string line = formatStats(getStats());
+  insertRecord(log4cplus::INFO_LOG_LEVEL, __FILE__, __LINE__, __func__,
+               line.data(), line.size(), NULL);
+}
+
+Ftylog::CallStats::CallStats(Ftylog * log)
+  : _log(log), _begin(monotonicNs())
+{
+}
+
+Ftylog::CallStats::~CallStats()
+{
+  unsigned long long end = monotonicNs();
+  FtylogStatsCounters::addLatency(_log->_stats->forThisThread(), end - _begin);
+  if (__atomic_load_n(&_log->_statsInterval, __ATOMIC_RELAXED) != 0)
+  {
+    //One thread writes the line when it is due
+    unsigned long long next = __atomic_load_n(&_log->_nextStatsLine, __ATOMIC_RELAXED);
+    if ((end >= next) &&
+        __atomic_compare_exchange_n(&_log->_nextStatsLine, &next,
+                                    end + __atomic_load_n(&_log->_statsInterval, __ATOMIC_RELAXED),
+                                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      _log->insertStatsLine();
+    }
+  }
+}
+
+void Ftylog::startBackend()
+{
+  if (_asyncMode && (NULL == _backend))
+  {
+    if (_perThreadQueues)
+    {
+      _backend = new FtylogBackend(_logger, FtylogBackend::DEFAULT_THREAD_QUEUE_SIZE, true,
+                                   _stats);
+    }
+    else
+    {
+      _backend = new FtylogBackend(_logger, FtylogBackend::DEFAULT_QUEUE_SIZE, false, _stats);
+    }
+  }
+}
+
+void Ftylog::stopBackend()
+{
+  if (NULL != _backend)
+  {
+    //The destructor writes the pending messages
+    delete _backend;
+    _backend = NULL;
+  }
+}
+
 void Ftylog::setContext(const std::map<std::string, std::string>& contextParam)
 {
   log4cplus::getMDC().clear();
@@ -204,11 +613,40 @@ void Ftylog::setContext(const std::map<std::string, std::string>& contextParam)
   {
     log4cplus::getMDC().put(entry.first, entry.second);
   }
+  //The entries of the scoped contexts were cleared too
+  FtylogContextStack::forThisThread().invalidateMirror();
 }
 
 void Ftylog::clearContext()
 {
   log4cplus::getMDC().clear();
+  FtylogContextStack::forThisThread().invalidateMirror();
+}
+
+////////////////////////
+//FtylogScopedContext
+////////////////////////
+
+size_t FtylogScopedContext::depth()
+{
+  return FtylogContextStack::forThisThread().size();
+}
+
+void FtylogScopedContext::push(const char* key, const std::string & value)
+{
+  const char * name = (key != NULL) ? key : "";
+  FtylogContextStack::forThisThread().push(name, strlen(name), value.data(), value.size());
+}
+
+void FtylogScopedContext::pop(size_t depth)
+{
+  FtylogContextStack::forThisThread().pop(depth);
+}
+
+std::string & FtylogScopedContext::valueBuffer()
+{
+  static thread_local std::string buffer;
+  return buffer;
 }
 
 //Set appenders from log config file if exist
@@ -239,19 +677,16 @@ void Ftylog::loadAppenders()
     setLogInitLevelFromEnv(varEnvInit);
   }
 
+  //Stop the watch confile file thread if any, before it can see the
+  //appenders change
+  stopConfigWatcher();
+
   //by default, load console appenders
   setConsoleAppender();
 
   //If true, load file
   bool loadFile = false;
 
-  //Stop the watch confile file thread if any
-  if (NULL != _watchConfigFile)
-  {
-    delete _watchConfigFile;
-    _watchConfigFile = NULL;
-  }
-
   //if path to log config file
   if (!_configFile.empty())
   {
@@ -263,8 +698,7 @@ void Ftylog::loadAppenders()
     }
     else
     {
-      log_error_log(this,"File %s can't be accessed with read rights; this process will not monitor whether it becomes available later",_configFile.c_str());
-      _configFile = "";
+      log_error_log(this,"File %s can't be accessed with read rights; it will be loaded when it becomes available",_configFile.c_str());
     }
   }
   else
@@ -284,13 +718,13 @@ void Ftylog::loadAppenders()
 
     if (log4cplus::NOT_SET_LOG_LEVEL != oldLevel)
     {
-      _logger.setLogLevel(oldLevel);
+      setLogLevel(oldLevel);
     }
 
     //Load the file
     log4cplus::PropertyConfigurator::doConfigure(LOG4CPLUS_TEXT(_configFile));
-    //Start the thread watching the modification of the log config file
-    _watchConfigFile = new log4cplus::ConfigureAndWatchThread(_configFile.c_str(), 60000);
+    //The file may define the level of any logger
+    levelChanged();
   }
   else
   {
@@ -298,9 +732,60 @@ void Ftylog::loadAppenders()
         log_info_log(this,"No log configuration file was loaded, will log to stderr by default");
     if (log4cplus::NOT_SET_LOG_LEVEL != oldLevel)
     {
-      _logger.setLogLevel(oldLevel);
+      setLogLevel(oldLevel);
+    }
+  }
+  loadLevelOverrides(loadFile ? _configFile : std::string());
+
+  //Start the thread watching the log config file, which is loaded
+  //as soon as it is created or made readable if it was not yet
+  if (!_configFile.empty())
+  {
+    _watchConfigFile = new FtylogConfigWatcher(_configFile,
+      [this](const std::string & file) { reloadConfigFile(file); });
+  }
+}
+
+void Ftylog::stopConfigWatcher()
+{
+  if (NULL != _watchConfigFile)
+  {
+    delete _watchConfigFile;
+    _watchConfigFile = NULL;
+  }
+}
+
+//Reload the log config file after a modification
+void Ftylog::reloadConfigFile(const std::string & file)
+{
+  //Same as log4cplus::ConfigureAndWatchThread: start from a clean
+  //hierarchy, locked so that the threads logging meanwhile wait for the
+  //new configuration instead of seeing half of it
+  {
+    log4cplus::HierarchyLocker lock(log4cplus::getDefaultHierarchy());
+    lock.resetConfiguration();
+    LockedConfigurator configurator(file, lock);
+    configurator.configure();
+  }
+  levelChanged();
+  loadLevelOverrides(file);
+}
+
+void Ftylog::loadLevelOverrides(const std::string & file)
+{
+  std::vector<FtylogLevelOverrides::Rule> rules;
+  if (!file.empty())
+  {
+    //log4cplus ignores the properties it does not know
+    log4cplus::helpers::Properties properties(LOG4CPLUS_TEXT(file));
+    std::string base;
+    if (!FtylogLevelOverrides::parse(properties.getProperty(LOG4CPLUS_TEXT("ftylog.levels")),
+                                     rules, base))
+    {
+      log_warning_log(this, "Invalid entries in ftylog.levels of %s", file.c_str());
     }
   }
+  FtylogLevelOverrides::setOwnerRules(this, rules);
 }
 
 //Set the logging level corresponding to the BIOS_LOG_LEVEL value
@@ -366,45 +851,105 @@ void Ftylog::setLogLevelFromEnv(const std::string& level)
 }
 
 //Set logger to a specific logging level
+void Ftylog::setLogLevel(log4cplus::LogLevel level)
+{
+  _logger.setLogLevel(level);
+  levelChanged();
+}
+
+void Ftylog::refreshLogLevel()
+{
+  //Read the generation first: a change made meanwhile triggers one more refresh
+  unsigned int generation = __atomic_load_n(&ftylog_levelGeneration, __ATOMIC_ACQUIRE);
+  int loggerLevel = _logger.getLogLevel();
+  __atomic_store_n(&_loggerLevel, loggerLevel, __ATOMIC_RELAXED);
+  if ((NULL != _recorder) && (_recordLevel < loggerLevel))
+  {
+    loggerLevel = _recordLevel;
+  }
+  //The call sites with a lower override check their level themselves
+  int lowestOverride = FtylogLevelOverrides::lowestLevel(this);
+  if ((FtylogLevelOverrides::NO_OVERRIDE != lowestOverride) && (lowestOverride < loggerLevel))
+  {
+    loggerLevel = lowestOverride;
+  }
+  __atomic_store_n(&effectiveLevel, loggerLevel, __ATOMIC_RELAXED);
+  __atomic_store_n(&levelGeneration, generation, __ATOMIC_RELEASE);
+}
+
+bool Ftylog::refreshSite(const FtylogCallSite * site)
+{
+  //Read the generation first: a change made meanwhile triggers one more refresh
+  unsigned int generation = __atomic_load_n(&ftylog_levelGeneration, __ATOMIC_ACQUIRE);
+  int threshold = FtylogLevelOverrides::siteLevel(this, loggerId, site);
+  if (FtylogLevelOverrides::NO_OVERRIDE == threshold)
+  {
+    threshold = _logger.getLogLevel();
+  }
+  if ((NULL != _recorder) && (_recordLevel < threshold))
+  {
+    threshold = _recordLevel;
+  }
+  bool enabled = (site->level >= threshold);
+
+  //The decision is read with the identifier of its logger in one load: a
+  //call with another logger replaces it, and never reads it as its own
+  __atomic_store_n(&site->levelCache->decision,
+                   ((unsigned long long) generation << 32) |
+                   ((unsigned long long) loggerId << 1) | (enabled ? 1 : 0),
+                   __ATOMIC_RELAXED);
+  return enabled;
+}
+
+void Ftylog::levelChanged()
+{
+  __atomic_add_fetch(&ftylog_levelGeneration, 1, __ATOMIC_RELEASE);
+  refreshLogLevel();
+}
+
 void Ftylog::setLogLevelTrace()
 {
-  _logger.setLogLevel(log4cplus::TRACE_LOG_LEVEL);
+  setLogLevel(log4cplus::TRACE_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelDebug()
 {
-  _logger.setLogLevel(log4cplus::DEBUG_LOG_LEVEL);
+  setLogLevel(log4cplus::DEBUG_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelInfo()
 {
-  _logger.setLogLevel(log4cplus::INFO_LOG_LEVEL);
+  setLogLevel(log4cplus::INFO_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelWarning()
 {
-  _logger.setLogLevel(log4cplus::WARN_LOG_LEVEL);
+  setLogLevel(log4cplus::WARN_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelError()
 {
-  _logger.setLogLevel(log4cplus::ERROR_LOG_LEVEL);
+  setLogLevel(log4cplus::ERROR_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelFatal()
 {
-  _logger.setLogLevel(log4cplus::FATAL_LOG_LEVEL);
+  setLogLevel(log4cplus::FATAL_LOG_LEVEL);
 }
 
 void Ftylog::setLogLevelOff()
 {
-  _logger.setLogLevel(log4cplus::OFF_LOG_LEVEL);
+  setLogLevel(log4cplus::OFF_LOG_LEVEL);
 }
 
 //Return true if the logging level is include in the logger log level
 bool Ftylog::isLogLevel(log4cplus::LogLevel level)
 {
-  return _logger.getLogLevel() <= level;
+  //The inline check also lets through the levels for the flight recorder
+  //and the level overrides; the override of the call site being logged
+  //replaces the level of the logger
+  int threshold = (siteLog == this) ? siteLevel : __atomic_load_n(&_loggerLevel, __ATOMIC_RELAXED);
+  return ftylog_isLevelEnabled(this, level) && (threshold <= level);
 }
 
 bool Ftylog::isLogTrace()
@@ -439,67 +984,306 @@ bool Ftylog::isLogFatal()
 
 bool Ftylog::isLogOff()
 {
-  return _logger.getLogLevel() == log4cplus::OFF_LOG_LEVEL;
+  return __atomic_load_n(&_loggerLevel, __ATOMIC_RELAXED) == log4cplus::OFF_LOG_LEVEL;
 }
 
 //Call log4cplus system to print logs in logger appenders
 void Ftylog::insertLog(log4cplus::LogLevel level, const char* file, int line,
                        const char* func, const char* format, va_list args)
 {
-  char *buffer = NULL;
-  int r;
-
-  //Check if the level of this log is included in the log level
-  if (!isLogLevel(level))
+  CallStats callStats(this);
+  //Check if the level of this log is included in the log level,
+  //or is kept by the flight recorder
+  if (!ftylog_isLevelEnabled(this, level))
   {
+    countFiltered(*_stats, level);
     return;
   }
-  //Construct the main log message
-  r = vasprintf(&buffer, format, args);
-  if (r == -1)
+  if (!isLogLevel(level))
   {
-    fprintf(stderr, "[ERROR]: %s:%d (%s) can't allocate enough memory for message string: buffer", __FILE__, __LINE__, __func__);
-    if (buffer)
+    countFiltered(*_stats, level);
+    //Let through by the inline check for the flight recorder, which
+    //formats the message only if it is dumped, or for the level override
+    //of another call site
+    if ((NULL != _recorder) && (level >= _recordLevel))
     {
-      free(buffer);
+      _recorder->record(level, file, line, func, format, args);
     }
     return;
   }
-
-  if (buffer == NULL)
+  //Let the backend thread build the message if the format allows it. The
+  //recorded messages are queued before the message which dumps them.
+  bool dumped = false;
+  if ((NULL != _backend) && _deferredFormat)
+  {
+    dumped = triggerFlightRecorder(level);
+    if (_backend->pushDeferred(level, file, line, func, format, args))
+    {
+      FtylogStatsCounters::add(
+        _stats->forThisThread().emitted[FtylogStatsCounters::levelIndex(level)], 1);
+      return;
+    }
+  }
+  //Construct the main log message in the buffer of this thread
+  FtylogFormatBuffer & buffer = FtylogFormatBuffer::forThisThread();
+  int r = buffer.format(format, args);
+  if (r == -1)
   {
-    log_error_log(this, "Buffer == NULL");
+    countFormatFailure(*_stats);
+    fprintf(stderr, "[ERROR]: %s:%d (%s) can't format message string: %s\n", __FILE__, __LINE__, __func__, format);
     return;
   }
 
-  //Give the printing job to log4cplus
-  log4cplus::detail::macro_forced_log(_logger, level, LOG4CPLUS_TEXT(buffer), file, line, func);
-  free(buffer);
+  insertRecord(level, file, line, func, buffer.data(), (size_t) r, NULL, dumped);
 }
 
-void Ftylog::insertLog(log4cplus::LogLevel level, const char* file, int line,
-                       const char* func, const char* format, ...)
+void Ftylog::insertLogSuppressedV(unsigned long long suppressed, log4cplus::LogLevel level,
+                                  const char* file, int line, const char* func,
+                                  const char* format, va_list args)
 {
-  va_list args;
-  va_start(args, format);
-  insertLog(level,file,line,func,format,args);
-  va_end(args);
+  if (0 == suppressed)
+  {
+    insertLog(level, file, line, func, format, args);
+    return;
+  }
+  CallStats callStats(this);
+  FtylogStatsCounters::add(_stats->forThisThread().suppressed, suppressed);
+  if (!ftylog_isLevelEnabled(this, level))
+  {
+    countFiltered(*_stats, level);
+    return;
+  }
+  FtylogFormatBuffer & buffer = FtylogFormatBuffer::forThisThread();
+  int r = buffer.format(format, args);
+  if (r != -1)
+  {
+    r = buffer.append((size_t) r, " (%llu similar message%s suppressed)",
+                      suppressed, (suppressed > 1) ? "s" : "");
+  }
+  if (r == -1)
+  {
+    countFormatFailure(*_stats);
+    fprintf(stderr, "[ERROR]: %s:%d (%s) can't format message string: %s\n", __FILE__, __LINE__, __func__, format);
+    return;
+  }
+  insertRecord(level, file, line, func, buffer.data(), (size_t) r, NULL);
+}
+
+void Ftylog::insertLogSuppressed(unsigned long long suppressed, log4cplus::LogLevel level,
+                                 const char* file, int line, const char* func,
+                                 const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  insertLogSuppressedV(suppressed, level, file, line, func, format, args);
+  va_end(args);
+}
+
+Ftylog::SiteScope::SiteScope(const Ftylog * log, const FtylogCallSite * site)
+  : _active(false), _enabled(true), _previousLog(NULL), _previousLevel(0)
+{
+  int level = FtylogLevelOverrides::siteLevel(log, log->loggerId, site);
+  if (FtylogLevelOverrides::NO_OVERRIDE != level)
+  {
+    _active = true;
+    _enabled = (site->level >= level);
+    _previousLog = siteLog;
+    _previousLevel = siteLevel;
+    siteLog = log;
+    siteLevel = level;
+  }
+}
+
+Ftylog::SiteScope::~SiteScope()
+{
+  if (_active)
+  {
+    siteLog = _previousLog;
+    siteLevel = _previousLevel;
+  }
+}
+
+void Ftylog::insertLog(const FtylogCallSite* site, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  insertLogV(site, format, args);
+  va_end(args);
+}
+
+void Ftylog::insertLogV(const FtylogCallSite* site, const char* format, va_list args)
+{
+  SiteScope scope(this, site);
+  if (scope.enabled())
+  {
+    insertLog(site->level, site->file, site->line, site->func, format, args);
+  }
+  else
+  {
+    countFiltered(*_stats, site->level);
+  }
+}
+
+void Ftylog::insertLogSuppressed(unsigned long long suppressed, const FtylogCallSite* site,
+                                 const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  insertLogSuppressedV(suppressed, site, format, args);
+  va_end(args);
+}
+
+void Ftylog::insertLogSuppressedV(unsigned long long suppressed, const FtylogCallSite* site,
+                                  const char* format, va_list args)
+{
+  SiteScope scope(this, site);
+  if (scope.enabled())
+  {
+    insertLogSuppressedV(suppressed, site->level, site->file, site->line, site->func, format, args);
+  }
+  else
+  {
+    countFiltered(*_stats, site->level);
+  }
+}
+
+void Ftylog::insertMessage(log4cplus::LogLevel level, const char* file, int line,
+                           const char* func, const char* message, size_t length)
+{
+  CallStats callStats(this);
+  insertRecord(level, file, line, func, message, length, NULL);
+}
+
+void Ftylog::insertStructured(log4cplus::LogLevel level, const char* file, int line,
+                              const char* func, const char* text, size_t textLength,
+                              size_t messageLength, const char* fields, size_t fieldsLength)
+{
+  CallStats callStats(this);
+  FtylogStructured structured;
+  structured.fields = fields;
+  structured.fieldsLength = fieldsLength;
+  structured.messageLength = messageLength;
+  structured.textLength = textLength;
+  insertRecord(level, file, line, func, text, textLength, &structured);
+}
+
+void Ftylog::insertRecord(log4cplus::LogLevel level, const char* file, int line,
+                          const char* func, const char* message, size_t length,
+                          const FtylogStructured * structured, bool dumped)
+{
+  FtylogStatsCounters::Block & counters = _stats->forThisThread();
+  FtylogStatsCounters::add(counters.bytesFormatted, length);
+  if (!isLogLevel(level))
+  {
+    FtylogStatsCounters::add(counters.filtered[FtylogStatsCounters::levelIndex(level)], 1);
+    //Let through by the inline check for the flight recorder or for the
+    //level override of another call site
+    if ((NULL != _recorder) && (level >= _recordLevel))
+    {
+      _recorder->record(level, file, line, func, message, length);
+    }
+    return;
+  }
+  FtylogStatsCounters::add(counters.emitted[FtylogStatsCounters::levelIndex(level)], 1);
+  if (!dumped)
+  {
+    triggerFlightRecorder(level);
+  }
+
+  if (NULL != _backend)
+  {
+    //Hand a copy of the message over to the backend thread
+    _backend->push(level, file, line, func, message, length, structured);
+    return;
+  }
+
+  //Give the printing job to log4cplus; the message is passed as a plain
+  //character string to avoid building a temporary tstring for it.
+  //The JSON layout finds the structured part in the scope, the layouts of
+  //the library find the context in the context scope.
+  FtylogContextStack & stack = FtylogContextStack::forThisThread();
+  stack.mirror();
+  FtylogEventContext::Scope contextScope(stack.snapshot(), log4cplus::getMDC().getContext());
+  FtylogJsonLayout::Scope scope(structured);
+  log4cplus::detail::macro_forced_log(_logger, level,
+    static_cast<const log4cplus::tchar *>(message), file, line, func);
+}
+
+std::string & Ftylog::messageBuffer()
+{
+  static thread_local std::string buffer;
+  return buffer;
+}
+
+std::string & Ftylog::fieldsBuffer()
+{
+  static thread_local std::string buffer;
+  return buffer;
+}
+
+void Ftylog::insertLog(log4cplus::LogLevel level, const char* file, int line,
+                       const char* func, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  insertLog(level,file,line,func,format,args);
+  va_end(args);
 }
 
 ////////////////////////
 //manageftylog section
 ////////////////////////
 
-Ftylog ManageFtyLog::_ftylogdefault = Ftylog("ftylog", FTY_COMMON_LOGGING_DEFAULT_CFG);
+//Not a static member: building it while the library is loaded would
+//initialize log4cplus, read the default config file and start its watcher
+//thread in every process, before main and setInstanceFtylog
+Ftylog & ManageFtyLog::instance(const char * componentName, const char * logConfigFile,
+                                bool * created)
+{
+  struct Instance
+  {
+    Ftylog log;
+    Instance(const char * componentName, const char * logConfigFile, bool * created)
+      : log(componentName, logConfigFile)
+    {
+      if (NULL != created)
+      {
+        *created = true;
+      }
+      __atomic_store_n(&ftylog_defaultInstance, &log, __ATOMIC_RELEASE);
+    }
+    ~Instance()
+    {
+      __atomic_store_n(&ftylog_defaultInstance, (Ftylog *) NULL, __ATOMIC_RELEASE);
+    }
+  };
+  //Destroyed at exit like the other static objects, which flushes the
+  //asynchronous mode
+  static Instance instance(componentName, logConfigFile, created);
+  return instance.log;
+}
 
 Ftylog* ManageFtyLog::getInstanceFtylog()
 {
-  return &_ftylogdefault;
+  return &instance("ftylog", FTY_COMMON_LOGGING_DEFAULT_CFG, NULL);
+}
+
+void ManageFtyLog::setInstanceFtylog(std::string componentName, std::string logConfigFile)
+{
+  //Called first, it builds the instance for the component directly
+  bool created = false;
+  Ftylog & log = instance(componentName.c_str(), logConfigFile.c_str(), &created);
+  if (!created)
+  {
+    log.change(componentName,logConfigFile);
+  }
 }
 
-void ManageFtyLog::setInstanceFtylog(std::string componentName, std::string logConfigFile )
+void ManageFtyLog::setInstanceFtylog(std::string componentName, std::string logConfigFile,
+                                     bool asyncMode)
 {
-  _ftylogdefault.change(componentName,logConfigFile);
+  setInstanceFtylog(componentName, logConfigFile);
+  getInstanceFtylog()->setAsyncMode(asyncMode);
 }
 
 ////////////////////////
@@ -597,12 +1381,130 @@ void ftylog_insertLog(Ftylog * log, int level, const char* file, int line,
   va_end(args);
 }
 
+unsigned int ftylog_levelGeneration = 0;
+
+//ftylog_levelState() reads the state of a logger at its own address.
+//Ftylog is not a standard-layout class (its members have other access
+//controls than the state), so offsetof is only conditionally supported
+//for it: GCC and clang support it, with a warning.
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+static_assert(offsetof(Ftylog, effectiveLevel) == offsetof(FtylogLevelState, effectiveLevel) &&
+              offsetof(Ftylog, levelGeneration) == offsetof(FtylogLevelState, levelGeneration) &&
+              offsetof(Ftylog, loggerId) == offsetof(FtylogLevelState, loggerId),
+              "The level state must be at the address of a Ftylog object");
+#pragma GCC diagnostic pop
+#endif
+
+Ftylog * ftylog_defaultInstance = NULL;
+
+void ftylog_refreshLevel(Ftylog * log)
+{
+  log->refreshLogLevel();
+}
+
+bool ftylog_refreshSite(Ftylog * log, const FtylogCallSite * site)
+{
+  return log->refreshSite(site);
+}
+
+void ftylog_insertLogSuppressed(Ftylog * log, unsigned long long suppressed, int level,
+                                const char* file, int line, const char* func,
+                                const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  log->insertLogSuppressedV(suppressed, level, file, line, func, format, args);
+  va_end(args);
+}
+
+void ftylog_insertLogSite(Ftylog * log, const FtylogCallSite * site, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  log->insertLogV(site, format, args);
+  va_end(args);
+}
+
+void ftylog_insertLogSuppressedSite(Ftylog * log, unsigned long long suppressed,
+                                    const FtylogCallSite * site, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  log->insertLogSuppressedV(suppressed, site, format, args);
+  va_end(args);
+}
+
+bool ftylog_rateLimitPerSecond(FtylogRateLimit * limit, unsigned int perSecond,
+                               unsigned long long * suppressed)
+{
+  //The coarse clock is read without a system call
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  long long second = (long long) now.tv_sec;
+
+  //The first call of a new second starts the window again; calls racing
+  //with it may be counted in either window
+  long long window = __atomic_load_n(&limit->window, __ATOMIC_RELAXED);
+  if ((window != second) &&
+      __atomic_compare_exchange_n(&limit->window, &window, second, false,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+  {
+    __atomic_store_n(&limit->count, 0, __ATOMIC_RELAXED);
+  }
+
+  if (__atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) >= perSecond)
+  {
+    __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  *suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+  return true;
+}
+
 //Switch to verbose mode
 void ftylog_setVeboseMode(Ftylog * log)
 {
   log->setVeboseMode();
 }
 
+//Switch the asynchronous mode
+void ftylog_setAsyncMode(Ftylog * log, bool asyncMode)
+{
+  log->setAsyncMode(asyncMode);
+}
+
+void ftylog_setDeferredFormatting(Ftylog * log, bool deferredFormat)
+{
+  log->setDeferredFormatting(deferredFormat);
+}
+
+void ftylog_setPerThreadQueues(Ftylog * log, bool perThreadQueues)
+{
+  log->setPerThreadQueues(perThreadQueues);
+}
+
+void ftylog_flush(Ftylog * log)
+{
+  log->flush();
+}
+
+void ftylog_setFlightRecorder(Ftylog * log, size_t records, int triggerLevel, int recordLevel)
+{
+  log->setFlightRecorder(records, triggerLevel, recordLevel);
+}
+
+void ftylog_getStats(Ftylog * log, FtylogStats * stats)
+{
+  *stats = log->getStats();
+}
+
+void ftylog_setStatsInterval(Ftylog * log, unsigned int seconds)
+{
+  log->setStatsInterval(seconds);
+}
+
 Ftylog * ftylog_getInstance()
 {
   return ManageFtyLog::getInstanceFtylog();
@@ -613,6 +1515,26 @@ void ftylog_setInstance(const char * component,const char * configFile)
   ManageFtyLog::setInstanceFtylog(std::string(component),std::string(configFile));
 }
 
+//Return true if the deferred formatting gives the same message as vsnprintf
+static bool checkDeferredFormat(const char * format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  va_list copy;
+  va_copy(copy, args);
+  char expected[256];
+  vsnprintf(expected, sizeof(expected), format, copy);
+  va_end(copy);
+  std::string captured, message;
+  bool deferred = FtylogDeferredFormat::capture(format, args, captured);
+  va_end(args);
+  if (deferred)
+  {
+    FtylogDeferredFormat::format(format, captured, message);
+  }
+  return deferred && (message == expected);
+}
+
 //Test function
 void fty_common_log_fty_log_test(bool verbose)
 {
@@ -627,6 +1549,28 @@ void fty_common_log_fty_log_test(bool verbose)
   log_fatal("This is a simple %s log with default logger","fatal");
   printf(" * Check default log : OK \n");
 
+  printf(" * Check default instance \n");
+  {
+    //Built once, setInstanceFtylog changes the same object
+    Ftylog * instance = ManageFtyLog::getInstanceFtylog();
+    assert(instance == ManageFtyLog::getInstanceFtylog());
+    assert(instance->getAgentName() == "ftylog");
+    ManageFtyLog::setInstanceFtylog("fty-log-instance");
+    assert(instance == ManageFtyLog::getInstanceFtylog());
+    assert(instance->getAgentName() == "fty-log-instance");
+    assert(ftylog_getInstance() == instance);
+    assert(ftylog_defaultLogger() == instance);
+
+    //The asynchronous mode only changes when it is given
+    ManageFtyLog::setInstanceFtylog("fty-log-instance", "", true);
+    assert(instance->isAsyncMode());
+    ManageFtyLog::setInstanceFtylog("fty-log-instance");
+    assert(instance->isAsyncMode());
+    ManageFtyLog::setInstanceFtylog("fty-log-instance", "", false);
+    assert(!instance->isAsyncMode());
+  }
+  printf(" * Check default instance : OK \n");
+
 
 
   printf(" * Check level test \n");
@@ -693,6 +1637,68 @@ void fty_common_log_fty_log_test(bool verbose)
   assert(!test->isLogError());
   assert(test->isLogFatal());
 
+  printf(" * Check inline level check \n");
+  {
+    //The macros read the level through the FtylogLevelState base
+    assert((void *) static_cast<FtylogLevelState *>(test) == (void *) test);
+    int evaluated = 0;
+    test->setLogLevelInfo();
+    assert(!ftylog_isLevelEnabled(test, log4cplus::DEBUG_LOG_LEVEL));
+    assert(ftylog_isLevelEnabled(test, log4cplus::INFO_LOG_LEVEL));
+    log_trace_log(test, "This trace log is disabled %d", ++evaluated);
+    log_debug_log(test, "This debug log is disabled %d", ++evaluated);
+    assert(evaluated == 0);
+    log_info_log(test, "This info log is enabled %d", ++evaluated);
+    assert(evaluated == 1);
+    test->setLogLevelOff();
+    assert(test->isLogOff());
+    log_fatal_log(test, "This fatal log is disabled %d", ++evaluated);
+    assert(evaluated == 1);
+
+    //A change made through another object invalidates the cached level
+    Ftylog first("fty-log-shared-logger");
+    Ftylog second("fty-log-shared-logger");
+    first.setLogLevelDebug();
+    assert(ftylog_isLevelEnabled(&second, log4cplus::DEBUG_LOG_LEVEL));
+    unsigned int generation = ftylog_levelGeneration;
+    first.setLogLevelError();
+    assert(ftylog_levelGeneration != generation);
+    assert(!ftylog_isLevelEnabled(&second, log4cplus::DEBUG_LOG_LEVEL));
+    assert(second.isLogError());
+
+    //A call site caches the decision of the last logger used there, the
+    //others take their own
+    Ftylog other("fty-log-other-logger");
+    other.setLogLevelTrace();
+    Ftylog * loggers[2] = { &first, &other };
+    int evaluatedBy[2] = { 0, 0 };
+    for (int round = 0; round < 3; round++)
+    {
+      if (round == 2)
+      {
+        //A level change takes effect at once
+        first.setLogLevelDebug();
+        other.setLogLevelInfo();
+      }
+      for (int i = 0; i < 2; i++)
+      {
+        log_debug_log(loggers[i], "This debug log is cached per call site %d", ++evaluatedBy[i]);
+      }
+    }
+    assert(evaluatedBy[0] == 1);
+    assert(evaluatedBy[1] == 2);
+  }
+  printf(" * Check inline level check : OK \n");
+
+  printf(" * Check statements stripped at compile time \n");
+  {
+    int evaluated = 0;
+    test->setLogLevelTrace();
+    log_macro_stripped(test, "This log is compiled out %d", ++evaluated);
+    assert(evaluated == 0);
+  }
+  printf(" * Check statements stripped at compile time : OK \n");
+
   test->setLogLevelTrace();
   printf(" * Check level test : OK \n");
   printf(" * Check log config file test\n");
@@ -713,6 +1719,1549 @@ void fty_common_log_fty_log_test(bool verbose)
   assert(0 != fileSize);
   printf(" * Check log config file test : OK\n");
 
+  printf(" * Check asynchronous mode \n");
+  {
+    test->setAsyncMode(true);
+    assert(test->isAsyncMode());
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++)
+    {
+      producers.push_back(std::thread([test, t]() {
+        for (int i = 0; i < 250; i++)
+        {
+          log_info_log(test, "This is an async test message %d from producer %d", i, t);
+        }
+      }));
+    }
+    for (auto & producer : producers)
+    {
+      producer.join();
+    }
+    test->flush();
+
+    std::ifstream logFile("./src/selftest-rw/logfile.log");
+    std::string logLine;
+    int asyncLines = 0;
+    while (std::getline(logFile, logLine))
+    {
+      if (logLine.find("async test message") != std::string::npos)
+      {
+        asyncLines++;
+      }
+    }
+    assert(asyncLines == 1000);
+
+    test->setAsyncMode(false);
+    assert(!test->isAsyncMode());
+  }
+  printf(" * Check asynchronous mode : OK \n");
+
+  printf(" * Check per-thread queues \n");
+  {
+    const char * configPath = "./src/selftest-rw/queues-config.conf";
+    const char * queuesPath = "./src/selftest-rw/queues.log";
+    remove(queuesPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-queues-test=INFO, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << queuesPath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%m%n\n";
+    }
+    Ftylog queues("fty-log-queues-test", configPath);
+    queues.setPerThreadQueues(true);
+    queues.setAsyncMode(true);
+    assert(queues.isPerThreadQueues());
+
+    //Two rounds of threads: the queues of the first ones are released when
+    //they exit; more messages than a queue holds
+    const int threads = 8;
+    const int messages = 3000;
+    for (int round = 0; round < 2; round++)
+    {
+      std::vector<std::thread> producers;
+      for (int t = 0; t < threads; t++)
+      {
+        producers.push_back(std::thread([&queues, round, t]() {
+          for (int i = 0; i < messages; i++)
+          {
+            log_info_log(&queues, "%d %d %d", round, t, i);
+          }
+        }));
+      }
+      for (auto & producer : producers)
+      {
+        producer.join();
+      }
+    }
+    log_info_log(&queues, "main thread");
+    queues.flush();
+
+    //Every message once, in the order of each thread
+    std::vector<int> next(2 * threads, 0);
+    std::ifstream logFile(queuesPath);
+    std::string logLine;
+    int count = 0;
+    while (std::getline(logFile, logLine))
+    {
+      if (logLine == "main thread")
+      {
+        continue;
+      }
+      int round, t, i;
+      assert(sscanf(logLine.c_str(), "%d %d %d", &round, &t, &i) == 3);
+      assert(next[round * threads + t] == i);
+      next[round * threads + t]++;
+      count++;
+    }
+    assert(count == 2 * threads * messages);
+
+    queues.setAsyncMode(false);
+    remove(configPath);
+    remove(queuesPath);
+  }
+  printf(" * Check per-thread queues : OK \n");
+
+  printf(" * Check template API \n");
+  {
+    static_assert(FtylogFormat::placeholders("no placeholder") == 0, "");
+    static_assert(FtylogFormat::placeholders("{} of {}") == 2, "");
+    static_assert(FtylogFormat::placeholders("{{}} {{{}}}") == 1, "");
+    static_assert(FtylogFormat::placeholders("{0}") == -1, "");
+    static_assert(FtylogFormat::placeholders("}") == -1, "");
+    //Longer than the constexpr depth limit of the compilers
+#define FTYLOG_TEXT_10(text) text text text text text text text text text text
+    static_assert(FtylogFormat::placeholders(
+                    FTYLOG_TEXT_10(FTYLOG_TEXT_10(FTYLOG_TEXT_10("long text "))) "{}") == 1, "");
+#undef FTYLOG_TEXT_10
+
+    std::string message;
+    FtylogFormat::format(message, "{} of {}", 3, 10u);
+    assert(message == "3 of 10");
+    FtylogFormat::format(message, "{}|{}|{}|{}", INT_MIN, LLONG_MAX, (short) -7, (unsigned char) 200);
+    assert(message == std::to_string(INT_MIN) + "|" + std::to_string(LLONG_MAX) + "|-7|200");
+    FtylogFormat::format(message, "{} {} {} {}", 0.1, 1e300, 2.5f, -0.0);
+    assert(message == "0.1 1e+300 2.5 -0");
+    FtylogFormat::format(message, "{} {} {} {}", true, 'c', std::string("str"), "literal");
+    assert(message == "true c str literal");
+    const char * nullString = NULL;
+    FtylogFormat::format(message, "{} {}", nullString, nullptr);
+    assert(message == "(null) nullptr");
+    FtylogFormat::format(message, "{{{}}} }}{{", 1);
+    assert(message == "{1} }{");
+    //Missing arguments keep their placeholder, extra ones are ignored
+    FtylogFormat::format(message, "{} {}", 1);
+    assert(message == "1 {}");
+    FtylogFormat::format(message, "{}", 1, 2);
+    assert(message == "1");
+
+    //Arguments of disabled messages are not evaluated
+    int evaluated = 0;
+    test->setLogLevelError();
+    log_info_fmt_log(test, "This is a template info log {}", ++evaluated);
+    assert(evaluated == 0);
+    log_error_fmt_log(test, "This is a template error log {}", ++evaluated);
+    assert(evaluated == 1);
+    test->setLogLevelTrace();
+
+    //Through the logger, synchronous and asynchronous
+    test->info("This is a template test message {} of {}", 1, 3);
+    const int memberLine = __LINE__ - 1;
+    log_info_fmt_log(test, "This is a template test message {} of {}", 2, 3);
+    test->setAsyncMode(true);
+    log_info_fmt_log(test, "This is a template test message {} of {}", std::string("3"), 3.0);
+    test->setAsyncMode(false);
+
+    std::ifstream logFile("./src/selftest-rw/logfile.log");
+    std::string logLine;
+    int templateLines = 0;
+    while (std::getline(logFile, logLine))
+    {
+      if (logLine.find("template test message " + std::to_string(templateLines + 1) + " of 3")
+          != std::string::npos)
+      {
+        templateLines++;
+        //The member gives the call site as the macros do
+        if (templateLines == 1)
+        {
+          assert(logLine.find(std::string(__FILE__) + ":" + std::to_string(memberLine))
+                 != std::string::npos);
+        }
+      }
+    }
+    assert(templateLines == 3);
+  }
+  printf(" * Check template API : OK \n");
+
+  printf(" * Check deferred formatting \n");
+  {
+    const char * nullString = NULL;
+    const char notTerminated[3] = { 'a', 'b', 'c' };
+    assert(checkDeferredFormat("no conversion"));
+    assert(checkDeferredFormat("%d %i %u %x %X %o %c %%", -42, 7, 42u, 255u, 255u, 8u, 'z'));
+    assert(checkDeferredFormat("%hhd %hu %ld %lu %lld %llu", 300, 70000, -1L, 2UL, -3LL, 4ULL));
+    assert(checkDeferredFormat("%zu %zd %jd %td", (size_t) 5, (ssize_t) -5, (intmax_t) 6, (ptrdiff_t) -7));
+    assert(checkDeferredFormat("%f %.3e %10.4g %a %Lf", 3.14159, 1e-10, 2.5, 1.0, (long double) 0.1));
+    assert(checkDeferredFormat("%-8s|%8s|%.2s|%s", "left", "right", "truncated", ""));
+    assert(checkDeferredFormat("%*d|%-*.*f|%.*s", 6, 1, 9, 2, 1.5, 3, notTerminated));
+    assert(checkDeferredFormat("%s %p %+05d % d %#x", nullString, (void *) test, 3, 4, 16u));
+    //Formats that must be formatted by the caller
+    int written = 0;
+    assert(!checkDeferredFormat("%d%n", 1, &written));
+    assert(!checkDeferredFormat("%m"));
+    assert(!checkDeferredFormat("%2$s %1$s", "a", "b"));
+    assert(!checkDeferredFormat("%ls", L"wide"));
+
+    //Through the asynchronous backend, with a string changed after the call
+    test->setAsyncMode(true);
+    test->setDeferredFormatting(true);
+    assert(test->isDeferredFormatting());
+    char transient[32];
+    strcpy(transient, "deferred string");
+    log_info_log(test, "This is a deferred test message: %s %d %.2f", transient, 42, 0.125);
+    strcpy(transient, "overwritten");
+    log_info_log(test, "This is a deferred test message: %s", "%s is not in the format");
+    test->flush();
+    test->setDeferredFormatting(false);
+    test->setAsyncMode(false);
+
+    std::ifstream logFile("./src/selftest-rw/logfile.log");
+    std::string logLine;
+    int deferredLines = 0;
+    while (std::getline(logFile, logLine))
+    {
+      if ((logLine.find("deferred test message: deferred string 42 0.12") != std::string::npos) ||
+          (logLine.find("deferred test message: %s is not in the format") != std::string::npos))
+      {
+        deferredLines++;
+      }
+    }
+    assert(deferredLines == 2);
+  }
+  printf(" * Check deferred formatting : OK \n");
+
+  printf(" * Check rate limited macros \n");
+  {
+    int evaluated = 0;
+    for (int i = 0; i < 10; i++)
+    {
+      log_info_every_n_log(test, 3, "This is an every n test message %d", ++evaluated);
+    }
+    //Suppressed calls do not evaluate their arguments
+    assert(evaluated == 4);
+    for (int i = 0; i < 5; i++)
+    {
+      log_info_once_log(test, "This is a once test message %d", ++evaluated);
+    }
+    assert(evaluated == 5);
+    for (int i = 0; i < 100; i++)
+    {
+      log_info_ratelimited_log(test, 5, "This is a rate limited test message %d", ++evaluated);
+    }
+    //The calls may straddle two windows of one second
+    assert((evaluated >= 5 + 5) && (evaluated <= 5 + 10));
+
+    //Calls at a disabled level are not counted
+    evaluated = 0;
+    test->setLogLevelError();
+    for (int i = 0; i < 10; i++)
+    {
+      log_info_once_log(test, "This is a disabled once test message %d", ++evaluated);
+    }
+    test->setLogLevelTrace();
+    assert(evaluated == 0);
+
+    //The counters are shared by the threads
+    std::atomic<int> logged(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+      threads.push_back(std::thread([test, &logged]() {
+        for (int i = 0; i < 1000; i++)
+        {
+          log_info_every_n_log(test, 10, "This is a threaded rate limit message %d", logged++);
+        }
+      }));
+    }
+    for (auto & thread : threads)
+    {
+      thread.join();
+    }
+    assert(logged == 400);
+
+    std::ifstream logFile("./src/selftest-rw/logfile.log");
+    std::string logLine;
+    int everyNLines = 0, reportLines = 0, onceLines = 0;
+    while (std::getline(logFile, logLine))
+    {
+      if (logLine.find("every n test message") != std::string::npos)
+      {
+        everyNLines++;
+        if (logLine.find("(2 similar messages suppressed)") != std::string::npos)
+        {
+          reportLines++;
+        }
+      }
+      if (logLine.find("once test message") != std::string::npos)
+      {
+        onceLines++;
+      }
+    }
+    assert(everyNLines == 4);
+    assert(reportLines == 3);
+    assert(onceLines == 1);
+  }
+  printf(" * Check rate limited macros : OK \n");
+
+  printf(" * Check allocations of the message formatting \n");
+  {
+    //vasprintf used to allocate and free one buffer per message
+    FtylogFormatBuffer & buffer = FtylogFormatBuffer::forThisThread();
+    log_info_log(test, "This is a formatting warm-up %s", "message");
+    unsigned long allocations = buffer.allocations();
+    for (int i = 0; i < 1000; i++)
+    {
+      log_info_log(test, "This is a formatting test message %d with %s", i, "a string");
+    }
+    if (verbose)
+    {
+      printf("   %lu buffer allocations for 1000 messages\n", buffer.allocations() - allocations);
+    }
+    assert(buffer.allocations() == allocations);
+
+    //A longer message grows the buffer once, which is then reused
+    std::string longText(4 * buffer.capacity(), 'x');
+    log_info_log(test, "This is a long message %s", longText.c_str());
+    assert(buffer.allocations() == allocations + 1);
+    log_info_log(test, "This is another long message %s", longText.c_str());
+    assert(buffer.allocations() == allocations + 1);
+    assert(strstr(buffer.data(), longText.c_str()) != NULL);
+  }
+  printf(" * Check allocations of the message formatting : OK \n");
+
+  printf(" * Check config file watcher \n");
+  {
+    const char * configPath = "./src/selftest-rw/watched-config.conf";
+    const char * firstLog = "./src/selftest-rw/watched-first.log";
+    const char * secondLog = "./src/selftest-rw/watched-second.log";
+    remove(configPath);
+    remove(firstLog);
+    remove(secondLog);
+
+    //Write the configuration the way editors do: temporary file and rename
+    auto writeConfig = [configPath](const char * logFile)
+    {
+      std::string tmpPath = std::string(configPath) + ".tmp";
+      std::ofstream config(tmpPath.c_str());
+      config << "log4cplus.logger.fty-log-watch-test=INFO, watched\n"
+             << "log4cplus.appender.watched=log4cplus::FileAppender\n"
+             << "log4cplus.appender.watched.File=" << logFile << "\n"
+             << "log4cplus.appender.watched.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.watched.layout.ConversionPattern=%m%n\n";
+      config.close();
+      assert(rename(tmpPath.c_str(), configPath) == 0);
+    };
+    //Log until the message shows up in the file, or give up after 5s
+    auto waitForLog = [](Ftylog & logger, const char * logFile, const char * message)
+    {
+      for (int i = 0; i < 100; i++)
+      {
+        log_info_log(&logger, "%s", message);
+        std::ifstream logStream(logFile);
+        std::string logLine;
+        while (getline(logStream, logLine))
+        {
+          if (logLine.find(message) != std::string::npos)
+          {
+            return true;
+          }
+        }
+        usleep(50000);
+      }
+      return false;
+    };
+
+    //The file does not exist yet: it is loaded once created
+    Ftylog watched("fty-log-watch-test", configPath);
+    writeConfig(firstLog);
+    assert(waitForLog(watched, firstLog, "watched first message"));
+
+    //A modification is applied without waiting for a polling period
+    writeConfig(secondLog);
+    assert(waitForLog(watched, secondLog, "watched second message"));
+
+    remove(configPath);
+    remove(firstLog);
+    remove(secondLog);
+  }
+  //The reload reset the whole log4cplus configuration
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check config file watcher : OK \n");
+
+  printf(" * Check ring file appender \n");
+  {
+    const char * configPath = "./src/selftest-rw/ring-config.conf";
+    const char * ringPath = "./src/selftest-rw/test.ring";
+    remove(ringPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-ring-test=INFO, ring\n"
+             << "log4cplus.appender.ring=fty::RingFileAppender\n"
+             << "log4cplus.appender.ring.File=" << ringPath << "\n"
+             << "log4cplus.appender.ring.Size=64KB\n"
+             << "log4cplus.appender.ring.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.ring.layout.ConversionPattern=%m%n\n";
+    }
+    std::vector<FtylogRingFileAppender::Record> records;
+    std::string error;
+
+    //Enough messages to wrap around: the newest ones are kept, in order
+    Ftylog * ring = new Ftylog("fty-log-ring-test", configPath);
+    for (int i = 0; i < 5000; i++)
+    {
+      log_info_log(ring, "ring message %d", i);
+    }
+    assert(FtylogRingFileAppender::readRecords(ringPath, records, error));
+    assert(!records.empty() && (records.size() < 5000));
+    for (size_t i = 1; i < records.size(); i++)
+    {
+      assert(records[i].sequence == records[i - 1].sequence + 1);
+    }
+    assert(records.back().message == "ring message 4999\n");
+    std::string first = "ring message " + std::to_string(5000 - records.size()) + "\n";
+    assert(records.front().message == first);
+
+    //The messages of a killed process are still in the file
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0)
+    {
+      log_info_log(ring, "ring message before kill");
+      kill(getpid(), SIGKILL);
+    }
+    int status = 0;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFSIGNALED(status) && (WTERMSIG(status) == SIGKILL));
+    assert(FtylogRingFileAppender::readRecords(ringPath, records, error));
+    assert(records.back().message == "ring message before kill\n");
+    unsigned long long lastSequence = records.back().sequence;
+
+    //A new process continues after the existing records, read through the
+    //public API as fty-log-ring-reader does
+    delete ring;
+    ring = new Ftylog("fty-log-ring-test", configPath);
+    log_info_log(ring, "ring message after restart");
+    assert(ftylog_readRingFile(ringPath, records, error));
+    assert(records.back().message == "ring message after restart\n");
+    assert(records.back().sequence == lastSequence + 1);
+    delete ring;
+
+    assert(!ftylog_readRingFile(configPath, records, error));
+    assert(!error.empty());
+    remove(configPath);
+    remove(ringPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check ring file appender : OK \n");
+
+  printf(" * Check compressed rolling file appender \n");
+  {
+    const char * configPath = "./src/selftest-rw/compress-config.conf";
+    const std::string logPath = "./src/selftest-rw/compressed.log";
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-compress-test=INFO, compressed\n"
+             << "log4cplus.appender.compressed=fty::CompressedRollingFileAppender\n"
+             << "log4cplus.appender.compressed.File=" << logPath << "\n"
+             << "log4cplus.appender.compressed.MaxFileSize=1KB\n"
+             << "log4cplus.appender.compressed.MaxBackupIndex=2\n"
+             << "log4cplus.appender.compressed.QueueSize=64\n"
+             << "log4cplus.appender.compressed.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.compressed.layout.ConversionPattern=%m%n\n";
+    }
+    Ftylog * compressed = new Ftylog("fty-log-compress-test", configPath);
+    FtylogCompressedRollingFileAppender * appender =
+      dynamic_cast<FtylogCompressedRollingFileAppender *>(
+        log4cplus::Logger::getInstance("fty-log-compress-test").getAppender("compressed").get());
+    assert(NULL != appender);
+    std::string written;
+    char line[64];
+    for (int i = 0; i < 200; i++)
+    {
+      snprintf(line, sizeof(line), "compressed message %03d", i);
+      log_info_log(compressed, "%s", line);
+      written += std::string(line) + "\n";
+    }
+    appender->waitForCompression();
+
+    //Two backups are kept, the newest messages are read back in order
+    std::string content, error;
+    assert(FtylogCompressedRollingFileAppender::readCompressed(logPath + ".1.gz", content, error));
+    assert(!content.empty() && (content.size() < 1024 + 32));
+    assert(access((logPath + ".2.gz").c_str(), F_OK) == 0);
+    assert(access((logPath + ".3.gz").c_str(), F_OK) != 0);
+    content.clear();
+    assert(FtylogCompressedRollingFileAppender::readAll(logPath, content, error));
+    assert((content.size() > 2048) && (content.size() < written.size()));
+    assert(written.compare(written.size() - content.size(), content.size(), content) == 0);
+    assert(content.compare(0, 19, "compressed message ") == 0);
+    delete compressed;
+
+    //A rotated file left by a previous process is compressed on start
+    {
+      std::ofstream pending(logPath + ".pending.7");
+      pending << "left over\n";
+    }
+    compressed = new Ftylog("fty-log-compress-test", configPath);
+    appender = dynamic_cast<FtylogCompressedRollingFileAppender *>(
+      log4cplus::Logger::getInstance("fty-log-compress-test").getAppender("compressed").get());
+    assert(NULL != appender);
+    appender->waitForCompression();
+    content.clear();
+    assert(FtylogCompressedRollingFileAppender::readCompressed(logPath + ".1.gz", content, error));
+    assert(content == "left over\n");
+    assert(access((logPath + ".pending.7").c_str(), F_OK) != 0);
+    assert(!FtylogCompressedRollingFileAppender::readCompressed(logPath + ".9.gz", content, error));
+    delete compressed;
+
+    remove(configPath);
+    remove(logPath.c_str());
+    remove((logPath + ".1.gz").c_str());
+    remove((logPath + ".2.gz").c_str());
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check compressed rolling file appender : OK \n");
+
+  printf(" * Check preallocated rolling file appender \n");
+  {
+    const char * configPath = "./src/selftest-rw/prealloc-config.conf";
+    const std::string logPath = "./src/selftest-rw/prealloc.log";
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-prealloc-test=INFO, prealloc\n"
+             << "log4cplus.appender.prealloc=fty::PreallocatedRollingFileAppender\n"
+             << "log4cplus.appender.prealloc.File=" << logPath << "\n"
+             << "log4cplus.appender.prealloc.MaxFileSize=1KB\n"
+             << "log4cplus.appender.prealloc.MaxBackupIndex=2\n"
+             << "log4cplus.appender.prealloc.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.prealloc.layout.ConversionPattern=%m%n\n";
+    }
+    auto readFile = [](const std::string & path)
+    {
+      std::ifstream file(path);
+      std::stringstream content;
+      content << file.rdbuf();
+      return content.str();
+    };
+    Ftylog * prealloc = new Ftylog("fty-log-prealloc-test", configPath);
+    FtylogPreallocatedRollingFileAppender * appender =
+      dynamic_cast<FtylogPreallocatedRollingFileAppender *>(
+        log4cplus::Logger::getInstance("fty-log-prealloc-test").getAppender("prealloc").get());
+    assert(NULL != appender);
+    appender->waitForHelper();
+    assert(access((logPath + ".next").c_str(), F_OK) == 0);
+    std::string written;
+    char line[64];
+    for (int i = 0; i < 200; i++)
+    {
+      snprintf(line, sizeof(line), "prealloc message %03d", i);
+      log_info_log(prealloc, "%s", line);
+      written += std::string(line) + "\n";
+      appender->waitForHelper();
+    }
+    assert(appender->lateRotations() == 0);
+
+    //The backups are cut at MaxFileSize, the newest messages kept in order
+    std::string backup2 = readFile(logPath + ".2");
+    std::string backup1 = readFile(logPath + ".1");
+    std::string current = readFile(logPath);
+    assert((backup2.size() >= 1024) && (backup2.size() < 1024 + 32));
+    assert((backup1.size() >= 1024) && (backup1.size() < 1024 + 32));
+    assert(access((logPath + ".3").c_str(), F_OK) != 0);
+    std::string content = backup2 + backup1 + current;
+    assert(written.compare(written.size() - content.size(), content.size(), content) == 0);
+    delete prealloc;
+    //Closed with the appender, which may outlive the Ftylog object
+    log4cplus::Logger::getInstance("fty-log-prealloc-test").removeAllAppenders();
+    assert(access((logPath + ".next").c_str(), F_OK) != 0);
+
+    //Messages left in File.next by a previous process become the file
+    {
+      std::ofstream next(logPath + ".next");
+      next << "left over\n";
+    }
+    prealloc = new Ftylog("fty-log-prealloc-test", configPath);
+    assert(readFile(logPath + ".1") == current);
+    assert(readFile(logPath + ".2") == backup1);
+    log_info_log(prealloc, "after restart");
+    assert(readFile(logPath) == "left over\nafter restart\n");
+    delete prealloc;
+    log4cplus::Logger::getInstance("fty-log-prealloc-test").removeAllAppenders();
+
+    remove(configPath);
+    remove(logPath.c_str());
+    remove((logPath + ".1").c_str());
+    remove((logPath + ".2").c_str());
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check preallocated rolling file appender : OK \n");
+
+  printf(" * Check flight recorder \n");
+  {
+    test->setLogLevelInfo();
+    test->setFlightRecorder(4);
+    //The macros let DEBUG through for the recorder, the logger does not
+    assert(ftylog_isLevelEnabled(test, log4cplus::DEBUG_LOG_LEVEL));
+    assert(!test->isLogDebug());
+    for (int i = 0; i < 10; i++)
+    {
+      log_debug_log(test, "flight recorder message %d", i);
+    }
+    log_info_log(test, "flight recorder info");
+    log_error_log(test, "flight recorder first error");
+    log_error_log(test, "flight recorder second error");
+    test->setFlightRecorder(0);
+    assert(!ftylog_isLevelEnabled(test, log4cplus::DEBUG_LOG_LEVEL));
+
+    //Only the last 4 messages are written, once, before the first error
+    std::ifstream logFile("./src/selftest-rw/logfile.log");
+    std::string logLine;
+    std::vector<std::string> lines;
+    while (getline(logFile, logLine))
+    {
+      if (logLine.find("flight recorder") != std::string::npos)
+      {
+        lines.push_back(logLine);
+      }
+    }
+    assert(lines.size() == 7);
+    assert(lines[0].find("flight recorder info") != std::string::npos);
+    for (int i = 0; i < 4; i++)
+    {
+      assert(lines[1 + i].find("[DEBUG]") != std::string::npos);
+      assert(lines[1 + i].find("flight recorder message " + std::to_string(6 + i)) != std::string::npos);
+    }
+    assert(lines[5].find("flight recorder first error") != std::string::npos);
+    assert(lines[6].find("flight recorder second error") != std::string::npos);
+
+    //Each thread keeps its last messages, formatted when they are written
+    //from the arguments copied by the call
+    ftylog_setFlightRecorder(test, 2, log4cplus::ERROR_LOG_LEVEL, log4cplus::DEBUG_LOG_LEVEL);
+    assert(!ftylog_isLevelEnabled(test, log4cplus::TRACE_LOG_LEVEL));
+    char transient[32];
+    strcpy(transient, "first value");
+    log_debug_log(test, "flight recorder deferred %s %d", transient, 1);
+    strcpy(transient, "second value");
+    std::thread producer([test]()
+      {
+        for (int i = 0; i < 4; i++)
+        {
+          log_debug_log(test, "flight recorder thread %d", i);
+        }
+      });
+    producer.join();
+    log_debug_log(test, "flight recorder deferred %s %d", transient, 2);
+    log_error_log(test, "flight recorder third error");
+    test->setFlightRecorder(0);
+
+    logFile.close();
+    logFile.open("./src/selftest-rw/logfile.log");
+    lines.clear();
+    while (getline(logFile, logLine))
+    {
+      if (logLine.find("flight recorder") != std::string::npos)
+      {
+        lines.push_back(logLine);
+      }
+    }
+    assert(lines.size() == 12);
+    assert(lines[7].find("flight recorder deferred first value 1") != std::string::npos);
+    assert(lines[8].find("flight recorder thread 2") != std::string::npos);
+    assert(lines[9].find("flight recorder thread 3") != std::string::npos);
+    assert(lines[10].find("flight recorder deferred second value 2") != std::string::npos);
+    assert(lines[11].find("flight recorder third error") != std::string::npos);
+
+    //An error formatted by the backend thread dumps the recorder too
+    test->setFlightRecorder(2);
+    test->setAsyncMode(true);
+    test->setDeferredFormatting(true);
+    log_debug_log(test, "flight recorder async %d", 1);
+    log_error_log(test, "flight recorder async error %d", 2);
+    test->setDeferredFormatting(false);
+    test->setAsyncMode(false);
+    test->setFlightRecorder(0);
+
+    logFile.close();
+    logFile.open("./src/selftest-rw/logfile.log");
+    lines.clear();
+    while (getline(logFile, logLine))
+    {
+      if (logLine.find("flight recorder") != std::string::npos)
+      {
+        lines.push_back(logLine);
+      }
+    }
+    assert(lines.size() == 14);
+    assert(lines[12].find("flight recorder async 1") != std::string::npos);
+    assert(lines[13].find("flight recorder async error 2") != std::string::npos);
+
+    //A new thread takes over the ring of a thread which exited
+    FtylogFlightRecorder recorder(1, log4cplus::ERROR_LOG_LEVEL);
+    for (int i = 0; i < 3; i++)
+    {
+      std::thread([&recorder]()
+        {
+          recorder.record(log4cplus::DEBUG_LOG_LEVEL, __FILE__, __LINE__, __func__,
+                          "flight recorder churn", 21);
+        }).join();
+      assert(recorder.size() == 1);
+    }
+
+    //Past MAX_RINGS threads running at once, the rings are shared
+    FtylogFlightRecorder shared(1, log4cplus::ERROR_LOG_LEVEL);
+    std::atomic<size_t> recorded(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < FtylogFlightRecorder::MAX_RINGS + 4; i++)
+    {
+      threads.emplace_back([&shared, &recorded]()
+        {
+          shared.record(log4cplus::DEBUG_LOG_LEVEL, __FILE__, __LINE__, __func__,
+                        "flight recorder shared", 22);
+          recorded++;
+          while (recorded < FtylogFlightRecorder::MAX_RINGS + 4)
+          {
+            std::this_thread::yield();
+          }
+        });
+    }
+    for (std::thread & thread : threads)
+    {
+      thread.join();
+    }
+    assert(shared.size() == FtylogFlightRecorder::MAX_RINGS);
+  }
+  printf(" * Check flight recorder : OK \n");
+
+  printf(" * Check batch appender \n");
+  {
+    const char * configPath = "./src/selftest-rw/batch-config.conf";
+    const char * batchPath = "./src/selftest-rw/batch.log";
+    remove(batchPath);
+    {
+      std::ofstream config(configPath);
+      //Logger name and maximum age of its messages
+      std::vector<std::pair<std::string, int>> loggers =
+        { { "fty-log-batch-test", 60000 }, { "fty-log-batch-age", 50 } };
+      for (const std::pair<std::string, int> & logger : loggers)
+      {
+        std::string appender = "log4cplus.appender." + logger.first;
+        config << "log4cplus.logger." << logger.first << "=INFO, " << logger.first << "\n"
+               << appender << "=fty::BatchAppender\n"
+               << appender << ".File=" << batchPath << "\n"
+               << appender << ".MaxAge=" << logger.second << "\n"
+               << appender << ".layout=log4cplus::PatternLayout\n"
+               << appender << ".layout.ConversionPattern=%m%n\n";
+      }
+    }
+    auto countLines = [batchPath](const char * text)
+    {
+      std::ifstream logFile(batchPath);
+      std::string logLine;
+      int count = 0;
+      while (getline(logFile, logLine))
+      {
+        if (logLine.find(text) != std::string::npos)
+        {
+          count++;
+        }
+      }
+      return count;
+    };
+
+    //Messages are kept until a message of the flush level
+    Ftylog batch("fty-log-batch-test", configPath);
+    for (int i = 0; i < 10; i++)
+    {
+      log_info_log(&batch, "batch message %d", i);
+    }
+    assert(countLines("batch message") == 0);
+    log_error_log(&batch, "batch error");
+    assert(countLines("batch message") == 10);
+    assert(countLines("batch error") == 1);
+
+    //Or until flush()
+    log_info_log(&batch, "batch flushed message");
+    assert(countLines("batch flushed message") == 0);
+    batch.flush();
+    assert(countLines("batch flushed message") == 1);
+
+    //Or until the oldest message is too old
+    Ftylog age("fty-log-batch-age", configPath);
+    log_info_log(&age, "batch old message");
+    bool written = false;
+    for (int i = 0; (i < 100) && !written; i++)
+    {
+      usleep(10000);
+      written = (countLines("batch old message") == 1);
+    }
+    assert(written);
+
+    remove(configPath);
+    remove(batchPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check batch appender : OK \n");
+
+  printf(" * Check journal appender \n");
+  {
+    const char * configPath = "./src/selftest-rw/journal-config.conf";
+    const char * socketPath = "./src/selftest-rw/journal.socket";
+    remove(socketPath);
+    //Stand-in for the socket of journald
+    int journalFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    assert(journalFd >= 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    assert(bind(journalFd, (struct sockaddr *) &address, sizeof(address)) == 0);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-journal-test=INFO, journal\n"
+             << "log4cplus.appender.journal=fty::JournalAppender\n"
+             << "log4cplus.appender.journal.SocketPath=" << socketPath << "\n"
+             << "log4cplus.appender.journal.SyslogIdentifier=fty-log-test\n"
+             << "log4cplus.appender.journal.MaxAge=60000\n";
+    }
+    //Next record received, read from the memfd passed for a large one
+    std::vector<char> buffer(1024 * 1024);
+    auto receive = [&]()
+    {
+      union
+      {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+      } control;
+      struct iovec iov = { buffer.data(), buffer.size() };
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1;
+      message.msg_control = control.buffer;
+      message.msg_controllen = sizeof(control.buffer);
+      ssize_t size = recvmsg(journalFd, &message, MSG_DONTWAIT);
+      if (size < 0)
+      {
+        return std::string("<none>");
+      }
+      struct cmsghdr * header = CMSG_FIRSTHDR(&message);
+      if ((NULL == header) || (header->cmsg_type != SCM_RIGHTS))
+      {
+        return std::string(buffer.data(), size);
+      }
+      int memfd;
+      memcpy(&memfd, CMSG_DATA(header), sizeof(int));
+      std::string record;
+      while ((size = pread(memfd, buffer.data(), buffer.size(), record.size())) > 0)
+      {
+        record.append(buffer.data(), size);
+      }
+      close(memfd);
+      return record;
+    };
+
+    Ftylog journal("fty-log-journal-test", configPath);
+    Ftylog::setContext({ { "asset", "ups-1" }, { "request-id", "42" } });
+    log_info_log(&journal, "journal message %d", 1);
+    log_debug_log(&journal, "journal debug");
+    //Kept until a message of the flush level, then sent together
+    assert(receive() == "<none>");
+    log_error_log(&journal, "journal first line\nsecond line");
+    std::string record = receive();
+    assert(record.compare(0, 26, "MESSAGE=journal message 1\n") == 0);
+    assert(record.find("\nPRIORITY=6\n") != std::string::npos);
+    assert(record.find("\nSYSLOG_IDENTIFIER=fty-log-test\n") != std::string::npos);
+    assert(record.find("\nCODE_FILE=") != std::string::npos);
+    assert(record.find("\nCODE_LINE=") != std::string::npos);
+    assert(record.find("\nCODE_FUNC=fty_common_log_fty_log_test\n") != std::string::npos);
+    assert(record.find("\nASSET=ups-1\n") != std::string::npos);
+    assert(record.find("\nREQUEST_ID=42\n") != std::string::npos);
+
+    //A value with a new line is sent with its size
+    record = receive();
+    std::string multiline = "journal first line\nsecond line";
+    uint64_t size;
+    assert(record.compare(0, 8, "MESSAGE\n") == 0);
+    memcpy(&size, record.data() + 8, sizeof(size));
+    assert(le64toh(size) == multiline.size());
+    assert(record.compare(16, multiline.size() + 1, multiline + "\n") == 0);
+    assert(record.find("\nPRIORITY=3\n") != std::string::npos);
+    assert(receive() == "<none>");
+    Ftylog::clearContext();
+
+    //flush() sends the pending records, a large one through a memfd (or
+    //drops it without memfd_create())
+    std::string large(512 * 1024, 'x');
+    log_info_log(&journal, "%s", large.c_str());
+    assert(receive() == "<none>");
+    journal.flush();
+#if defined (HAVE_MEMFD_CREATE) && defined (F_ADD_SEALS)
+    record = receive();
+    assert(record.compare(0, large.size() + 9, "MESSAGE=" + large + "\n") == 0);
+    assert(record.find("\nASSET=") == std::string::npos);
+#else
+    assert(receive() == "<none>");
+#endif
+
+    close(journalFd);
+    remove(socketPath);
+    remove(configPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check journal appender : OK \n");
+
+  printf(" * Check structured logging \n");
+  {
+    //Escaping, across and inside the blocks of the scan
+    std::string json;
+    std::string text = "0123456789\"bcdefgh\\jklmnop\x01qrstuvwxyz\n\t\xc3\xa9";
+    ftylog_jsonString(json, text.data(), text.size());
+    assert(json == "\"0123456789\\\"bcdefgh\\\\jklmnop\\u0001qrstuvwxyz\\n\\t\xc3\xa9\"");
+    json.clear();
+    ftylog_jsonValue(json, (const char *) NULL);
+    json.push_back(',');
+    ftylog_jsonValue(json, (double) NAN);
+    json.push_back(',');
+    ftylog_jsonValue(json, -42);
+    assert(json == "null,\"nan\",-42");
+
+    const char * configPath = "./src/selftest-rw/kv-config.conf";
+    const char * jsonPath = "./src/selftest-rw/kv.json";
+    const char * textPath = "./src/selftest-rw/kv.log";
+    remove(jsonPath);
+    remove(textPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-kv-test=INFO, json, text\n"
+             << "log4cplus.appender.json=log4cplus::FileAppender\n"
+             << "log4cplus.appender.json.File=" << jsonPath << "\n"
+             << "log4cplus.appender.json.layout=fty::JsonLayout\n"
+             << "log4cplus.appender.text=log4cplus::FileAppender\n"
+             << "log4cplus.appender.text.File=" << textPath << "\n"
+             << "log4cplus.appender.text.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.text.layout.ConversionPattern=%m%n\n";
+    }
+    auto readLines = [](const char * path)
+    {
+      std::ifstream logFile(path);
+      std::vector<std::string> lines;
+      std::string logLine;
+      while (getline(logFile, logLine))
+      {
+        lines.push_back(logLine);
+      }
+      return lines;
+    };
+
+    Ftylog kv("fty-log-kv-test", configPath);
+    Ftylog::setContext({ { "user", "admin" } });
+    for (int i = 0; i < 2; i++)
+    {
+      log_info_kv_log(&kv, "Power changed", "asset", "ups-1", "power", 1250.5,
+                      "phases", i + 1, "on", true, "note", std::string("\"quoted\""));
+    }
+    Ftylog::clearContext();
+    log_debug_kv_log(&kv, "Filtered out", "asset", "ups-1");
+    log_info_log(&kv, "Plain %s", "message");
+    kv.setAsyncMode(true);
+    log_warning_kv_log(&kv, "Queued", "count", 3u);
+    kv.flush();
+    kv.setAsyncMode(false);
+
+    std::vector<std::string> lines = readLines(jsonPath);
+    assert(lines.size() == 4);
+    for (const std::string & line : lines)
+    {
+      assert(line.compare(0, 14, "{\"timestamp\":\"") == 0);
+      assert(line.back() == '}');
+      assert(line.find("\"logger\":\"fty-log-kv-test\"") != std::string::npos);
+    }
+    assert(lines[0].find("\"level\":\"INFO\"") != std::string::npos);
+    assert(lines[0].find("\"func\":\"fty_common_log_fty_log_test\"") != std::string::npos);
+    assert(lines[0].find("\"message\":\"Power changed\",\"context\":{\"user\":\"admin\"},"
+                         "\"asset\":\"ups-1\",\"power\":1250.5,\"phases\":1,\"on\":true,"
+                         "\"note\":\"\\\"quoted\\\"\"}") != std::string::npos);
+    assert(lines[1].find("\"phases\":2,") != std::string::npos);
+    assert(lines[2].find("\"message\":\"Plain message\"}") != std::string::npos);
+    assert(lines[3].find("\"message\":\"Queued\",\"count\":3}") != std::string::npos);
+
+    //Text layouts print the pairs after the message
+    lines = readLines(textPath);
+    assert(lines.size() == 4);
+    assert(lines[0] == "Power changed asset=ups-1 power=1250.5 phases=1 on=true note=\"quoted\"");
+    assert(lines[3] == "Queued count=3");
+
+    remove(configPath);
+    remove(jsonPath);
+    remove(textPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check structured logging : OK \n");
+
+  printf(" * Check scoped context \n");
+  {
+    const char * configPath = "./src/selftest-rw/context-config.conf";
+    const char * contextPath = "./src/selftest-rw/context.log";
+    remove(contextPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-context-test=INFO, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << contextPath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%X{request}|%X{user}|%m%n\n";
+    }
+
+    Ftylog context("fty-log-context-test", configPath);
+    for (int request = 1; request <= 2; request++)
+    {
+      FtylogScopedContext requestContext("request", request);
+      log_info_log(&context, "start");
+      {
+        FtylogScopedContext userContext("user", "admin", "request", "inner");
+        log_info_log(&context, "nested");
+      }
+      log_info_log(&context, "end");
+    }
+    log_info_log(&context, "outside");
+
+    //setContext() replaces the MDC, the scoped entries come back
+    {
+      FtylogScopedContext requestContext("request", 3);
+      Ftylog::setContext({ { "user", "set" } });
+      log_info_log(&context, "set");
+      Ftylog::clearContext();
+      log_info_log(&context, "cleared");
+    }
+
+    //A scoped key hides the value set by setContext() until the end of the scope
+    Ftylog::setContext({ { "user", "set" } });
+    {
+      FtylogScopedContext userContext("user", "scoped");
+      log_info_log(&context, "hidden");
+    }
+    log_info_log(&context, "restored");
+    Ftylog::clearContext();
+
+    //The backend thread gets the context of the producer
+    context.setAsyncMode(true);
+    {
+      FtylogScopedContext requestContext("request", 4.5);
+      log_info_log(&context, "queued");
+    }
+    context.flush();
+    context.setAsyncMode(false);
+
+    std::vector<std::string> expected =
+      { "1||start", "inner|admin|nested", "1||end", "2||start", "inner|admin|nested", "2||end",
+        "||outside", "3|set|set", "3||cleared", "|scoped|hidden", "|set|restored",
+        "4.5||queued" };
+    std::ifstream logFile(contextPath);
+    std::string logLine;
+    size_t count = 0;
+    while (getline(logFile, logLine))
+    {
+      assert(count < expected.size());
+      assert(logLine == expected[count]);
+      count++;
+    }
+    assert(count == expected.size());
+
+    //The layouts of the library read a snapshot of the entries, shared by
+    //the messages logged while they do not change
+    FtylogContextStack & stack = FtylogContextStack::forThisThread();
+    assert(stack.snapshot() == NULL);
+    {
+      FtylogScopedContext requestContext("request", 5);
+      std::shared_ptr<const FtylogContextSnapshot> queued = stack.shareSnapshot();
+      assert(stack.snapshot() == queued.get());
+      unsigned long long serial = queued->serial();
+      const FtylogContextSnapshot * nested = NULL;
+      {
+        //A snapshot held by a queued message is not modified
+        FtylogScopedContext userContext("user", "admin", "request", "inner");
+        nested = stack.snapshot();
+        assert(nested != queued.get());
+        assert(queued->serial() == serial);
+        std::string text;
+        nested->forEach([&text](const char * key, size_t keyLength, const char * value,
+                                size_t valueLength)
+        {
+          text.append(key, keyLength).append("=").append(value, valueLength).append(";");
+        });
+        assert(text == "request=inner;user=admin;");
+
+        log4cplus::MappedDiagnosticContextMap mdc;
+        mdc["user"] = "hidden";
+        mdc["other"] = "mdc";
+        log4cplus::spi::InternalLoggingEvent event("fty-log-context-test", log4cplus::INFO_LOG_LEVEL,
+                                                   "", log4cplus::MappedDiagnosticContextMap(),
+                                                   "message", "1", "1",
+                                                   log4cplus::helpers::time_from_parts(0, 0),
+                                                   "file.cc", 1, "function");
+        std::unique_ptr<log4cplus::Layout> layout =
+          FtylogPatternLayout::create("%X{request}|%X{user}|%X{other}|%m", "fty-log-context-test");
+        log4cplus::tostringstream output;
+        {
+          FtylogEventContext::Scope scope(nested, mdc);
+          layout->formatAndAppend(output, event);
+          text.clear();
+          FtylogEventContext::forEach(event, [&text](const char * key, size_t keyLength,
+                                                     const char * value, size_t valueLength)
+          {
+            text.append(key, keyLength).append("=").append(value, valueLength).append(";");
+          });
+          assert(text == "other=mdc;request=inner;user=admin;");
+        }
+        assert(output.str() == "inner|admin|mdc|message");
+        assert(FtylogEventContext::current() == NULL);
+      }
+      //Released, the snapshot object is rebuilt in place
+      queued.reset();
+      assert(stack.snapshot() == nested);
+      assert(nested->serial() != serial);
+      size_t length = 0;
+      const char * value = nested->find("request", 7, length);
+      assert((value != NULL) && (std::string(value, length) == "5"));
+      assert(nested->find("user", 4, length) == NULL);
+    }
+    assert(stack.snapshot() == NULL);
+
+    remove(configPath);
+    remove(contextPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check scoped context : OK \n");
+
+  printf(" * Check timestamps \n");
+  {
+    //Same text as strftime() with the fractions of a second added
+    time_t second = 1500000000;
+    struct tm local;
+    localtime_r(&second, &local);
+    char text[64];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    FtylogTimestampFormat localFormat("%Y-%m-%d %H:%M:%S,%q", false);
+    std::string out("prefix ");
+    localFormat.append(out, log4cplus::helpers::time_from_parts(second, 7890));
+    assert(out == std::string("prefix ") + text + ",007");
+    //Same second, from the cache
+    out.clear();
+    localFormat.append(out, log4cplus::helpers::time_from_parts(second, 999999));
+    assert(out == std::string(text) + ",999");
+
+    FtylogTimestampFormat utcFormat("%Y-%m-%dT%H:%M:%S.%fZ", true);
+    out.clear();
+    utcFormat.append(out, log4cplus::helpers::time_from_parts(second, 42));
+    assert(out == "2017-07-14T02:40:00.000042Z");
+    //Next second, the formats do not share their cache
+    out.clear();
+    utcFormat.append(out, log4cplus::helpers::time_from_parts(second + 1, 123456));
+    assert(out == "2017-07-14T02:40:01.123456Z");
+    out.clear();
+    localFormat.append(out, log4cplus::helpers::time_from_parts(second, 1000));
+    assert(out == std::string(text) + ",001");
+
+    FtylogTimestampFormat otherFormat("%Q %%q %H", true);
+    out.clear();
+    otherFormat.append(out, log4cplus::helpers::time_from_parts(second, 12345));
+    assert(out == "012.345 %q 02");
+
+    //The cheaper sources stay close to the system clock
+    FtylogClock::Source sources[] = { FtylogClock::REALTIME_COARSE, FtylogClock::TSC };
+    for (FtylogClock::Source source : sources)
+    {
+      FtylogClock::Source used = FtylogClock::setSource(source);
+      assert((used == source) || (used == FtylogClock::REALTIME));
+      assert(FtylogClock::getSource() == used);
+      for (int i = 0; i < 1000; i++)
+      {
+        log4cplus::helpers::Time clockTime = FtylogClock::now();
+        log4cplus::helpers::Time systemTime = log4cplus::helpers::now();
+        long long drift = std::chrono::duration_cast<std::chrono::milliseconds>(
+          systemTime - clockTime).count();
+        assert((drift > -50) && (drift < 50));
+      }
+    }
+    FtylogClock::Source source;
+    assert(FtylogClock::parseSource("coarse", source) && (source == FtylogClock::REALTIME_COARSE));
+    assert(!FtylogClock::parseSource("sundial", source));
+    FtylogClock::setSource(FtylogClock::REALTIME);
+  }
+  printf(" * Check timestamps : OK \n");
+
+  printf(" * Check pattern layout \n");
+  {
+    log4cplus::MappedDiagnosticContextMap mdc;
+    mdc["request"] = "42";
+    log4cplus::helpers::Time time = log4cplus::helpers::time_from_parts(1500000000, 123456);
+    std::vector<log4cplus::spi::InternalLoggingEvent> events;
+    events.push_back(log4cplus::spi::InternalLoggingEvent("fty-log-pattern-test", log4cplus::INFO_LOG_LEVEL,
+                                                          "", mdc, "message", "1234", "worker",
+                                                          time, "src/file.cc", 42, "function"));
+    events.push_back(log4cplus::spi::InternalLoggingEvent("other.logger", log4cplus::ERROR_LOG_LEVEL,
+                                                          "", mdc, "other message", "5678", "",
+                                                          time, "file.cc", 0, ""));
+    events.push_back(log4cplus::spi::InternalLoggingEvent("fty-log-pattern-test", 25000,
+                                                          "", log4cplus::MappedDiagnosticContextMap(),
+                                                          "", "1", "1", time, "f", 7));
+
+    //Supported patterns give the same text as log4cplus
+    std::vector<std::string> patterns =
+      { LOGPATTERN, "%m", "%c [%t/%T] %-5p %5p %.3p %3.8c %-25c|%M %F:%L %l %X{request}|%X{none}%n",
+        "%d{%Y-%m-%d %H:%M:%S,%q} %D{%d.%m.%y %H%M%S.%Q} %-30d{%H:%M} 100%% {%t}%n", "%-10.40m|%.4m|%10m|" };
+    for (const std::string & pattern : patterns)
+    {
+      std::unique_ptr<log4cplus::Layout> layout = FtylogPatternLayout::create(pattern, "fty-log-pattern-test");
+      assert(typeid(*layout) == typeid(FtylogPatternLayout));
+      log4cplus::PatternLayout reference(pattern);
+      for (const log4cplus::spi::InternalLoggingEvent & event : events)
+      {
+        log4cplus::tostringstream output;
+        log4cplus::tostringstream expected;
+        layout->formatAndAppend(output, event);
+        reference.formatAndAppend(expected, event);
+        assert(output.str() == expected.str());
+      }
+    }
+
+    //Other patterns are left to log4cplus
+    std::vector<std::string> others = { "%c{1} %m", "%d %m", "%x %m", "%r", "%-.m", "%m%" };
+    for (const std::string & pattern : others)
+    {
+      std::unique_ptr<log4cplus::Layout> layout = FtylogPatternLayout::create(pattern, "fty-log-pattern-test");
+      assert(typeid(*layout) == typeid(log4cplus::PatternLayout));
+    }
+  }
+  printf(" * Check pattern layout : OK \n");
+
+  printf(" * Check call site \n");
+  {
+    const char * configPath = "./src/selftest-rw/site-config.conf";
+    const char * sitePath = "./src/selftest-rw/site.log";
+    remove(sitePath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-site-test=INFO, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << sitePath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%p|%l|%M|%m%n\n";
+    }
+
+    //The descriptor is a constant, its parts are computed by the compiler
+    ftylog_call_site(FTY_LOG_LEVEL_WARNING);
+    const int siteLine = __LINE__ - 1;
+    static_assert(ftylog_macro_call_site_.level == FTY_LOG_LEVEL_WARNING, "level of the call site");
+    assert(ftylog_macro_call_site_.line == siteLine);
+    assert(strcmp(ftylog_macro_call_site_.basename, "fty_logger.cc") == 0);
+    assert(strcmp(ftylog_basename("file.cc", "file.cc"), "file.cc") == 0);
+    assert(std::string(ftylog_macro_call_site_.location) ==
+           std::string(__FILE__) + ":" + std::to_string(siteLine));
+
+    Ftylog site("fty-log-site-test", configPath);
+    site.insertLog(&ftylog_macro_call_site_, "warning %d", 1);
+    //A null pointer constant is not taken for a va_list
+    site.insertLog(&ftylog_macro_call_site_, "zero %d", 0);
+    site.insertLogSuppressed(2, &ftylog_macro_call_site_, "suppressed");
+    site.insertLogSuppressed(2, &ftylog_macro_call_site_, "zero %d", 0);
+    site.log(&ftylog_macro_call_site_, "template {}", 3);
+    ftylog_insertLogSite(&site, &ftylog_macro_call_site_, "c %s", "function");
+    int macroLine = __LINE__ + 1;
+    log_info_log(&site, "macro");
+
+    std::string location = std::string(__FILE__) + ":" + std::to_string(siteLine);
+    std::string function = "|fty_common_log_fty_log_test|";
+    std::vector<std::string> expected =
+      { "WARN|" + location + function + "warning 1",
+        "WARN|" + location + function + "zero 0",
+        "WARN|" + location + function + "suppressed (2 similar messages suppressed)",
+        "WARN|" + location + function + "zero 0 (2 similar messages suppressed)",
+        "WARN|" + location + function + "template 3",
+        "WARN|" + location + function + "c function",
+        "INFO|" + std::string(__FILE__) + ":" + std::to_string(macroLine) + function + "macro" };
+    std::ifstream logFile(sitePath);
+    std::string logLine;
+    size_t count = 0;
+    while (getline(logFile, logLine))
+    {
+      assert(count < expected.size());
+      assert(logLine == expected[count]);
+      count++;
+    }
+    assert(count == expected.size());
+
+    remove(configPath);
+    remove(sitePath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check call site : OK \n");
+
+  printf(" * Check level overrides \n");
+  {
+    std::vector<FtylogLevelOverrides::Rule> rules;
+    std::string base;
+    assert(!FtylogLevelOverrides::parse("LOG_INFO, bad=LOG_NOPE, func:x=LOG_DEBUG,src/*.cc=LOG_ERR",
+                                        rules, base));
+    assert(base == "LOG_INFO");
+    assert(rules.size() == 2);
+    assert(rules[0].function && (rules[0].pattern == "x") &&
+           (rules[0].level == log4cplus::DEBUG_LOG_LEVEL));
+    assert(!rules[1].function && (rules[1].pattern == "src/*.cc") &&
+           (rules[1].level == log4cplus::ERROR_LOG_LEVEL));
+
+    const char * configPath = "./src/selftest-rw/levels-config.conf";
+    const char * levelsPath = "./src/selftest-rw/levels.log";
+    remove(levelsPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-levels-test=WARN, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << levelsPath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%p|%m%n\n"
+             << "ftylog.levels=func:operator=LOG_TRACE\n";
+    }
+    const char * savedLevel = getenv("BIOS_LOG_LEVEL");
+    std::string savedValue(savedLevel ? savedLevel : "");
+
+    Ftylog levels("fty-log-levels-test", configPath);
+    //Lambdas are functions named operator()
+    auto traceFromLambda = [&levels](int round) { log_trace_log(&levels, "trace %d", round); };
+    for (int round = 0; round < 3; round++)
+    {
+      //The rules of BIOS_LOG_LEVEL come first, the results cached by the
+      //call sites are replaced
+      if (round == 1)
+      {
+        setenv("BIOS_LOG_LEVEL", "LOG_WARNING,fty_logger.cc=LOG_ERR", 1);
+        Ftylog environment("fty-log-levels-env");
+      }
+      else if (round == 2)
+      {
+        unsetenv("BIOS_LOG_LEVEL");
+        Ftylog environment("fty-log-levels-env");
+      }
+      log_debug_log(&levels, "debug %d", round);
+      log_warning_log(&levels, "warning %d", round);
+      log_error_fmt_log(&levels, "error {}", round);
+      traceFromLambda(round);
+    }
+
+    //Matched once, then cached by the call site
+    {
+      ftylog_call_site(FTY_LOG_LEVEL_TRACE);
+      assert(ftylog_macro_site_level_.cached == 0);
+      assert(FtylogLevelOverrides::siteLevel(&levels, levels.loggerId,
+                                             &ftylog_macro_call_site_) ==
+             FtylogLevelOverrides::NO_OVERRIDE);
+      assert(ftylog_macro_site_level_.cached != 0);
+      assert(FtylogLevelOverrides::siteLevel(&levels, levels.loggerId,
+                                             &ftylog_macro_call_site_) ==
+             FtylogLevelOverrides::NO_OVERRIDE);
+      auto lambdaSite = []() -> const FtylogCallSite *
+      {
+        ftylog_call_site(FTY_LOG_LEVEL_TRACE);
+        return &ftylog_macro_call_site_;
+      };
+      assert(FtylogLevelOverrides::siteLevel(&levels, levels.loggerId, lambdaSite()) ==
+             log4cplus::TRACE_LOG_LEVEL);
+      //The rules of the configuration file of levels are its own
+      assert(FtylogLevelOverrides::siteLevel(test, test->loggerId, lambdaSite()) ==
+             FtylogLevelOverrides::NO_OVERRIDE);
+      assert(FtylogLevelOverrides::lowestLevel(&levels) == log4cplus::TRACE_LOG_LEVEL);
+      assert(FtylogLevelOverrides::lowestLevel(test) == FtylogLevelOverrides::NO_OVERRIDE);
+    }
+
+    std::vector<std::string> expected =
+      { "WARN|warning 0", "ERROR|error 0", "TRACE|trace 0",
+        "ERROR|error 1",
+        "WARN|warning 2", "ERROR|error 2", "TRACE|trace 2" };
+    std::ifstream logFile(levelsPath);
+    std::string logLine;
+    size_t count = 0;
+    while (getline(logFile, logLine))
+    {
+      assert(count < expected.size());
+      assert(logLine == expected[count]);
+      count++;
+    }
+    assert(count == expected.size());
+
+    //Two loggers at one call site, each with the overrides of its own
+    //configuration file
+    const char * otherConfigPath = "./src/selftest-rw/levels-other-config.conf";
+    const char * otherPath = "./src/selftest-rw/levels-other.log";
+    {
+      std::ofstream config(otherConfigPath);
+      config << "log4cplus.logger.fty-log-levels-other=TRACE, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << otherPath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%p|%m%n\n"
+             << "ftylog.levels=func:operator=LOG_ERR\n";
+    }
+    Ftylog other("fty-log-levels-other", otherConfigPath);
+    auto sharedSite = [](Ftylog * log, int & evaluated)
+    {
+      log_debug_log(log, "shared call site %d", ++evaluated);
+    };
+    int evaluatedBy[2] = { 0, 0 };
+    for (int round = 0; round < 2; round++)
+    {
+      //Enabled by the rule of levels, disabled by the rule of other
+      sharedSite(&levels, evaluatedBy[0]);
+      sharedSite(&other, evaluatedBy[1]);
+    }
+    assert(evaluatedBy[0] == 2);
+    assert(evaluatedBy[1] == 0);
+
+    if (!savedValue.empty())
+    {
+      setenv("BIOS_LOG_LEVEL", savedValue.c_str(), 1);
+    }
+    remove(configPath);
+    remove(levelsPath);
+    remove(otherConfigPath);
+    remove(otherPath);
+  }
+  test->setConfigFile("./src/selftest-ro/test-config.conf");
+  printf(" * Check level overrides : OK \n");
+
+  printf(" * Check statistics \n");
+  {
+    const char * configPath = "./src/selftest-rw/stats-config.conf";
+    const char * statsPath = "./src/selftest-rw/stats.log";
+    remove(statsPath);
+    {
+      std::ofstream config(configPath);
+      config << "log4cplus.logger.fty-log-stats-test=INFO, file\n"
+             << "log4cplus.appender.file=log4cplus::FileAppender\n"
+             << "log4cplus.appender.file.File=" << statsPath << "\n"
+             << "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+             << "log4cplus.appender.file.layout.ConversionPattern=%p|%m%n\n";
+    }
+    Ftylog log("fty-log-stats-test", configPath);
+    FtylogStats stats = log.getStats();
+    assert((stats.calls == 0) && (stats.emitted[2] == 0) && (stats.bytesFormatted == 0));
+
+    log_info_log(&log, "info %d", 0);
+    log_info_log(&log, "info %d", 1);
+    //Rejected inline, not counted
+    log_debug_log(&log, "debug %d", 0);
+    //Rejected by the logging function
+    log.insertLog(log4cplus::DEBUG_LOG_LEVEL, __FILE__, __LINE__, __func__, "direct %d", 1);
+    for (int i = 0; i < 4; i++)
+    {
+      log_error_every_n_log(&log, 3, "every %d", i);
+    }
+    log_warning_fmt_log(&log, "fmt {}", 1);
+    //The blocks of the threads which exited are kept
+    std::thread thread([&log]()
+    {
+      for (int i = 0; i < 10; i++)
+      {
+        log_info_log(&log, "thread %d", i);
+      }
+    });
+    thread.join();
+
+    stats = log.getStats();
+    const unsigned long long emitted[FTYLOG_STATS_LEVELS] = { 0, 0, 12, 1, 2, 0 };
+    const unsigned long long filtered[FTYLOG_STATS_LEVELS] = { 0, 1, 0, 0, 0, 0 };
+    for (size_t i = 0; i < FTYLOG_STATS_LEVELS; i++)
+    {
+      assert(stats.emitted[i] == emitted[i]);
+      assert(stats.filtered[i] == filtered[i]);
+    }
+    size_t bytes = strlen("info 0") * 2 + strlen("every 0") +
+                   strlen("every 3 (2 similar messages suppressed)") + strlen("fmt 1") +
+                   strlen("thread 0") * 10;
+    assert(stats.bytesFormatted == bytes);
+    assert((stats.formatFailures == 0) && (stats.dropped == 0) && (stats.queueFullWaits == 0));
+    assert(stats.suppressed == 2);
+    assert(stats.calls == 16);
+    unsigned long long calls = 0;
+    for (size_t i = 0; i < FTYLOG_STATS_LATENCY_BUCKETS; i++)
+    {
+      calls += stats.latency[i];
+    }
+    assert((calls == stats.calls) && (stats.latencyTotalNs > 0));
+    FtylogStats cStats;
+    ftylog_getStats(&log, &cStats);
+    assert((cStats.calls == stats.calls) && (cStats.emitted[2] == stats.emitted[2]));
+
+    //The blocks of the exited threads are retired when another thread
+    //registers its block, and still counted
+    {
+      FtylogStatsCounters counters;
+      for (int i = 0; i < 3; i++)
+      {
+        std::thread([&counters]()
+        {
+          FtylogStatsCounters::add(counters.forThisThread().dropped, 2);
+        }).join();
+      }
+      FtylogStats threadStats;
+      counters.get(threadStats);
+      assert(threadStats.dropped == 6);
+    }
+
+    FtylogStats sample;
+    memset(&sample, 0, sizeof(sample));
+    sample.emitted[2] = 3;
+    sample.filtered[0] = 7;
+    sample.bytesFormatted = 42;
+    sample.suppressed = 1;
+    sample.calls = 100;
+    sample.latency[2] = 99;
+    sample.latency[5] = 1;
+    sample.latencyTotalNs = 100000;
+    assert(Ftylog::formatStats(sample) ==
+           "Logging statistics: emitted 0/0/3/0/0/0, filtered 7/0/0/0/0/0 "
+           "(TRACE/DEBUG/INFO/WARN/ERROR/FATAL), 42 bytes formatted, 0 format failures, "
+           "0 dropped, 1 suppressed, 0 queue full waits, 100 calls, mean 1000 ns, "
+           "99% under 1024 ns");
+
+    //Written by the first call after the interval
+    log.setStatsInterval(1);
+    log_info_log(&log, "before");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    log_info_log(&log, "after");
+    log.setStatsInterval(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    log_info_log(&log, "last");
+
+    std::ifstream logFile(statsPath);
+    std::vector<std::string> lines;
+    std::string logLine;
+    while (getline(logFile, logLine))
+    {
+      lines.push_back(logLine);
+    }
+    assert(lines.size() == 19);
+    assert(lines[15] == "INFO|before");
+    assert(lines[16] == "INFO|after");
+    assert(lines[17].find("INFO|Logging statistics: emitted 0/0/14/1/2/0, filtered 0/1/0/0/0/0 ") == 0);
+    assert(lines[17].find(", 18 calls, mean ") != std::string::npos);
+    assert(lines[18] == "INFO|last");
+
+    remove(configPath);
+    remove(statsPath);
+  }
+  printf(" * Check statistics : OK \n");
+
   printf(" * Check verbose \n");
   test->setVeboseMode();
   log_trace_log(test, "This is a verbose trace log");
@@ -0,0 +1,217 @@
+/*  =========================================================================
+    fty_logger_format - Type-safe formatting of log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_logger_format - Type-safe formatting of log messages
+@discuss
+    Integers are written digit by digit into the message, without going
+    through printf and its format parsing.
+@end
+ */
+
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+template <typename T>
+void appendUnsigned(std::string & out, T value)
+{
+  char digits[std::numeric_limits<T>::digits10 + 2];
+  char * end = digits + sizeof(digits);
+  char * p = end;
+  do
+  {
+    *--p = (char) ('0' + (value % 10));
+    value /= 10;
+  }
+  while (value != 0);
+  out.append(p, end - p);
+}
+
+template <typename T>
+void appendSigned(std::string & out, T value)
+{
+  typedef typename std::make_unsigned<T>::type Unsigned;
+  if (value < 0)
+  {
+    out.push_back('-');
+    //Negate in the unsigned type, which is also right for the minimum value
+    appendUnsigned(out, (Unsigned) (Unsigned(0) - (Unsigned) value));
+  }
+  else
+  {
+    appendUnsigned(out, (Unsigned) value);
+  }
+}
+
+//Print with the smallest precision giving back the same value
+template <typename T>
+void appendFloating(std::string & out, T value, const char * format)
+{
+  char text[64];
+  int r = 0;
+  for (int precision = std::numeric_limits<T>::digits10;
+       precision <= std::numeric_limits<T>::max_digits10; precision++)
+  {
+    r = snprintf(text, sizeof(text), format, precision, value);
+    //Also stop on nan and infinities, which do not compare equal
+    if ((value != value) || ((T) strtold(text, NULL) == value))
+    {
+      break;
+    }
+  }
+  if (r > 0)
+  {
+    out.append(text, ((size_t) r < sizeof(text)) ? (size_t) r : sizeof(text) - 1);
+  }
+}
+
+}
+
+void ftylog_formatValue(std::string & out, bool value)
+{
+  out.append(value ? "true" : "false");
+}
+
+void ftylog_formatValue(std::string & out, char value)
+{
+  out.push_back(value);
+}
+
+void ftylog_formatValue(std::string & out, signed char value)
+{
+  appendSigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, unsigned char value)
+{
+  appendUnsigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, short value)
+{
+  appendSigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, unsigned short value)
+{
+  appendUnsigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, int value)
+{
+  appendSigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, unsigned int value)
+{
+  appendUnsigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, long value)
+{
+  appendSigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, unsigned long value)
+{
+  appendUnsigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, long long value)
+{
+  appendSigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, unsigned long long value)
+{
+  appendUnsigned(out, value);
+}
+
+void ftylog_formatValue(std::string & out, float value)
+{
+  appendFloating(out, value, "%.*g");
+}
+
+void ftylog_formatValue(std::string & out, double value)
+{
+  appendFloating(out, value, "%.*g");
+}
+
+void ftylog_formatValue(std::string & out, long double value)
+{
+  appendFloating(out, value, "%.*Lg");
+}
+
+void ftylog_formatValue(std::string & out, const char * value)
+{
+  out.append((value != NULL) ? value : "(null)");
+}
+
+void ftylog_formatValue(std::string & out, const std::string & value)
+{
+  out.append(value);
+}
+
+void ftylog_formatValue(std::string & out, const void * value)
+{
+  char text[32];
+  int r = snprintf(text, sizeof(text), "%p", value);
+  if (r > 0)
+  {
+    out.append(text, r);
+  }
+}
+
+void ftylog_formatValue(std::string & out, std::nullptr_t value)
+{
+  (void) value;
+  out.append("nullptr");
+}
+
+const char * FtylogFormat::appendText(std::string & out, const char * format)
+{
+  //Jump from brace to brace, the text in between is copied as a whole
+  const char * text = format;
+  for (const char * p = strpbrk(format, "{}"); p != NULL; p = strpbrk(p + 1, "{}"))
+  {
+    if (((p[0] == '{') && (p[1] == '{')) || ((p[0] == '}') && (p[1] == '}')))
+    {
+      //Escaped brace: keep one of the two
+      out.append(text, p + 1 - text);
+      text = ++p + 1;
+    }
+    else if ((p[0] == '{') && (p[1] == '}'))
+    {
+      out.append(text, p - text);
+      return p + 2;
+    }
+  }
+  out.append(text);
+  return NULL;
+}
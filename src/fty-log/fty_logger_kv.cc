@@ -0,0 +1,244 @@
+/*  =========================================================================
+    fty_logger_kv - Structured key/value log messages
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_logger_kv - Structured key/value log messages
+@discuss
+    Strings are scanned eight bytes at a time for the characters which
+    must be escaped in JSON, and copied in runs between them.
+@end
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fty_common_logging_classes.h"
+
+namespace
+{
+
+const uint64_t ONES = 0x0101010101010101ULL;
+const uint64_t HIGHS = 0x8080808080808080ULL;
+
+//True if a byte of word is zero
+inline bool hasZeroByte(uint64_t word)
+{
+  return ((word - ONES) & ~word & HIGHS) != 0;
+}
+
+//True if one of the eight bytes of text is a control character, a quote
+//or a backslash. Bytes of UTF-8 sequences (0x80 and above) never match.
+inline bool needsEscape(const char * text)
+{
+  uint64_t word;
+  memcpy(&word, text, sizeof(word));
+  bool control = ((word - ONES * 0x20) & ~word & HIGHS) != 0;
+  return control || hasZeroByte(word ^ (ONES * '"')) || hasZeroByte(word ^ (ONES * '\\'));
+}
+
+inline bool needsEscape(char c)
+{
+  return ((unsigned char) c < 0x20) || (c == '"') || (c == '\\');
+}
+
+void appendEscaped(std::string & out, char c)
+{
+  switch (c)
+  {
+    case '"':  out.append("\\\""); break;
+    case '\\': out.append("\\\\"); break;
+    case '\n': out.append("\\n"); break;
+    case '\r': out.append("\\r"); break;
+    case '\t': out.append("\\t"); break;
+    case '\b': out.append("\\b"); break;
+    case '\f': out.append("\\f"); break;
+    default:
+    {
+      static const char hex[] = "0123456789abcdef";
+      char text[6] = { '\\', 'u', '0', '0', hex[(c >> 4) & 0x0f], hex[c & 0x0f] };
+      out.append(text, sizeof(text));
+      break;
+    }
+  }
+}
+
+template <typename T>
+void appendFloating(std::string & out, T value)
+{
+  if (isfinite(value))
+  {
+    ftylog_formatValue(out, value);
+  }
+  else
+  {
+    out.push_back('"');
+    ftylog_formatValue(out, value);
+    out.push_back('"');
+  }
+}
+
+}
+
+void ftylog_jsonString(std::string & out, const char * text, size_t length)
+{
+  out.push_back('"');
+  size_t start = 0;
+  size_t i = 0;
+  while (i < length)
+  {
+    //Skip the blocks of eight characters which need no escape
+    while ((i + 8 <= length) && !needsEscape(text + i))
+    {
+      i += 8;
+    }
+    size_t end = (i + 8 <= length) ? i + 8 : length;
+    for (; i < end; i++)
+    {
+      if (needsEscape(text[i]))
+      {
+        out.append(text + start, i - start);
+        appendEscaped(out, text[i]);
+        start = i + 1;
+      }
+    }
+  }
+  out.append(text + start, length - start);
+  out.push_back('"');
+}
+
+void ftylog_jsonValue(std::string & out, bool value)
+{
+  out.append(value ? "true" : "false");
+}
+
+void ftylog_jsonValue(std::string & out, char value)
+{
+  ftylog_jsonString(out, &value, 1);
+}
+
+void ftylog_jsonValue(std::string & out, signed char value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, unsigned char value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, short value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, unsigned short value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, int value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, unsigned int value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, long value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, unsigned long value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, long long value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, unsigned long long value)
+{
+  ftylog_formatValue(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, float value)
+{
+  appendFloating(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, double value)
+{
+  appendFloating(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, long double value)
+{
+  appendFloating(out, value);
+}
+
+void ftylog_jsonValue(std::string & out, const char * value)
+{
+  if (value == NULL)
+  {
+    out.append("null");
+    return;
+  }
+  ftylog_jsonString(out, value, strlen(value));
+}
+
+void ftylog_jsonValue(std::string & out, const std::string & value)
+{
+  ftylog_jsonString(out, value.data(), value.size());
+}
+
+void ftylog_jsonValue(std::string & out, const void * value)
+{
+  out.push_back('"');
+  ftylog_formatValue(out, value);
+  out.push_back('"');
+}
+
+void ftylog_jsonValue(std::string & out, std::nullptr_t value)
+{
+  (void) value;
+  out.append("null");
+}
+
+void FtylogKvSite::addKey(const char * key, size_t length)
+{
+  std::string text(" ");
+  text.append(key, length);
+  text.push_back('=');
+  _textKeys.push_back(text);
+
+  std::string json;
+  ftylog_jsonString(json, key, length);
+  json.push_back(':');
+  _jsonKeys.push_back(json);
+}
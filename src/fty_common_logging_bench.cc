@@ -0,0 +1,947 @@
+/*  =========================================================================
+    fty_common_logging_bench - Benchmark of the logging hot path
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty_common_logging_bench - Benchmark of the logging hot path
+@discuss
+    Runs each scenario with 1 to 64 threads and prints, as JSON, the time
+    and the number of heap allocations per logging call, and the total
+    throughput. Console output goes to /dev/null while measuring, so the
+    JSON report can be read from stdout (or written with --output).
+    The rolling file scenarios also time each call, to show the latency
+    percentiles across the rotations of the file.
+    The startup scenarios run the program again in new processes, and
+    measure the time from the fork to the first line on the console.
+
+    Usage: fty_common_logging_bench [--iterations N] [--threads 1,2,4]
+                                    [--startup-runs N] [--scenario NAME]...
+                                    [--output FILE]
+@end
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <log4cplus/logger.h>
+#include <log4cplus/nullappender.h>
+
+#include "fty_common_logging_classes.h"
+
+////////////////////////
+//Allocation counter
+////////////////////////
+
+//Every heap allocation of the process goes through these definitions,
+//operator new (aligned or not) included. They count the call and forward
+//it to the next definition, the one of the C library, found with dlsym().
+static std::atomic<unsigned long long> s_allocations(0);
+
+namespace
+{
+struct Allocators
+{
+  void * (*malloc)(size_t size);
+  void * (*calloc)(size_t count, size_t size);
+  void * (*realloc)(void * ptr, size_t size);
+  void * (*reallocarray)(void * ptr, size_t count, size_t size);
+  void * (*aligned_alloc)(size_t alignment, size_t size);
+  int (*posix_memalign)(void ** ptr, size_t alignment, size_t size);
+  void * (*memalign)(size_t alignment, size_t size);
+  void * (*valloc)(size_t size);
+  void * (*pvalloc)(size_t size);
+  void (*free)(void * ptr);
+};
+
+//dlsym() may allocate memory: while it runs, the allocations are served
+//from this buffer, which is never freed
+alignas(max_align_t) char s_bootstrap[16384];
+size_t s_bootstrapUsed = 0;
+bool s_resolving = false;
+
+void * bootstrapAlloc(size_t size)
+{
+  size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+  if (size > sizeof(s_bootstrap) - s_bootstrapUsed)
+  {
+    return NULL;
+  }
+  void * ptr = s_bootstrap + s_bootstrapUsed;
+  s_bootstrapUsed += size;
+  return ptr;
+}
+
+bool isBootstrap(void * ptr)
+{
+  return (ptr >= (void *) s_bootstrap) && (ptr < (void *) (s_bootstrap + sizeof(s_bootstrap)));
+}
+
+template <typename Function>
+void resolve(Function & function, const char * name)
+{
+  function = reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+}
+
+//Resolved on the first allocation, which happens before main() and so
+//before the threads are started
+const Allocators & next()
+{
+  static Allocators allocators;
+  if ((allocators.free == NULL) && !s_resolving)
+  {
+    s_resolving = true;
+    resolve(allocators.malloc, "malloc");
+    resolve(allocators.calloc, "calloc");
+    resolve(allocators.realloc, "realloc");
+    resolve(allocators.reallocarray, "reallocarray");
+    resolve(allocators.aligned_alloc, "aligned_alloc");
+    resolve(allocators.posix_memalign, "posix_memalign");
+    resolve(allocators.memalign, "memalign");
+    resolve(allocators.valloc, "valloc");
+    resolve(allocators.pvalloc, "pvalloc");
+    resolve(allocators.free, "free");
+    s_resolving = false;
+  }
+  return allocators;
+}
+
+void countAllocation()
+{
+  s_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+}
+
+extern "C"
+{
+void * malloc(size_t size)
+{
+  if (s_resolving)
+  {
+    return bootstrapAlloc(size);
+  }
+  countAllocation();
+  return next().malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+  if (s_resolving)
+  {
+    //The buffer is zeroed and never reused
+    return ((size != 0) && (count > SIZE_MAX / size)) ? NULL : bootstrapAlloc(count * size);
+  }
+  countAllocation();
+  return next().calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+  if (s_resolving || isBootstrap(ptr))
+  {
+    //The old size is unknown: copy what the buffer may hold
+    void * newPtr = s_resolving ? bootstrapAlloc(size) : malloc(size);
+    if (newPtr != NULL)
+    {
+      size_t available = s_bootstrap + sizeof(s_bootstrap) - (char *) ptr;
+      memcpy(newPtr, ptr, std::min(size, available));
+    }
+    return newPtr;
+  }
+  countAllocation();
+  return next().realloc(ptr, size);
+}
+
+void * reallocarray(void * ptr, size_t count, size_t size)
+{
+  if ((size != 0) && (count > SIZE_MAX / size))
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, count * size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+  countAllocation();
+  return next().aligned_alloc(alignment, size);
+}
+
+int posix_memalign(void ** ptr, size_t alignment, size_t size)
+{
+  countAllocation();
+  return next().posix_memalign(ptr, alignment, size);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+  countAllocation();
+  return next().memalign(alignment, size);
+}
+
+void * valloc(size_t size)
+{
+  countAllocation();
+  return next().valloc(size);
+}
+
+void * pvalloc(size_t size)
+{
+  countAllocation();
+  return next().pvalloc(size);
+}
+
+void free(void * ptr)
+{
+  if (!isBootstrap(ptr))
+  {
+    next().free(ptr);
+  }
+}
+}
+
+////////////////////////
+//Scenarios
+////////////////////////
+
+struct Scenario
+{
+  const char * name;
+  const char * description;
+  //Create the logger of the scenario, in the directory given
+  std::function<Ftylog * (const std::string &)> setUp;
+  //Called once in each thread before measuring
+  std::function<void ()> setUpThread;
+  //One logging call
+  std::function<void (Ftylog *, int)> call;
+  //Time each call for the latency percentiles
+  bool latency;
+};
+
+//Replace the appenders of a logger with an appender which drops everything
+static void useNullSink(Ftylog * log, const char * name)
+{
+  log4cplus::Logger logger = log4cplus::Logger::getInstance(LOG4CPLUS_TEXT(name));
+  logger.removeAllAppenders();
+  log4cplus::SharedAppenderPtr sink(new log4cplus::NullAppender());
+  logger.addAppender(sink);
+  log->setLogLevelTrace();
+}
+
+static Ftylog * createFileLogger(const std::string & dir, const char * name,
+                                 const char * appender = "log4cplus::FileAppender",
+                                 const char * properties = "")
+{
+  std::string config = dir + "/" + name + ".conf";
+  FILE * file = fopen(config.c_str(), "w");
+  if (NULL == file)
+  {
+    perror(config.c_str());
+    exit(EXIT_FAILURE);
+  }
+  fprintf(file,
+    "log4cplus.logger.%s=TRACE, file\n"
+    "log4cplus.appender.file=%s\n"
+    "log4cplus.appender.file.File=%s/%s.log\n"
+    "%s"
+    "log4cplus.appender.file.layout=log4cplus::PatternLayout\n"
+    "log4cplus.appender.file.layout.ConversionPattern=%s\n",
+    name, appender, dir.c_str(), name, properties, "%c [%t] -%-5p- %M (%l) %m%n");
+  fclose(file);
+
+  Ftylog * log = new Ftylog(name);
+  log->setConfigFile(config);
+  log->setLogLevelTrace();
+  return log;
+}
+
+static std::vector<Scenario> scenarios()
+{
+  std::vector<Scenario> list;
+  auto noThreadSetUp = []() {};
+
+  list.push_back({ "disabled", "log_debug_log with the level set to ERROR",
+    [](const std::string &) {
+      Ftylog * log = new Ftylog("bench-disabled");
+      log->setLogLevelError();
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_debug_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "null_sink", "log_info_log to an appender dropping the events",
+    [](const std::string &) {
+      Ftylog * log = new Ftylog("bench-null");
+      useNullSink(log, "bench-null");
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "null_sink_fmt", "log_info_fmt_log to an appender dropping the events",
+    [](const std::string &) {
+      Ftylog * log = new Ftylog("bench-null-fmt");
+      useNullSink(log, "bench-null-fmt");
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_fmt_log(log, "Processed metric {} value {} ({})", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "console", "log_info_log to the console with the default pattern",
+    [](const std::string &) {
+      Ftylog * log = new Ftylog("bench-console");
+      log->setLogLevelTrace();
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "file", "log_info_log to a FileAppender loaded with setConfigFile",
+    [](const std::string & dir) {
+      return createFileLogger(dir, "bench-file");
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "file_async", "same as file, in asynchronous mode (flush included)",
+    [](const std::string & dir) {
+      Ftylog * log = createFileLogger(dir, "bench-file-async");
+      log->setAsyncMode(true);
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  list.push_back({ "file_async_per_thread", "same as file_async, with a queue per thread",
+    [](const std::string & dir) {
+      Ftylog * log = createFileLogger(dir, "bench-file-async-per-thread");
+      log->setPerThreadQueues(true);
+      log->setAsyncMode(true);
+      return log;
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  //Small files, to rotate a few times per run
+  const char * rollingProperties =
+    "log4cplus.appender.file.MaxFileSize=256KB\n"
+    "log4cplus.appender.file.MaxBackupIndex=3\n";
+
+  list.push_back({ "rolling_file", "log_info_log to a log4cplus::RollingFileAppender of 256KB",
+    [rollingProperties](const std::string & dir) {
+      return createFileLogger(dir, "bench-rolling-file", "log4cplus::RollingFileAppender",
+                              rollingProperties);
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    },
+    true });
+
+  list.push_back({ "rolling_file_prealloc", "same as rolling_file, with fty::PreallocatedRollingFileAppender",
+    [rollingProperties](const std::string & dir) {
+      return createFileLogger(dir, "bench-rolling-file-prealloc",
+                              "fty::PreallocatedRollingFileAppender", rollingProperties);
+    },
+    noThreadSetUp,
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    },
+    true });
+
+  list.push_back({ "mdc", "log_info_log to the console, with a context set by setContext",
+    [](const std::string &) {
+      //The pattern of the console appender is taken from the environment
+      const char * pattern = getenv("BIOS_LOG_PATTERN");
+      std::string savedPattern = (NULL != pattern) ? pattern : "";
+      setenv("BIOS_LOG_PATTERN", "%c [%t] -%-5p- %M (%l) [%X{asset}] [%X{request}] %m%n", 1);
+      Ftylog * log = new Ftylog("bench-mdc");
+      if (NULL != pattern)
+      {
+        setenv("BIOS_LOG_PATTERN", savedPattern.c_str(), 1);
+      }
+      else
+      {
+        unsetenv("BIOS_LOG_PATTERN");
+      }
+      log->setLogLevelTrace();
+      return log;
+    },
+    []() {
+      Ftylog::setContext({ { "asset", "datacenter-3" }, { "request", "42" } });
+    },
+    [](Ftylog * log, int i) {
+      log_info_log(log, "Processed metric %s value %f (%d)", "realpower.default", 1.5 * i, i);
+    } });
+
+  return list;
+}
+
+////////////////////////
+//Measure
+////////////////////////
+
+struct Result
+{
+  std::string scenario;
+  int threads;
+  unsigned long long calls;
+  double nsPerCall;
+  double callsPerSecond;
+  double allocationsPerCall;
+  //Latency percentiles of one call, if measured
+  bool latency;
+  double p50Ns;
+  double p99Ns;
+  double p999Ns;
+  double maxNs;
+};
+
+static Result run(const Scenario & scenario, Ftylog * log, int threadCount, int iterations)
+{
+  std::atomic<int> ready(0);
+  std::atomic<bool> start(false);
+  std::vector<std::thread> threads;
+  //Allocated before measuring, not to count the allocations
+  std::vector<std::vector<unsigned int>> latencies(threadCount);
+
+  for (int t = 0; t < threadCount; t++)
+  {
+    if (scenario.latency)
+    {
+      latencies[t].resize(iterations);
+    }
+    threads.push_back(std::thread([&, t]() {
+      scenario.setUpThread();
+      //Warm up the per-thread buffers and caches
+      for (int i = 0; i < 100; i++)
+      {
+        scenario.call(log, i);
+      }
+      ready.fetch_add(1);
+      while (!start.load())
+      {
+        std::this_thread::yield();
+      }
+      if (!scenario.latency)
+      {
+        for (int i = 0; i < iterations; i++)
+        {
+          scenario.call(log, i);
+        }
+        return;
+      }
+      unsigned int * latency = latencies[t].data();
+      for (int i = 0; i < iterations; i++)
+      {
+        auto callBegin = std::chrono::steady_clock::now();
+        scenario.call(log, i);
+        auto callEnd = std::chrono::steady_clock::now();
+        latency[i] = (unsigned int) std::min<long long>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(callEnd - callBegin).count(),
+          UINT_MAX);
+      }
+    }));
+  }
+  while (ready.load() < threadCount)
+  {
+    std::this_thread::yield();
+  }
+  log->flush();
+
+  unsigned long long allocations = s_allocations.load();
+  auto begin = std::chrono::steady_clock::now();
+  start.store(true);
+  for (auto & thread : threads)
+  {
+    thread.join();
+  }
+  log->flush();
+  auto end = std::chrono::steady_clock::now();
+  allocations = s_allocations.load() - allocations;
+
+  Result result;
+  result.scenario = scenario.name;
+  result.threads = threadCount;
+  result.calls = (unsigned long long) threadCount * iterations;
+  double elapsed = std::chrono::duration<double, std::nano>(end - begin).count();
+  //Time spent in one call by one thread
+  result.nsPerCall = elapsed * threadCount / result.calls;
+  result.callsPerSecond = result.calls / (elapsed / 1e9);
+  result.allocationsPerCall = (double) allocations / result.calls;
+
+  result.latency = scenario.latency;
+  result.p50Ns = result.p99Ns = result.p999Ns = result.maxNs = 0;
+  if (scenario.latency)
+  {
+    std::vector<unsigned int> all;
+    all.reserve(result.calls);
+    for (const auto & latency : latencies)
+    {
+      all.insert(all.end(), latency.begin(), latency.end());
+    }
+    std::sort(all.begin(), all.end());
+    result.p50Ns = all[all.size() / 2];
+    result.p99Ns = all[all.size() * 99 / 100];
+    result.p999Ns = all[all.size() * 999 / 1000];
+    result.maxNs = all.back();
+  }
+  return result;
+}
+
+////////////////////////
+//Startup
+////////////////////////
+
+//What a new process does until its first line, run with --first-line NAME
+struct Startup
+{
+  const char * name;
+  const char * description;
+  void (* firstLine)();
+};
+
+static std::vector<Startup> startups()
+{
+  return {
+    { "startup_none", "no logging, a line written to stderr (cost of starting the process)",
+      []() {
+        if (write(STDERR_FILENO, "First line\n", 11) != 11)
+        {
+          exit(EXIT_FAILURE);
+        }
+      } },
+    { "startup_default", "log_info with the default instance (default config file read)",
+      []() {
+        log_info("First line");
+      } },
+    { "startup_set_instance", "setInstanceFtylog without config file, then log_info",
+      []() {
+        ManageFtyLog::setInstanceFtylog("bench-startup");
+        log_info("First line");
+      } }
+  };
+}
+
+struct StartupResult
+{
+  std::string scenario;
+  int runs;
+  double minUs;
+  double medianUs;
+  double meanUs;
+};
+
+//Microseconds from the fork to the first line of the new process, or a
+//negative value if it wrote no line
+static double startOnce(const std::string & program, const Startup & startup)
+{
+  int output[2];
+  if (pipe(output) != 0)
+  {
+    perror("pipe");
+    return -1;
+  }
+  auto begin = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    dup2(output[1], STDOUT_FILENO);
+    dup2(output[1], STDERR_FILENO);
+    close(output[0]);
+    close(output[1]);
+    execl(program.c_str(), program.c_str(), "--first-line", startup.name, (char *) NULL);
+    _exit(127);
+  }
+  close(output[1]);
+  if (pid < 0)
+  {
+    perror("fork");
+    close(output[0]);
+    return -1;
+  }
+
+  bool line = false;
+  auto end = begin;
+  char buffer[4096];
+  ssize_t size;
+  //Read everything, so that the process does not block on a full pipe
+  while ((size = read(output[0], buffer, sizeof(buffer))) != 0)
+  {
+    if ((size < 0) && (errno != EINTR))
+    {
+      break;
+    }
+    if (!line && (size > 0) && (memchr(buffer, '\n', size) != NULL))
+    {
+      end = std::chrono::steady_clock::now();
+      line = true;
+    }
+  }
+  close(output[0]);
+  int status = 0;
+  while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR))
+  {
+  }
+  if (!line || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+  {
+    return -1;
+  }
+  return std::chrono::duration<double, std::micro>(end - begin).count();
+}
+
+static bool runStartup(const std::string & program, const Startup & startup, int runs,
+                       StartupResult & result)
+{
+  std::vector<double> times;
+  for (int i = 0; i < runs; i++)
+  {
+    double time = startOnce(program, startup);
+    if (time < 0)
+    {
+      return false;
+    }
+    times.push_back(time);
+  }
+  std::sort(times.begin(), times.end());
+  result.scenario = startup.name;
+  result.runs = runs;
+  result.minUs = times.front();
+  result.medianUs = times[times.size() / 2];
+  double total = 0;
+  for (double time : times)
+  {
+    total += time;
+  }
+  result.meanUs = total / times.size();
+  return true;
+}
+
+static int firstLine(const char * name)
+{
+  for (const Startup & startup : startups())
+  {
+    if (std::string(name) == startup.name)
+    {
+      startup.firstLine();
+      return EXIT_SUCCESS;
+    }
+  }
+  return EXIT_FAILURE;
+}
+
+static bool isSelected(const std::vector<std::string> & selected, const char * name)
+{
+  return selected.empty() || (std::find(selected.begin(), selected.end(), name) != selected.end());
+}
+
+////////////////////////
+//Main
+////////////////////////
+
+//Remove the configuration and log files of the file scenarios
+static void removeDirectory(const std::string & dir)
+{
+  DIR * handle = opendir(dir.c_str());
+  if (NULL != handle)
+  {
+    struct dirent * entry;
+    while ((entry = readdir(handle)) != NULL)
+    {
+      std::string name = entry->d_name;
+      if ((name != ".") && (name != ".."))
+      {
+        unlink((dir + "/" + name).c_str());
+      }
+    }
+    closedir(handle);
+  }
+  if (rmdir(dir.c_str()) != 0)
+  {
+    perror(dir.c_str());
+  }
+}
+
+static void usage(const char * program)
+{
+  printf("Usage: %s [--iterations N] [--threads 1,2,4,...] [--startup-runs N] [--scenario NAME]...\n"
+         "       [--output FILE]\n", program);
+  printf("  --iterations N    logging calls per thread (default 20000)\n");
+  printf("  --threads LIST    numbers of threads to run (default 1,2,4,8,16,32,64)\n");
+  printf("  --startup-runs N  processes started per startup scenario (default 20, 0 for none)\n");
+  printf("  --scenario NAME   run only this scenario (may be repeated)\n");
+  printf("  --output FILE     write the JSON report to FILE instead of stdout\n");
+  printf("Scenarios:\n");
+  for (const Scenario & scenario : scenarios())
+  {
+    printf("  %-20s %s\n", scenario.name, scenario.description);
+  }
+  for (const Startup & startup : startups())
+  {
+    printf("  %-20s %s\n", startup.name, startup.description);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  //A new process of a startup scenario
+  if ((argc == 3) && (std::string(argv[1]) == "--first-line"))
+  {
+    return firstLine(argv[2]);
+  }
+
+  int iterations = 20000;
+  int startupRuns = 20;
+  std::vector<int> threadCounts = { 1, 2, 4, 8, 16, 32, 64 };
+  std::vector<std::string> selected;
+  const char * output = NULL;
+
+  for (int argn = 1; argn < argc; argn++)
+  {
+    std::string arg = argv[argn];
+    if ((arg == "--help") || (arg == "-h"))
+    {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    else if ((arg == "--iterations") && (argn + 1 < argc))
+    {
+      iterations = atoi(argv[++argn]);
+    }
+    else if ((arg == "--threads") && (argn + 1 < argc))
+    {
+      threadCounts.clear();
+      std::string list = argv[++argn];
+      size_t begin = 0;
+      while (begin < list.size())
+      {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+        {
+          end = list.size();
+        }
+        threadCounts.push_back(atoi(list.substr(begin, end - begin).c_str()));
+        begin = end + 1;
+      }
+    }
+    else if ((arg == "--startup-runs") && (argn + 1 < argc))
+    {
+      startupRuns = atoi(argv[++argn]);
+    }
+    else if ((arg == "--scenario") && (argn + 1 < argc))
+    {
+      selected.push_back(argv[++argn]);
+    }
+    else if ((arg == "--output") && (argn + 1 < argc))
+    {
+      output = argv[++argn];
+    }
+    else
+    {
+      fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (iterations <= 0)
+  {
+    fprintf(stderr, "The number of iterations must be positive\n");
+    return EXIT_FAILURE;
+  }
+  if (startupRuns < 0)
+  {
+    fprintf(stderr, "The number of startup runs must not be negative\n");
+    return EXIT_FAILURE;
+  }
+  for (int threadCount : threadCounts)
+  {
+    if (threadCount <= 0)
+    {
+      fprintf(stderr, "The numbers of threads must be positive\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  char dirTemplate[] = "/tmp/fty-common-logging-bench-XXXXXX";
+  if (NULL == mkdtemp(dirTemplate))
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  std::string dir = dirTemplate;
+
+  //Keep stdout for the report and stderr for the progress, the console
+  //appenders write to /dev/null
+  fflush(stdout);
+  fflush(stderr);
+  int reportFd = dup(STDOUT_FILENO);
+  int progressFd = dup(STDERR_FILENO);
+  int devNull = open("/dev/null", O_WRONLY);
+  if ((reportFd < 0) || (progressFd < 0) || (devNull < 0) ||
+      (dup2(devNull, STDOUT_FILENO) < 0) || (dup2(devNull, STDERR_FILENO) < 0))
+  {
+    perror("Can't redirect the console output");
+    return EXIT_FAILURE;
+  }
+  close(devNull);
+  FILE * progress = fdopen(progressFd, "w");
+  setvbuf(progress, NULL, _IOLBF, 0);
+
+  //Started first, while this process is small and has a single thread
+  std::vector<StartupResult> startupResults;
+  if (startupRuns > 0)
+  {
+    char program[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", program, sizeof(program) - 1);
+    if (length < 0)
+    {
+      perror("/proc/self/exe");
+      return EXIT_FAILURE;
+    }
+    program[length] = '\0';
+    //The first line is logged at INFO level
+    const char * level = getenv("BIOS_LOG_LEVEL");
+    std::string savedLevel = (NULL != level) ? level : "";
+    setenv("BIOS_LOG_LEVEL", "LOG_INFO", 1);
+    for (const Startup & startup : startups())
+    {
+      if (!isSelected(selected, startup.name))
+      {
+        continue;
+      }
+      StartupResult result;
+      if (!runStartup(program, startup, startupRuns, result))
+      {
+        fprintf(progress, "%-20s failed: no line on the console (see the default config file)\n",
+                startup.name);
+        continue;
+      }
+      startupResults.push_back(result);
+      fprintf(progress, "%-20s %10.1f us to the first line (median, min %.1f us)\n",
+              startup.name, result.medianUs, result.minUs);
+    }
+    if (NULL != level)
+    {
+      setenv("BIOS_LOG_LEVEL", savedLevel.c_str(), 1);
+    }
+    else
+    {
+      unsetenv("BIOS_LOG_LEVEL");
+    }
+  }
+
+  std::vector<Result> results;
+  for (const Scenario & scenario : scenarios())
+  {
+    if (!isSelected(selected, scenario.name))
+    {
+      continue;
+    }
+    Ftylog * log = scenario.setUp(dir);
+    for (int threadCount : threadCounts)
+    {
+      results.push_back(run(scenario, log, threadCount, iterations));
+      fprintf(progress, "%-14s %2d threads: %10.1f ns/call %6.2f allocations/call",
+              scenario.name, threadCount, results.back().nsPerCall,
+              results.back().allocationsPerCall);
+      if (results.back().latency)
+      {
+        fprintf(progress, " p99 %.0f ns max %.0f ns", results.back().p99Ns, results.back().maxNs);
+      }
+      fprintf(progress, "\n");
+    }
+    delete log;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(progressFd, STDERR_FILENO);
+  fclose(progress);
+  FILE * report = (NULL != output) ? fopen(output, "w") : fdopen(reportFd, "w");
+  if (NULL == report)
+  {
+    perror(output);
+    return EXIT_FAILURE;
+  }
+  fprintf(report, "{\n  \"iterations_per_thread\": %d,\n  \"results\": [", iterations);
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result & result = results[i];
+    fprintf(report, "%s\n    { \"scenario\": \"%s\", \"threads\": %d, \"calls\": %llu, "
+            "\"ns_per_call\": %.1f, \"calls_per_second\": %.0f, \"allocations_per_call\": %.3f",
+            (i == 0) ? "" : ",", result.scenario.c_str(), result.threads, result.calls,
+            result.nsPerCall, result.callsPerSecond, result.allocationsPerCall);
+    if (result.latency)
+    {
+      fprintf(report, ", \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f",
+              result.p50Ns, result.p99Ns, result.p999Ns, result.maxNs);
+    }
+    fprintf(report, " }");
+  }
+  fprintf(report, "\n  ],\n  \"startup\": [");
+  for (size_t i = 0; i < startupResults.size(); i++)
+  {
+    const StartupResult & result = startupResults[i];
+    fprintf(report, "%s\n    { \"scenario\": \"%s\", \"runs\": %d, \"min_us\": %.1f, "
+            "\"median_us\": %.1f, \"mean_us\": %.1f }",
+            (i == 0) ? "" : ",", result.scenario.c_str(), result.runs, result.minUs,
+            result.medianUs, result.meanUs);
+  }
+  fprintf(report, "\n  ]\n}\n");
+  fclose(report);
+  if (NULL != output)
+  {
+    close(reportFd);
+  }
+
+  removeDirectory(dir);
+  return EXIT_SUCCESS;
+}
@@ -37,6 +37,24 @@
 //  Extra headers
 
 //  Internal API
+
+#include "fty-log/fty_log_backend.h"
+#include "fty-log/fty_log_batch.h"
+#include "fty-log/fty_log_buffer.h"
+#include "fty-log/fty_log_compress.h"
+#include "fty-log/fty_log_context.h"
+#include "fty-log/fty_log_deferred.h"
+#include "fty-log/fty_log_journal.h"
+#include "fty-log/fty_log_json.h"
+#include "fty-log/fty_log_levels.h"
+#include "fty-log/fty_log_pattern.h"
+#include "fty-log/fty_log_prealloc.h"
+#include "fty-log/fty_log_recorder.h"
+#include "fty-log/fty_log_ringfile.h"
+#include "fty-log/fty_log_stats.h"
+#include "fty-log/fty_log_timestamp.h"
+#include "fty-log/fty_log_watcher.h"
+
 // common definitions and idioms from czmq_prelude.h, which are used in generated code
 #if ! defined(__CZMQ_PRELUDE_H_INCLUDED__)
 #include <stdlib.h>